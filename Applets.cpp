@@ -0,0 +1,518 @@
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <ctype.h>
+#include "Applets.h"
+
+// Helper functions
+
+static bool parseLongLong(const char* str, long long& value) {
+    if (*str == '\0') {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    value = strtoll(str, &end, 0);
+    return *end == '\0' && errno == 0;
+}
+
+static bool parseCount(const char* str, long long& value) {
+    return isdigit(*str) && parseLongLong(str, value) && value >= 0;
+}
+
+// Opens the single input operand of head/wc ("-" or none is the standard input)
+static int openInput(const char* path, int in_fd) {
+    if (path == nullptr || strcmp(path, "-") == 0) {
+        return in_fd;
+    }
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static void closeInput(int fd, int in_fd) {
+    if (fd != in_fd) {
+        close(fd);
+    }
+}
+
+// true / false
+
+static int appletTrue(int, char**, int, std::ostream&) {
+    return 0;
+}
+
+static int appletFalse(int, char**, int, std::ostream&) {
+    return 1;
+}
+
+// echo [-n] [-E] args...
+
+static int appletEcho(int argc, char** argv, int, std::ostream& out) {
+    bool newline = true;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strspn(argv[i] + 1, "neE") != strlen(argv[i] + 1)) {
+            break; // Not an option, printed as is
+        }
+        if (strchr(argv[i], 'e') != nullptr) {
+            return APPLET_FALLBACK; // Backslash escapes
+        }
+        if (strchr(argv[i], 'n') != nullptr) {
+            newline = false;
+        }
+    }
+    for (int first = i; i < argc; i++) {
+        if (i > first) {
+            out << ' ';
+        }
+        out << argv[i];
+    }
+    if (newline) {
+        out << '\n';
+    }
+    return 0;
+}
+
+/*
+ * printf FORMAT [ARGS]
+ * Conversions: %s %c %d %i %u %o %x %X %% with flags, width and precision, and the common
+ * backslash escapes. The format is reused while arguments remain. The output is built first,
+ * so anything unsupported (floating point, %b, invalid numbers) can still fall back.
+ */
+static bool appendEscape(const char*& pos, std::string& result) {
+    switch (*++pos) {
+        case 'n': result += '\n'; break;
+        case 't': result += '\t'; break;
+        case 'r': result += '\r'; break;
+        case 'a': result += '\a'; break;
+        case 'b': result += '\b'; break;
+        case 'f': result += '\f'; break;
+        case 'v': result += '\v'; break;
+        case '\\': result += '\\'; break;
+        case '"': result += '"'; break;
+        case '\'': result += '\''; break;
+        default: return false;
+    }
+    return true;
+}
+
+static int appletPrintf(int argc, char** argv, int, std::ostream& out) {
+    if (argc < 2) {
+        return APPLET_FALLBACK;
+    }
+    const char* format = argv[1];
+    int next_arg = 2;
+    std::string result;
+
+    do {
+        int first_arg = next_arg;
+        for (const char* pos = format; *pos != '\0'; pos++) {
+            if (*pos == '\\') {
+                if (!appendEscape(pos, result)) {
+                    return APPLET_FALLBACK;
+                }
+                continue;
+            }
+            if (*pos != '%') {
+                result += *pos;
+                continue;
+            }
+            if (pos[1] == '%') {
+                result += '%';
+                pos++;
+                continue;
+            }
+
+            // %[flags][width][.precision]conversion
+            std::string spec = "%";
+            const char* spec_start = ++pos;
+            pos += strspn(pos, "-+ #0");
+            pos += strspn(pos, "0123456789");
+            if (*pos == '.') {
+                pos++;
+                pos += strspn(pos, "0123456789");
+            }
+            spec.append(spec_start, pos - spec_start);
+
+            const char* arg = (next_arg < argc) ? argv[next_arg++] : nullptr;
+            char buffer[512];
+            int len;
+            long long number = 0;
+            switch (*pos) {
+                case 's':
+                    len = snprintf(buffer, sizeof(buffer), (spec + "s").c_str(), arg ? arg : "");
+                    break;
+                case 'c':
+                    if (arg == nullptr || *arg == '\0') {
+                        continue;
+                    }
+                    len = snprintf(buffer, sizeof(buffer), (spec + "c").c_str(), *arg);
+                    break;
+                case 'd': case 'i':
+                    if (arg != nullptr && !parseLongLong(arg, number)) {
+                        return APPLET_FALLBACK;
+                    }
+                    len = snprintf(buffer, sizeof(buffer), (spec + "lld").c_str(), number);
+                    break;
+                case 'u': case 'o': case 'x': case 'X':
+                    if (arg != nullptr && !parseLongLong(arg, number)) {
+                        return APPLET_FALLBACK;
+                    }
+                    len = snprintf(buffer, sizeof(buffer), (spec + "ll" + *pos).c_str(),
+                                   static_cast<unsigned long long>(number));
+                    break;
+                default:
+                    return APPLET_FALLBACK;
+            }
+            if (len < 0 || len >= static_cast<int>(sizeof(buffer))) {
+                return APPLET_FALLBACK;
+            }
+            result.append(buffer, len);
+        }
+        if (next_arg == first_arg) {
+            break; // The format does not consume arguments
+        }
+    } while (next_arg < argc);
+
+    out << result;
+    return 0;
+}
+
+// sleep NUMBER[smhd]...
+
+static int appletSleep(int argc, char** argv, int, std::ostream&) {
+    if (argc < 2) {
+        return APPLET_FALLBACK;
+    }
+    double seconds = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!isdigit(argv[i][0]) && argv[i][0] != '.') {
+            return APPLET_FALLBACK;
+        }
+        char* end;
+        double value = strtod(argv[i], &end);
+        switch (*end) {
+            case '\0': case 's': break;
+            case 'm': value *= 60; break;
+            case 'h': value *= 60 * 60; break;
+            case 'd': value *= 24 * 60 * 60; break;
+            default: return APPLET_FALLBACK;
+        }
+        if (*end != '\0' && end[1] != '\0') {
+            return APPLET_FALLBACK;
+        }
+        seconds += value;
+    }
+
+    // What the shell printed so far shows up before the wait
+    std::cout.flush();
+    struct timespec remaining;
+    remaining.tv_sec = static_cast<time_t>(seconds);
+    remaining.tv_nsec = static_cast<long>((seconds - remaining.tv_sec) * 1e9);
+    if (nanosleep(&remaining, &remaining) == -1 && errno == EINTR) {
+        // Interrupted by ctrl-C, like a process killed by SIGINT
+        return 128 + 2;
+    }
+    return 0;
+}
+
+/*
+ * test EXPRESSION / [ EXPRESSION ]
+ * Up to four arguments: string tests, "!", the common file tests and the string and
+ * integer comparisons. -a/-o, parentheses and invalid operands run the real binary.
+ */
+static int testUnary(const char* op, const char* operand) {
+    if (strcmp(op, "-n") == 0) {
+        return *operand != '\0' ? 0 : 1;
+    }
+    if (strcmp(op, "-z") == 0) {
+        return *operand == '\0' ? 0 : 1;
+    }
+    if (op[0] != '-' || op[1] == '\0' || op[2] != '\0') {
+        return APPLET_FALLBACK;
+    }
+
+    struct stat sb;
+    bool is_link_test = (op[1] == 'L' || op[1] == 'h');
+    if (strchr("efdsLhpSbcrwx", op[1]) == nullptr) {
+        return APPLET_FALLBACK;
+    }
+    if (op[1] == 'r' || op[1] == 'w' || op[1] == 'x') {
+        int mode = (op[1] == 'r') ? R_OK : (op[1] == 'w') ? W_OK : X_OK;
+        return access(operand, mode) == 0 ? 0 : 1;
+    }
+    if ((is_link_test ? lstat(operand, &sb) : stat(operand, &sb)) == -1) {
+        return 1;
+    }
+    switch (op[1]) {
+        case 'e': return 0;
+        case 'f': return S_ISREG(sb.st_mode) ? 0 : 1;
+        case 'd': return S_ISDIR(sb.st_mode) ? 0 : 1;
+        case 's': return sb.st_size > 0 ? 0 : 1;
+        case 'L': case 'h': return S_ISLNK(sb.st_mode) ? 0 : 1;
+        case 'p': return S_ISFIFO(sb.st_mode) ? 0 : 1;
+        case 'S': return S_ISSOCK(sb.st_mode) ? 0 : 1;
+        case 'b': return S_ISBLK(sb.st_mode) ? 0 : 1;
+        default: return S_ISCHR(sb.st_mode) ? 0 : 1;
+    }
+}
+
+static int testBinary(const char* left, const char* op, const char* right) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+        return strcmp(left, right) == 0 ? 0 : 1;
+    }
+    if (strcmp(op, "!=") == 0) {
+        return strcmp(left, right) != 0 ? 0 : 1;
+    }
+
+    static const char* const COMPARISONS[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    int comparison = -1;
+    for (int i = 0; i < 6; i++) {
+        if (strcmp(op, COMPARISONS[i]) == 0) {
+            comparison = i;
+        }
+    }
+    long long a, b;
+    if (comparison == -1 || !parseLongLong(left, a) || !parseLongLong(right, b)) {
+        return APPLET_FALLBACK;
+    }
+    bool result[] = {a == b, a != b, a < b, a <= b, a > b, a >= b};
+    return result[comparison] ? 0 : 1;
+}
+
+static int negate(int result) {
+    return (result == APPLET_FALLBACK) ? result : 1 - result;
+}
+
+static int evaluateTest(int argc, char** argv) {
+    switch (argc) {
+        case 0:
+            return 1;
+        case 1:
+            return *argv[0] != '\0' ? 0 : 1;
+        case 2:
+            if (strcmp(argv[0], "!") == 0) {
+                return negate(evaluateTest(1, argv + 1));
+            }
+            return testUnary(argv[0], argv[1]);
+        case 3:
+            if (strcmp(argv[0], "!") == 0) {
+                return negate(evaluateTest(2, argv + 1));
+            }
+            return testBinary(argv[0], argv[1], argv[2]);
+        case 4:
+            if (strcmp(argv[0], "!") == 0) {
+                return negate(evaluateTest(3, argv + 1));
+            }
+            return APPLET_FALLBACK;
+        default:
+            return APPLET_FALLBACK;
+    }
+}
+
+static int appletTest(int argc, char** argv, int, std::ostream&) {
+    return evaluateTest(argc - 1, argv + 1);
+}
+
+static int appletBracket(int argc, char** argv, int, std::ostream&) {
+    if (argc < 2 || strcmp(argv[argc - 1], "]") != 0) {
+        return APPLET_FALLBACK;
+    }
+    return evaluateTest(argc - 2, argv + 1);
+}
+
+// head [-n N | -c N | -N] [FILE]
+
+static int appletHead(int argc, char** argv, int in_fd, std::ostream& out) {
+    long long count = 10;
+    bool count_bytes = false;
+    const char* path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if ((strcmp(arg, "-n") == 0 || strcmp(arg, "-c") == 0) && i + 1 < argc) {
+            count_bytes = (arg[1] == 'c');
+            if (!parseCount(argv[++i], count)) {
+                return APPLET_FALLBACK;
+            }
+        } else if ((strncmp(arg, "-n", 2) == 0 || strncmp(arg, "-c", 2) == 0) && arg[2] != '\0') {
+            count_bytes = (arg[1] == 'c');
+            if (!parseCount(arg + 2, count)) {
+                return APPLET_FALLBACK;
+            }
+        } else if (arg[0] == '-' && isdigit(arg[1])) {
+            if (!parseCount(arg + 1, count)) {
+                return APPLET_FALLBACK;
+            }
+        } else if ((arg[0] == '-' && arg[1] != '\0') || path != nullptr) {
+            return APPLET_FALLBACK; // Other options or several files
+        } else {
+            path = arg;
+        }
+    }
+
+    int fd = openInput(path, in_fd);
+    if (fd == -1) {
+        return APPLET_FALLBACK; // Let the real head report the error
+    }
+
+    char buffer[64 * 1024];
+    while (count > 0) {
+        ssize_t bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            break;
+        }
+        ssize_t end = bytes;
+        if (count_bytes) {
+            end = std::min<long long>(bytes, count);
+            count -= end;
+        } else {
+            const char* pos = buffer;
+            while (count > 0 && (pos = static_cast<const char*>(memchr(pos, '\n', buffer + bytes - pos))) != nullptr) {
+                pos++;
+                count--;
+            }
+            if (count == 0) {
+                end = pos - buffer;
+            }
+        }
+        out.write(buffer, end);
+    }
+    closeInput(fd, in_fd);
+    return 0;
+}
+
+// wc [-l] [-w] [-c] [FILE]
+
+static int appletWc(int argc, char** argv, int in_fd, std::ostream& out) {
+    bool show_lines = false, show_words = false, show_bytes = false;
+    const char* path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (arg[0] == '-' && arg[1] != '\0') {
+            if (arg[1] == '-' || strspn(arg + 1, "lwc") != strlen(arg + 1)) {
+                return APPLET_FALLBACK;
+            }
+            show_lines |= (strchr(arg, 'l') != nullptr);
+            show_words |= (strchr(arg, 'w') != nullptr);
+            show_bytes |= (strchr(arg, 'c') != nullptr);
+        } else if (path != nullptr) {
+            return APPLET_FALLBACK; // Several files print a total line
+        } else {
+            path = arg;
+        }
+    }
+    if (!show_lines && !show_words && !show_bytes) {
+        show_lines = show_words = show_bytes = true;
+    }
+
+    int fd = openInput(path, in_fd);
+    if (fd == -1) {
+        return APPLET_FALLBACK;
+    }
+
+    long long lines = 0, words = 0, bytes = 0;
+    bool in_word = false;
+    char buffer[64 * 1024];
+    while (true) {
+        ssize_t nread = read(fd, buffer, sizeof(buffer));
+        if (nread == -1 && errno == EINTR) {
+            continue;
+        }
+        if (nread <= 0) {
+            break;
+        }
+        bytes += nread;
+        for (ssize_t i = 0; i < nread; i++) {
+            char c = buffer[i];
+            lines += (c == '\n');
+            bool is_space = (c == ' ' || (c >= '\t' && c <= '\r'));
+            words += (!is_space && !in_word);
+            in_word = !is_space;
+        }
+    }
+
+    // Same column width as GNU wc: 1 for a single count, otherwise the digits of the file size
+    int width = 1;
+    if (show_lines + show_words + show_bytes > 1) {
+        struct stat sb;
+        if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+            width = std::to_string(static_cast<long long>(sb.st_size)).size();
+        } else {
+            width = 7;
+        }
+    }
+    closeInput(fd, in_fd);
+
+    std::string line;
+    long long counts[] = {lines, words, bytes};
+    bool shown[] = {show_lines, show_words, show_bytes};
+    for (int i = 0; i < 3; i++) {
+        if (!shown[i]) {
+            continue;
+        }
+        std::string number = std::to_string(counts[i]);
+        if (!line.empty()) {
+            line += ' ';
+        }
+        if (static_cast<int>(number.size()) < width) {
+            line.append(width - number.size(), ' ');
+        }
+        line += number;
+    }
+    if (path != nullptr) {
+        line += ' ';
+        line += path;
+    }
+    out << line << '\n';
+    return 0;
+}
+
+// Applets table
+
+static Applet APPLETS[] = {
+        {"echo", appletEcho, true},
+        {"printf", appletPrintf, true},
+        {"true", appletTrue, true},
+        {"false", appletFalse, true},
+        {"test", appletTest, true},
+        {"[", appletBracket, true},
+        {"sleep", appletSleep, true},
+        {"head", appletHead, true},
+        {"wc", appletWc, true},
+};
+
+const Applet* findApplet(const char* name) {
+    for (const auto& applet : APPLETS) {
+        if (applet.enabled && strcmp(applet.name, name) == 0) {
+            return &applet;
+        }
+    }
+    return nullptr;
+}
+
+bool setAppletEnabled(const char* name, bool enabled) {
+    for (auto& applet : APPLETS) {
+        if (strcmp(applet.name, name) == 0) {
+            applet.enabled = enabled;
+            return true;
+        }
+    }
+    return false;
+}
+
+void printApplets(std::ostream& out) {
+    for (const auto& applet : APPLETS) {
+        out << applet.name << ": " << (applet.enabled ? "enabled" : "disabled") << '\n';
+    }
+}
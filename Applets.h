@@ -0,0 +1,31 @@
+#ifndef SMASH_APPLETS_H_
+#define SMASH_APPLETS_H_
+
+#include <ostream>
+
+/*
+ * Small utilities (echo, test, true, printf, ...) implemented inside the shell, busybox style,
+ * so the common ones do not pay for a fork and exec.
+ * An applet returns its exit status, or APPLET_FALLBACK before producing any output when it
+ * does not support the given arguments - the real binary is executed instead.
+ */
+#define APPLET_FALLBACK (-1)
+
+typedef int (*AppletMain)(int argc, char** argv, int in_fd, std::ostream& out);
+
+struct Applet {
+    const char* name;
+    AppletMain main;
+    bool enabled;
+};
+
+// Returns the enabled applet called name, or NULL
+const Applet* findApplet(const char* name);
+
+// Enables or disables an applet by name, returns false when there is no such applet
+bool setAppletEnabled(const char* name, bool enabled);
+
+// Lists every applet with its state
+void printApplets(std::ostream& out);
+
+#endif //SMASH_APPLETS_H_
@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arena.h"
+
+static thread_local Arena* current_arena = nullptr;
+
+Arena::Arena() : m_head(nullptr), m_current(nullptr) {}
+
+Arena::~Arena() {
+    Chunk* chunk = m_head;
+    while (chunk != nullptr) {
+        Chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+Arena::Chunk* Arena::newChunk(size_t min_size) {
+    size_t size = (min_size > DEFAULT_CHUNK_SIZE) ? min_size : DEFAULT_CHUNK_SIZE;
+    auto* chunk = static_cast<Chunk*>(malloc(sizeof(Chunk) + size));
+    if (chunk == nullptr) {
+        throw std::bad_alloc();
+    }
+    chunk->next = nullptr;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+    if (m_current == nullptr) {
+        m_head = m_current = newChunk(size + alignment);
+    }
+
+    while (true) {
+        // The address is aligned, not the offset: the data follows the chunk header
+        uintptr_t start = reinterpret_cast<uintptr_t>(m_current->data());
+        size_t offset = ((start + m_current->used + alignment - 1) & ~(alignment - 1)) - start;
+        if (offset + size <= m_current->size) {
+            m_current->used = offset + size;
+            return m_current->data() + offset;
+        }
+        // Reuse chunks left over from previous lines before growing the chain
+        if (m_current->next == nullptr) {
+            m_current->next = newChunk(size + alignment);
+        }
+        m_current = m_current->next;
+        m_current->used = 0;
+    }
+}
+
+char* Arena::strndup(const char* str, size_t len) {
+    char* copy = static_cast<char*>(allocate(len + 1, 1));
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char* Arena::strdup(const char* str) {
+    return strndup(str, strlen(str));
+}
+
+void Arena::reset() {
+    m_current = m_head;
+    if (m_current != nullptr) {
+        m_current->used = 0;
+    }
+}
+
+Arena::Mark Arena::mark() const {
+    return {m_current, (m_current != nullptr) ? m_current->used : 0};
+}
+
+void Arena::rewind(const Mark& mark) {
+    if (mark.chunk == nullptr) {
+        reset();
+        return;
+    }
+    m_current = mark.chunk;
+    m_current->used = mark.used;
+}
+
+Arena* Arena::current() {
+    return current_arena;
+}
+
+void Arena::setCurrent(Arena* arena) {
+    current_arena = arena;
+}
@@ -0,0 +1,96 @@
+#ifndef SMASH_ARENA_H_
+#define SMASH_ARENA_H_
+
+#include <cstddef>
+#include <new>
+#include <string>
+
+/*
+ * Monotonic (bump pointer) allocator used for everything that only lives
+ * while a single command line is executed: the Command objects themselves,
+ * their argument vectors and their string members.
+ * Memory is handed out from a chain of chunks and is never freed one object
+ * at a time - reset() rewinds the arena to its first chunk in O(1) and keeps
+ * the chunks for the next line, so the shell's heap stops growing/fragmenting.
+ */
+class Arena {
+    struct Chunk {
+        Chunk* next;
+        size_t size;
+        size_t used;
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    static const size_t DEFAULT_CHUNK_SIZE = 16 * 1024;
+
+    Chunk* m_head;
+    Chunk* m_current;
+
+    static Chunk* newChunk(size_t min_size);
+
+public:
+    // A position in the arena, see rewind()
+    struct Mark {
+        Chunk* chunk;
+        size_t used;
+    };
+
+    Arena();
+    ~Arena();
+    Arena(Arena const &) = delete;
+    void operator=(Arena const &) = delete;
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    char* strdup(const char* str);
+    char* strndup(const char* str, size_t len);
+    void reset();
+
+    // Releases everything allocated after mark was taken, like reset() does for the whole arena
+    Mark mark() const;
+    void rewind(const Mark& mark);
+
+    // The arena new allocations of the calling thread are taken from (may be NULL)
+    static Arena* current();
+    static void setCurrent(Arena* arena);
+};
+
+/*
+ * std allocator adapter - containers constructed while an arena is current
+ * take their memory from it, otherwise they fall back to the global heap.
+ */
+template <typename T>
+class ArenaAllocator {
+    template <typename U> friend class ArenaAllocator;
+    Arena* m_arena;
+
+public:
+    typedef T value_type;
+
+    ArenaAllocator() : m_arena(Arena::current()) {}
+    explicit ArenaAllocator(Arena* arena) : m_arena(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.m_arena) {}
+
+    T* allocate(size_t n) {
+        if (m_arena == nullptr) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t) {
+        // Arena memory is released in bulk by Arena::reset()
+        if (m_arena == nullptr) {
+            ::operator delete(p);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return m_arena == other.m_arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return m_arena != other.m_arena; }
+};
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+
+#endif //SMASH_ARENA_H_
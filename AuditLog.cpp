@@ -0,0 +1,304 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include "AuditLog.h"
+
+// Set in the children forked while the log is open, the writer thread is not theirs
+static volatile bool forked = false;
+
+static void markForked() {
+    forked = true;
+}
+
+static int64_t monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+static char* appendText(char* out, const char* text) {
+    while (*text != '\0') {
+        *out++ = *text++;
+    }
+    return out;
+}
+
+// The digits of value, at least width of them
+static char* appendNumber(char* out, int64_t value, int width = 1) {
+    if (value < 0) {
+        *out++ = '-';
+        value = -value;
+    }
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0 || count < width);
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+// The command as a JSON string, without the quotes
+static char* appendEscaped(char* out, const char* text, size_t length) {
+    static const char HEX[] = "0123456789abcdef";
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c == '"' || c == '\\') {
+            *out++ = '\\';
+            *out++ = static_cast<char>(c);
+        } else if (c < 0x20) {
+            out = appendText(out, "\\u00");
+            *out++ = HEX[c >> 4];
+            *out++ = HEX[c & 0xf];
+        } else {
+            *out++ = static_cast<char>(c);
+        }
+    }
+    return out;
+}
+
+// The longest line a record makes: every command byte escaped as \u00XX, plus the fields
+static const size_t MAX_LINE_SIZE = 6 * AuditLog::COMMAND_SIZE + 256;
+
+/*
+ * The UTC date of a day counted from 1970-01-01, in the proleptic Gregorian calendar. Computed
+ * here rather than with gmtime_r(), which takes a glibc lock and may load the time zone file.
+ */
+static void civilFromDays(int64_t days, int64_t& year, int& month, int& day) {
+    days += 719468;                                     // From 0000-03-01, years start in March
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int64_t day_of_era = days - era * 146097;           // [0, 146096]
+    int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int64_t month_index = (5 * day_of_year + 2) / 153;  // [0, 11], March first
+    day = static_cast<int>(day_of_year - (153 * month_index + 2) / 5 + 1);
+    month = static_cast<int>(month_index < 10 ? month_index + 3 : month_index - 9);
+    year = year_of_era + era * 400 + (month <= 2);
+}
+
+static char* formatRecord(char* out, const AuditLog::Record& record) {
+    int64_t seconds = record.timeNs / 1000000000;
+    int64_t days = seconds / 86400;
+    int64_t second_of_day = seconds % 86400;
+    int64_t year;
+    int month;
+    int day;
+    civilFromDays(days, year, month, day);
+    out = appendText(out, "{\"time\":\"");
+    out = appendNumber(out, year, 4);
+    *out++ = '-';
+    out = appendNumber(out, month, 2);
+    *out++ = '-';
+    out = appendNumber(out, day, 2);
+    *out++ = 'T';
+    out = appendNumber(out, second_of_day / 3600, 2);
+    *out++ = ':';
+    out = appendNumber(out, second_of_day / 60 % 60, 2);
+    *out++ = ':';
+    out = appendNumber(out, second_of_day % 60, 2);
+    *out++ = '.';
+    out = appendNumber(out, record.timeNs % 1000000000 / 1000, 6);
+    out = appendText(out, "Z\",\"pid\":");
+    out = appendNumber(out, record.pid);
+    out = appendText(out, ",\"job\":");
+    out = appendNumber(out, record.jobId);
+    out = appendText(out, ",\"status\":");
+    out = appendNumber(out, record.status);
+    out = appendText(out, ",\"duration_us\":");
+    out = appendNumber(out, record.durationNs / 1000);
+    out = appendText(out, ",\"command\":\"");
+    out = appendEscaped(out, record.command, record.length);
+    return appendText(out, "\"}\n");
+}
+
+static bool writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t count = write(fd, data, size);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+AuditLog::AuditLog() : m_head(0), m_tail(0), m_dropped(0), m_written(0), m_stop(false), m_ring(nullptr),
+        m_fd(-1), m_wakeFd(-1), m_running(false), m_writer(), m_owner(0) {}
+
+AuditLog::~AuditLog() {
+    close();
+    delete[] m_ring;
+}
+
+bool AuditLog::open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        perror("smash error: open failed");
+        return false;
+    }
+    int wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd == -1) {
+        perror("smash error: eventfd failed");
+        ::close(fd);
+        return false;
+    }
+    static bool fork_handler = false;
+    if (!fork_handler) {
+        pthread_atfork(nullptr, nullptr, markForked);
+        fork_handler = true;
+    }
+    if (m_ring == nullptr) {
+        m_ring = new Record[CAPACITY];
+    }
+    m_fd = fd;
+    m_wakeFd = wake_fd;
+    m_path = path;
+    m_head.store(0);
+    m_tail.store(0);
+    m_stop.store(false);
+    m_owner = getpid();
+
+    // Signals stay with the shell's thread (ctrl-C, and the SIGCHLD read from signalfds)
+    sigset_t all;
+    sigset_t old_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+    int error = pthread_create(&m_writer, nullptr, writerMain, this);
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    if (error != 0) {
+        errno = error;
+        perror("smash error: pthread_create failed");
+        ::close(m_fd);
+        ::close(m_wakeFd);
+        m_fd = m_wakeFd = -1;
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+void AuditLog::close() {
+    if (!m_running) {
+        return;
+    }
+    m_running = false;
+    // Only the process that started the writer can stop it
+    if (!forked && getpid() == m_owner) {
+        m_stop.store(true, std::memory_order_release);
+        uint64_t wake = 1;
+        if (write(m_wakeFd, &wake, sizeof(wake)) == -1) {
+            perror("smash error: write failed");
+        }
+        pthread_join(m_writer, nullptr);
+    }
+    ::close(m_fd);
+    ::close(m_wakeFd);
+    m_fd = m_wakeFd = -1;
+}
+
+bool AuditLog::isOpen() const {
+    return m_running;
+}
+
+bool AuditLog::record(int64_t time_ns, int64_t duration_ns, pid_t pid, int job_id, int status,
+                      const char* command, size_t length) {
+    if (!m_running || forked) {
+        return false;
+    }
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) == CAPACITY) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    Record& record = m_ring[head & (CAPACITY - 1)];
+    record.timeNs = time_ns;
+    record.durationNs = duration_ns;
+    record.pid = pid;
+    record.jobId = job_id;
+    record.status = status;
+    record.length = static_cast<uint32_t>(length < COMMAND_SIZE ? length : COMMAND_SIZE);
+    memcpy(record.command, command, record.length);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+size_t AuditLog::drain() {
+    char buffer[64 * 1024];
+    char* out = buffer;
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    size_t lost = 0;
+    size_t batch = 0;
+    for (uint64_t i = tail; i < head; i++) {
+        out = formatRecord(out, m_ring[i & (CAPACITY - 1)]);
+        ++batch;
+        // The slot is free again once it is formatted
+        m_tail.store(i + 1, std::memory_order_release);
+        if (static_cast<size_t>(buffer + sizeof(buffer) - out) < MAX_LINE_SIZE || i + 1 == head) {
+            if (!writeAll(m_fd, buffer, out - buffer)) {
+                lost += batch;
+            }
+            out = buffer;
+            batch = 0;
+        }
+    }
+    m_written.fetch_add(head - tail - lost, std::memory_order_relaxed);
+    m_dropped.fetch_add(lost, std::memory_order_relaxed);
+    return head - tail;
+}
+
+/*
+ * Drains the ring, then sleeps: 5 ms after records came, doubling up to 200 ms while none come.
+ * The shell does not wake the writer for a record (no system call on its side), close() does
+ * through the eventfd.
+ */
+void* AuditLog::writerMain(void* arg) {
+    static const int MIN_SLEEP_MS = 5;
+    static const int MAX_SLEEP_MS = 200;
+    static const int64_t SYNC_INTERVAL_MS = 1000;
+    AuditLog* log = static_cast<AuditLog*>(arg);
+    int sleep_ms = MIN_SLEEP_MS;
+    int64_t last_sync = monotonicMs();
+    bool unsynced = false;
+    while (!log->m_stop.load(std::memory_order_acquire)) {
+        if (log->drain() > 0) {
+            unsynced = true;
+            sleep_ms = MIN_SLEEP_MS;
+        } else {
+            sleep_ms = (sleep_ms * 2 < MAX_SLEEP_MS) ? sleep_ms * 2 : MAX_SLEEP_MS;
+        }
+        if (unsynced && monotonicMs() - last_sync >= SYNC_INTERVAL_MS) {
+            fdatasync(log->m_fd);
+            last_sync = monotonicMs();
+            unsynced = false;
+        }
+        struct pollfd wake = {log->m_wakeFd, POLLIN, 0};
+        poll(&wake, 1, sleep_ms);
+    }
+    log->drain();
+    fdatasync(log->m_fd);
+    return nullptr;
+}
+
+void AuditLog::printStatus(std::ostream& out) const {
+    if (!m_running) {
+        out << "audit: off" << '\n';
+        return;
+    }
+    out << "audit: " << m_path << ": " << m_written.load() << " records written, " << m_dropped.load()
+        << " dropped" << '\n';
+}
@@ -0,0 +1,73 @@
+#ifndef SMASH_AUDIT_LOG_H_
+#define SMASH_AUDIT_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <atomic>
+#include <ostream>
+#include <string>
+
+/*
+ * Record of every command line the shell executes (audit, $SMASH_AUDIT), one JSON object per line:
+ * {"time":"2026-10-19T15:41:07.123456Z","pid":4242,"job":2,"status":0,"duration_us":1520,"command":"..."}
+ * The shell only copies a fixed-size record into a lock-free single producer, single consumer ring.
+ * A writer thread formats the records in batches, writes each batch with one write() and fdatasyncs
+ * the file at most once a second. When the ring is full the record is dropped and counted: the
+ * shell never waits for the disk.
+ * The writer neither allocates nor uses stdio, so a child forked (or cloned) while it runs cannot
+ * inherit a lock it held. Children do not log.
+ */
+class AuditLog {
+public:
+    static const size_t CAPACITY = 4096;        // Records, a power of two
+    static const size_t COMMAND_SIZE = 208;
+
+    struct Record {
+        int64_t timeNs;         // Start, CLOCK_REALTIME
+        int64_t durationNs;
+        int32_t pid;            // The last process the line started, 0 if none
+        int32_t jobId;          // The job the line left running, -1 if none
+        int32_t status;
+        uint32_t length;
+        char command[COMMAND_SIZE];     // Longer lines are cut
+    };
+
+private:
+    alignas(64) std::atomic<uint64_t> m_head;   // Next record to fill, moved by the shell
+    alignas(64) std::atomic<uint64_t> m_tail;   // Next record to write, moved by the writer
+    alignas(64) std::atomic<uint64_t> m_dropped;
+    std::atomic<uint64_t> m_written;
+    std::atomic<bool> m_stop;
+    Record* m_ring;
+    int m_fd;
+    int m_wakeFd;                               // eventfd, written by close() to stop the writer
+    bool m_running;
+    pthread_t m_writer;
+    pid_t m_owner;
+    std::string m_path;
+
+    static void* writerMain(void* log);
+    // Writes the records queued so far, returns how many
+    size_t drain();
+
+public:
+    AuditLog();
+    ~AuditLog();
+    AuditLog(AuditLog const &) = delete;
+    void operator=(AuditLog const &) = delete;
+
+    // Appends the records to the file at path from now on, false (after printing why) on failure
+    bool open(const std::string& path);
+    // Writes the queued records, syncs and closes the file
+    void close();
+    bool isOpen() const;
+    // Queues a record without blocking, false when it was dropped (ring full, or not open)
+    bool record(int64_t time_ns, int64_t duration_ns, pid_t pid, int job_id, int status,
+                const char* command, size_t length);
+    // "audit: <path>: N records written, M dropped", or "audit: off"
+    void printStatus(std::ostream& out) const;
+};
+
+#endif //SMASH_AUDIT_LOG_H_
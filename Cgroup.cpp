@@ -0,0 +1,251 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "Cgroup.h"
+
+// Older kernel headers (Ubuntu 18.04) lack clone3, clone3() then fails with ENOSYS and fork() is used
+#ifndef SYS_clone3
+#define SYS_clone3 435
+#endif
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+// struct clone_args of Linux 5.7, declared here for the headers that do not have it
+struct CloneArgs {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t childTid;
+    uint64_t parentTid;
+    uint64_t exitSignal;
+    uint64_t stack;
+    uint64_t stackSize;
+    uint64_t tls;
+    uint64_t setTid;
+    uint64_t setTidSize;
+    uint64_t cgroup;
+};
+
+// Reads the whole (small) file at path, false if it cannot be read
+static bool readFile(int dir, const char* path, std::string& content) {
+    int fd = openat(dir, path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    char buffer[4096];
+    ssize_t length = read(fd, buffer, sizeof(buffer));
+    close(fd);
+    if (length < 0) {
+        return false;
+    }
+    content.assign(buffer, length);
+    return true;
+}
+
+static bool writeFile(int dir, const char* path, const std::string& value) {
+    int fd = openat(dir, path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    bool written = write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return written;
+}
+
+// True when the space separated list holds word
+static bool hasWord(const std::string& list, const std::string& word) {
+    std::istringstream words(list);
+    std::string listed;
+    while (words >> listed) {
+        if (listed == word) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * $SMASH_CGROUP, or the cgroup of the shell: the cgroup2 mount point from /proc/self/mountinfo
+ * ("id parent dev root mount-point options ... - cgroup2 source options") followed by the
+ * "0::<path>" line of /proc/self/cgroup. Empty without a cgroup v2 hierarchy.
+ */
+static std::string findBase() {
+    const char* configured = getenv("SMASH_CGROUP");
+    if (configured != nullptr && configured[0] != '\0') {
+        return configured;
+    }
+    std::ifstream mountinfo("/proc/self/mountinfo");
+    std::string line;
+    std::string mount_point;
+    while (mount_point.empty() && std::getline(mountinfo, line)) {
+        size_t separator = line.find(" - cgroup2 ");
+        if (separator != std::string::npos) {
+            std::istringstream fields(line.substr(0, separator));
+            std::string skipped;
+            fields >> skipped >> skipped >> skipped >> skipped >> mount_point;
+        }
+    }
+    std::ifstream self("/proc/self/cgroup");
+    while (!mount_point.empty() && std::getline(self, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            return (line.size() > 4) ? mount_point + line.substr(3) : mount_point;
+        }
+    }
+    return "";
+}
+
+// Makes controller available to the children of base
+static bool enableController(int base, const std::string& base_path, const char* controller) {
+    std::string controllers;
+    if (!readFile(base, "cgroup.controllers", controllers) || !hasWord(controllers, controller)) {
+        std::cerr << "smash error: run: the " << controller << " controller is not available in "
+                  << base_path << std::endl;
+        return false;
+    }
+    if (readFile(base, "cgroup.subtree_control", controllers) && hasWord(controllers, controller)) {
+        return true;
+    }
+    if (!writeFile(base, "cgroup.subtree_control", std::string("+") + controller)) {
+        perror("smash error: run: enabling the controller failed");
+        return false;
+    }
+    return true;
+}
+
+Cgroup::Cgroup(std::string path, int fd) : m_path(std::move(path)), m_fd(fd), m_owner(getpid()) {}
+
+Cgroup::~Cgroup() {
+    close(m_fd);
+    // Forked child shells hold copies; a cgroup still holding processes stays (rmdir fails)
+    if (getpid() == m_owner) {
+        rmdir(m_path.c_str());
+    }
+}
+
+std::shared_ptr<Cgroup> Cgroup::create(const Limits& limits) {
+    static unsigned sequence = 0;
+    std::string base_path = findBase();
+    if (base_path.empty()) {
+        std::cerr << "smash error: run: no cgroup v2 hierarchy is mounted" << std::endl;
+        return nullptr;
+    }
+    int base = open(base_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (base == -1) {
+        perror("smash error: open failed");
+        return nullptr;
+    }
+
+    struct Limit {
+        const char* controller;
+        const char* file;
+        const std::string& value;
+    } const settings[] = {
+        {"cpu", "cpu.max", limits.cpuMax},
+        {"memory", "memory.max", limits.memoryMax},
+        {"pids", "pids.max", limits.pidsMax},
+    };
+    for (const Limit& limit : settings) {
+        if (!limit.value.empty() && !enableController(base, base_path, limit.controller)) {
+            close(base);
+            return nullptr;
+        }
+    }
+
+    std::string name = "smash-" + std::to_string(getpid()) + "-" + std::to_string(++sequence);
+    if (mkdirat(base, name.c_str(), 0755) == -1) {
+        perror("smash error: run: mkdir failed");
+        close(base);
+        return nullptr;
+    }
+    int fd = openat(base, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    close(base);
+    if (fd == -1) {
+        perror("smash error: open failed");
+        rmdir((base_path + "/" + name).c_str());
+        return nullptr;
+    }
+    std::shared_ptr<Cgroup> cgroup(new Cgroup(base_path + "/" + name, fd));
+    for (const Limit& limit : settings) {
+        if (!limit.value.empty() && !writeFile(fd, limit.file, limit.value)) {
+            std::cerr << "smash error: run: cannot set " << limit.file << " to " << limit.value << std::endl;
+            return nullptr;
+        }
+    }
+    return cgroup;
+}
+
+const std::string& Cgroup::path() const {
+    return m_path;
+}
+
+/*
+ * clone3() with only CLONE_INTO_CGROUP and SIGCHLD behaves like fork(), the child starts in the
+ * cgroup so nothing it does is accounted elsewhere. Before Linux 5.7 it is missing or rejects the
+ * flag, the forked child then writes itself to cgroup.procs.
+ */
+pid_t Cgroup::fork() const {
+    static bool clone_into_cgroup = true;
+    if (clone_into_cgroup) {
+        CloneArgs args;
+        memset(&args, 0, sizeof(args));
+        args.flags = CLONE_INTO_CGROUP;
+        args.exitSignal = SIGCHLD;
+        args.cgroup = m_fd;
+        pid_t pid = syscall(SYS_clone3, &args, sizeof(args));
+        if (pid != -1 || (errno != ENOSYS && errno != E2BIG && errno != EINVAL)) {
+            return pid;
+        }
+        clone_into_cgroup = false;
+    }
+    pid_t pid = ::fork();
+    if (pid == 0 && !writeFile(m_fd, "cgroup.procs", "0")) {
+        perror("smash error: run: joining the cgroup failed");
+        _exit(1);
+    }
+    return pid;
+}
+
+bool Cgroup::killAll() const {
+    if (writeFile(m_fd, "cgroup.kill", "1")) {
+        return true;
+    }
+    std::string procs;
+    if (errno != ENOENT || !readFile(m_fd, "cgroup.procs", procs)) {
+        return false;
+    }
+    std::istringstream pids(procs);
+    pid_t pid;
+    while (pids >> pid) {
+        kill(pid, SIGKILL);
+    }
+    return true;
+}
+
+std::string Cgroup::usage() const {
+    std::string usage;
+    std::string content;
+    if (readFile(m_fd, "memory.current", content)) {
+        usage = "memory " + std::to_string(strtoull(content.c_str(), nullptr, 10) / 1024) + "K";
+    }
+    size_t field;
+    if (readFile(m_fd, "cpu.stat", content) && (field = content.find("usage_usec ")) != std::string::npos) {
+        unsigned long long usec = strtoull(content.c_str() + field + 11, nullptr, 10);
+        char seconds[32];
+        snprintf(seconds, sizeof(seconds), "cpu %llu.%02llus", usec / 1000000, usec % 1000000 / 10000);
+        usage += (usage.empty() ? "" : ", ") + std::string(seconds);
+    }
+    return usage;
+}
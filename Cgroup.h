@@ -0,0 +1,49 @@
+#ifndef SMASH_CGROUP_H_
+#define SMASH_CGROUP_H_
+
+#include <sys/types.h>
+#include <memory>
+#include <string>
+
+/*
+ * A cgroup v2 directory holding the processes started by one run command (run --cgroup), so they
+ * can be limited, accounted and killed together.
+ * The cgroups are created below $SMASH_CGROUP when it is set (a delegated subtree the user may
+ * write to), otherwise below the shell's own cgroup. The parent must not hold processes itself
+ * when controllers are enabled for its children, which is why a delegated subtree is usually
+ * given. Processes are created directly inside the cgroup with clone3(CLONE_INTO_CGROUP); kernels
+ * without it fork and move the child before it executes anything.
+ * The directory is removed when the last job using it is gone, by the shell that created it.
+ */
+class Cgroup {
+    std::string m_path;
+    int m_fd;
+    pid_t m_owner;
+
+    Cgroup(std::string path, int fd);
+
+public:
+    // Values as written to the interface files, empty ones are left alone
+    struct Limits {
+        std::string cpuMax;     // "<quota> <period>" in microseconds
+        std::string memoryMax;  // Bytes, K, M and G suffixes allowed
+        std::string pidsMax;
+    };
+
+    ~Cgroup();
+    Cgroup(Cgroup const &) = delete;
+    void operator=(Cgroup const &) = delete;
+
+    // Creates a cgroup with the limits, nullptr (after printing why) when that is not possible
+    static std::shared_ptr<Cgroup> create(const Limits& limits);
+
+    const std::string& path() const;
+    // Like fork(), with the child already in the cgroup
+    pid_t fork() const;
+    // Kills every process of the cgroup (cgroup.kill, or each of cgroup.procs on older kernels)
+    bool killAll() const;
+    // "memory 1234K, cpu 0.52s" from memory.current and cpu.stat, the ones the cgroup has
+    std::string usage() const;
+};
+
+#endif //SMASH_CGROUP_H_
@@ -7,6 +7,12 @@
 #include <sys/wait.h>
 #include <iomanip>
 #include "Commands.h"
+#include "FdStream.h"
+#include "LineReader.h"
+#include "Applets.h"
+#include "Launcher.h"
+#include "Script.h"
+#include "Watcher.h"
 #include <fstream>
 #include <sys/utsname.h>
 #include <ctime>
@@ -20,14 +26,30 @@
 #include <sys/sysinfo.h>
 #include <algorithm>
 #include <sys/syscall.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <deque>
+#include <map>
 
 using namespace std;
 
+// Older kernel headers (Ubuntu 18.04) lack it, the call then fails with ENOSYS and the callers wait
+// without pidfds
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
 const std::string WHITESPACE = " \n\r\t\f\v";
-const char ExternalCommand::WILDCARDS[] = {'*', '?'};
 
 // Helper functions and declarations
 extern pid_t smash_fg_pid;
+extern volatile sig_atomic_t smash_interrupted;
 extern char **environ;
 struct UsbDevice;
 struct linux_dirent64;
@@ -35,6 +57,10 @@ static bool isStringRepValidNum(const char* str);
 static long long calculateDirectorySize(const std::string& path);
 static void addUsbDevice(const std::string& path, std::vector<UsbDevice>& devices);
 static std::string read_content(const std::string& path);
+static int createSealedMemfd(const char* data, size_t len);
+static int exitStatusOf(int wait_status);
+static double parseDuration(const std::string& word);
+static void armTimer(int timer_fd, double seconds);
 
 #if 0
 #define FUNC_ENTRY()  \
@@ -61,20 +87,101 @@ string _trim(const std::string &s) {
     return _rtrim(_ltrim(s));
 }
 
-int _parseCommandLine(const char *cmd_line, char **args) {
+// The length of the word at text, whitespace inside a command substitution does not end it
+static size_t _wordLength(const char* text, size_t length) {
+    size_t pos = 0;
+    while (pos < length && WHITESPACE.find(text[pos]) == std::string::npos) {
+        size_t end = SmallShell::substitutionEnd(text, pos, length);
+        pos = (end != pos && end != std::string::npos) ? end : pos + 1;
+    }
+    return pos;
+}
+
+// Like find_first_of(chars, pos), skipping command substitutions
+static size_t _findUnsubstituted(const std::string& line, const char* chars, size_t pos = 0) {
+    while (pos < line.size()) {
+        size_t end = SmallShell::substitutionEnd(line.c_str(), pos, line.size());
+        if (end != pos && end != std::string::npos) {
+            pos = end;
+            continue;
+        }
+        if (strchr(chars, line[pos]) != nullptr) {
+            return pos;
+        }
+        ++pos;
+    }
+    return std::string::npos;
+}
+
+// Splits the command line on whitespace. The arguments are copied into the given arena,
+// or malloc'ed when there is none. Parameters ($NAME, $? ...) and command substitutions are
+// expanded on the way, the quote state is carried from word to word so a quoted '$' stays
+// literal. The result of an expansion in an unquoted word is split into words, like bash does.
+int _parseCommandLine(const char *cmd_line, char **args, Arena *arena) {
     FUNC_ENTRY()
     int i = 0;
-    std::istringstream iss(_trim(string(cmd_line)).c_str());
-    for (std::string s; iss >> s;) {
-        args[i] = (char *) malloc(s.length() + 1);
-        memset(args[i], 0, s.length() + 1);
-        strcpy(args[i], s.c_str());
+    const char *pos = cmd_line;
+    const bool expand = (strpbrk(cmd_line, "$`") != nullptr);
+    const char* line_end = expand ? cmd_line + strlen(cmd_line) : nullptr;
+    char quote = '\0';
+    auto add_arg = [&](const char* arg, size_t len) {
+        args[i] = (arena != nullptr) ? arena->strndup(arg, len) : strndup(arg, len);
         args[++i] = NULL;
+    };
+    while (i < COMMAND_MAX_ARGS) {
+        pos += strspn(pos, WHITESPACE.c_str());
+        if (*pos == '\0') {
+            break;
+        }
+        if (!expand) {
+            size_t len = strcspn(pos, WHITESPACE.c_str());
+            add_arg(pos, len);
+            pos += len;
+            continue;
+        }
+
+        size_t len = _wordLength(pos, line_end - pos);
+        ArenaString word{ArenaAllocator<char>(arena)};
+        word.reserve(len + 32);
+        bool quoted = (quote != '\0' || memchr(pos, '\'', len) != nullptr || memchr(pos, '"', len) != nullptr);
+        SmallShell::getInstance().expandParameters(pos, len, word, quote);
+        pos += len;
+        if (quoted) {
+            add_arg(word.data(), word.size());
+            continue;
+        }
+        const char* part = word.c_str();
+        while (i < COMMAND_MAX_ARGS) {
+            part += strspn(part, WHITESPACE.c_str());
+            if (*part == '\0') {
+                break;
+            }
+            size_t part_len = strcspn(part, WHITESPACE.c_str());
+            add_arg(part, part_len);
+            part += part_len;
+        }
     }
     return i;
     FUNC_EXIT()
 }
 
+// True when cmd_line has wildcards for bash to expand ('?' of a "$?" is not one)
+static bool _hasWildcards(const char* cmd_line) {
+    size_t length = strlen(cmd_line);
+    for (size_t pos = 0; pos < length; ++pos) {
+        size_t end = SmallShell::substitutionEnd(cmd_line, pos, length);
+        if (end != pos && end != std::string::npos) {
+            pos = end - 1;
+            continue;
+        }
+        char c = cmd_line[pos];
+        if (c == '*' || (c == '?' && (pos == 0 || cmd_line[pos - 1] != '$'))) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool _isBackgroundComamnd(const char *cmd_line) {
     const string str(cmd_line);
     return str[str.find_last_not_of(WHITESPACE)] == '&';
@@ -98,15 +205,32 @@ void _removeBackgroundSign(char *cmd_line) {
     cmd_line[str.find_last_not_of(WHITESPACE, idx) + 1] = 0;
 }
 
+// The command line without its background sign, whatever its length
+template <typename String>
+static String _removedBackgroundSign(const char *cmd_line) {
+    String removed(cmd_line);
+    _removeBackgroundSign(&removed[0]);
+    removed.resize(strlen(removed.c_str()));
+    return removed;
+}
+
 // TODO: Add your implementation for classes in Commands.h
 // TODO: SmallShell class
 
-SmallShell::SmallShell() : m_prompt("smash> "), m_lastPwd(NULL) {}
+SmallShell::SmallShell() : m_prompt("smash> "), m_lastPwd(NULL), m_executeDepth(0), m_lastExitStatus(0),
+        m_input(nullptr), m_interactiveInput(false), m_positionalParameters(1, {"smash"}), m_pid(getpid()),
+        m_auditPending(false), m_auditedLength(0), m_auditedTimeNs(0), m_auditedStartNs(0), m_lastStartedPid(0),
+        m_substitutionReplay(nullptr), m_captureDepth(0) {
+    Arena::setCurrent(&m_lineArena);
+}
 
 SmallShell::~SmallShell() {
     if (m_lastPwd != NULL) {
         free(m_lastPwd);
     }
+    for (int fd : m_captureFds) {
+        close(fd);
+    }
 }
 
 std::string SmallShell::resolveAlias(const char *cmd_line) const {
@@ -115,7 +239,7 @@ std::string SmallShell::resolveAlias(const char *cmd_line) const {
         return "";
     }
 
-    const size_t space_pos = original_line.find_first_of(" \t\n&|>");
+    const size_t space_pos = original_line.find_first_of(" \t\n&|<>");
     // the command line consists of one word
     const std::string first_word = (space_pos == std::string::npos)
                              ? original_line
@@ -155,18 +279,33 @@ Command *SmallShell::CreateCommand(const char *cmd_line) {
         return nullptr;
     }
 
+    // run prefixes the whole line, its pipes and redirections included
+    if (cmd_s.substr(0, cmd_s.find_first_of(WHITESPACE)) == "run") {
+        return new RunCommand(cmd_line);
+    }
+
     // Special command: Check for Pipe character
-    if (cmd_s.find('|') != std::string::npos) {
+    else if (_findUnsubstituted(cmd_s, "|") != std::string::npos) {
         return new PipeCommand(cmd_line);
     }
 
     // Special command: Check for IO Redirection character
-    else if (cmd_s.find('>') != std::string::npos) {
+    else if (_findUnsubstituted(cmd_s, "<>") != std::string::npos) {
         return new RedirectionCommand(cmd_line);
     }
 
     std::string firstWord = cmd_s.substr(0, cmd_s.find_first_of(WHITESPACE));
 
+    // Shell functions come before the built-ins
+    if (!m_functions.empty() && m_functions.count(firstWord) != 0) {
+        return new FunctionCommand(cmd_line, firstWord);
+    }
+
+    size_t equals = firstWord.find('=');
+    if (equals != std::string::npos && ShellVariables::isValidName(firstWord.c_str(), equals)) {
+        return new AssignmentCommand(cmd_line);
+    }
+
     // Built-in commands' factory
     if (firstWord == "chprompt") {
         return new ChangePromptCommand(cmd_line, this);
@@ -189,11 +328,32 @@ Command *SmallShell::CreateCommand(const char *cmd_line) {
     else if (firstWord == "unsetenv") {
         return new UnSetEnvCommand(cmd_line);
     }
+    else if (firstWord == "export") {
+        return new ExportCommand(cmd_line);
+    }
+    else if (firstWord == "unset") {
+        return new UnsetCommand(cmd_line);
+    }
+    else if (firstWord == "timeout") {
+        return new TimeoutCommand(cmd_line);
+    }
+    else if (firstWord == "every") {
+        return new EveryCommand(cmd_line, &m_scheduler);
+    }
+    else if (firstWord == "history") {
+        return new HistoryCommand(cmd_line, &m_history);
+    }
+    else if (firstWord == "watchrun") {
+        return new WatchRunCommand(cmd_line, &m_jobsList);
+    }
+    else if (firstWord == "audit") {
+        return new AuditCommand(cmd_line, &m_auditLog);
+    }
     else if (firstWord == "sysinfo") {
         return new SysInfoCommand(cmd_line);
     }
     else if (firstWord == "jobs") {
-        return new JobsCommand(cmd_line, &m_jobsList);
+        return new JobsCommand(cmd_line, &m_jobsList, &m_processTree);
     }
     else if (firstWord == "fg") {
         return new ForegroundCommand(cmd_line, &m_jobsList);
@@ -213,6 +373,28 @@ Command *SmallShell::CreateCommand(const char *cmd_line) {
     else if (firstWord == "usbinfo") {
         return new USBInfoCommand(cmd_line);
     }
+    // Wildcards are expanded by bash running the real cat and tee
+    else if (firstWord == "cat" && !_hasWildcards(cmd_s.c_str())) {
+        return new CatCommand(cmd_line);
+    }
+    else if (firstWord == "tee" && !_hasWildcards(cmd_s.c_str())) {
+        return new TeeCommand(cmd_line);
+    }
+    else if (firstWord == "parallel") {
+        return new ParallelCommand(cmd_line);
+    }
+    else if (firstWord == "applet") {
+        return new AppletsCommand(cmd_line);
+    }
+    else if (firstWord == "joblog") {
+        return new JobLogCommand(cmd_line, &m_jobLogs);
+    }
+
+    // Applets, unless the arguments need wildcard expansion by bash or run options must apply
+    const Applet* applet = findApplet(firstWord.c_str());
+    if (applet != nullptr && !_hasWildcards(cmd_s.c_str()) && m_launch == nullptr) {
+        return new AppletCommand(cmd_line, applet);
+    }
     // External commands' factory
     else {
         return new ExternalCommand(cmd_line);
@@ -220,470 +402,2241 @@ Command *SmallShell::CreateCommand(const char *cmd_line) {
     return nullptr;
 }
 
+static int64_t clockNs(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/*
+* Everything created while a line executes is taken from m_lineArena. Commands may execute
+* nested lines (redirection, pipes), so the arena is only rewound when the outermost one returns.
+* The outermost line is also the one the audit log records.
+*/
+class SmallShell::LineScope {
+    SmallShell& m_smash;
+public:
+    LineScope(SmallShell& smash, const char* cmd_line) : m_smash(smash) {
+        if (++m_smash.m_executeDepth == 1 && m_smash.m_auditLog.isOpen()) {
+            // The record keeps at most COMMAND_SIZE bytes of the line
+            m_smash.m_auditedLength = strnlen(cmd_line, AuditLog::COMMAND_SIZE);
+            memcpy(m_smash.m_auditedLine, cmd_line, m_smash.m_auditedLength);
+            m_smash.m_auditPending = true;
+            m_smash.m_auditedTimeNs = clockNs(CLOCK_REALTIME);
+            m_smash.m_auditedStartNs = clockNs(CLOCK_MONOTONIC);
+            m_smash.m_lastStartedPid = 0;
+        }
+    }
+    ~LineScope() {
+        if (--m_smash.m_executeDepth == 0) {
+            m_smash.auditLine();
+            m_smash.m_hereDocuments.clear();
+            m_smash.m_lineArena.reset();
+        }
+    }
+};
+
+std::unordered_map<int, const HereDocument*> HereDocument::s_open;
+
+HereDocument::HereDocument(int fd, bool expand) : m_fd(fd), m_expand(expand) {
+    s_open[fd] = this;
+}
+
+HereDocument::~HereDocument() {
+    s_open.erase(m_fd);
+    close(m_fd);
+}
+
+const HereDocument* HereDocument::find(int fd) {
+    auto it = s_open.find(fd);
+    return (it != s_open.end()) ? it->second : nullptr;
+}
+
+bool HereDocument::read(std::string& content) const {
+    char buffer[4096];
+    off_t offset = 0;
+    ssize_t bytes;
+    while ((bytes = pread(m_fd, buffer, sizeof(buffer), offset)) > 0) {
+        content.append(buffer, bytes);
+        offset += bytes;
+    }
+    if (bytes == -1) {
+        perror("smash error: read failed");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Like bash, quotes are not special in the content: only parameters, command substitutions and a
+ * backslash before '$', '`' or another backslash are. The text between two double quotes or
+ * escapes is expanded as if it were inside double quotes.
+ */
+int HereDocument::open() const {
+    if (!m_expand) {
+        // Reopening the memfd gives an offset of its own, without /proc the content is copied
+        std::string path = "/proc/self/fd/" + std::to_string(m_fd);
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd != -1) {
+            return fd;
+        }
+    }
+    std::string content;
+    if (!read(content)) {
+        return -1;
+    }
+    if (!m_expand) {
+        return createSealedMemfd(content.data(), content.size());
+    }
+
+    const char* text = content.data();
+    size_t length = content.size();
+    ArenaString expanded;
+    size_t start = 0;
+    size_t pos = 0;
+    while (pos < length) {
+        size_t substitution_end = SmallShell::substitutionEnd(text, pos, length);
+        if (substitution_end != pos && substitution_end != std::string::npos) {
+            pos = substitution_end;
+            continue;
+        }
+        bool escape = (text[pos] == '\\' && pos + 1 < length && strchr("$`\\", text[pos + 1]) != nullptr);
+        if (text[pos] != '"' && !escape) {
+            ++pos;
+            continue;
+        }
+        char quote = '"';
+        SmallShell::getInstance().expandParameters(text + start, pos - start, expanded, quote);
+        if (escape) {
+            ++pos;
+        }
+        expanded += text[pos];
+        start = ++pos;
+    }
+    char quote = '"';
+    SmallShell::getInstance().expandParameters(text + start, length - start, expanded, quote);
+    return createSealedMemfd(expanded.data(), expanded.size());
+}
+
+/*
+* Reads the content of every "<<DELIM" here-document of the line from the input into a sealed memfd
+* and replaces the operator with "<&fd". The content is consumed here, before any stage of the line
+* forks, so pipe stages and nested lines only refer to the already open descriptor.
+*/
+std::string SmallShell::collectHereDocuments(const std::string& cmd_line) {
+    std::string result;
+    size_t pos = 0;
+    while (true) {
+        size_t op = cmd_line.find("<<", pos);
+        if (op == std::string::npos) {
+            break;
+        }
+        if (cmd_line.compare(op, 3, "<<<") == 0) {
+            // Here-string, handled by RedirectionCommand
+            op = cmd_line.find_first_not_of('<', op);
+            result.append(cmd_line, pos, op - pos);
+            pos = op;
+            continue;
+        }
+        result.append(cmd_line, pos, op - pos);
+        pos = op + 2;
+
+        bool strip_tabs = (pos < cmd_line.size() && cmd_line[pos] == '-');
+        if (strip_tabs) {
+            ++pos;
+        }
+        pos = cmd_line.find_first_not_of(" \t", pos);
+        size_t delimiter_end = (pos == std::string::npos) ? std::string::npos
+                                                          : cmd_line.find_first_of(" \t;|&<>", pos);
+        std::string delimiter = (pos == std::string::npos) ? "" : cmd_line.substr(pos, delimiter_end - pos);
+        pos = (delimiter_end == std::string::npos) ? cmd_line.size() : delimiter_end;
+        // A quoted delimiter (any part of it) leaves the content as it is
+        bool quoted = (delimiter.find_first_of("'\"\\") != std::string::npos);
+        delimiter.erase(std::remove(delimiter.begin(), delimiter.end(), '\''), delimiter.end());
+        delimiter.erase(std::remove(delimiter.begin(), delimiter.end(), '"'), delimiter.end());
+        delimiter.erase(std::remove(delimiter.begin(), delimiter.end(), '\\'), delimiter.end());
+        if (delimiter.empty()) {
+            std::cerr << "smash error: here-document: missing delimiter" << std::endl;
+            return "";
+        }
+
+        std::string content;
+        while (m_input != nullptr) {
+            if (m_interactiveInput) {
+                showPrompt(true);
+                std::cout.flush();
+            }
+            const char* line = m_input->nextLine();
+            if (line == nullptr) {
+                break;
+            }
+            if (strip_tabs) {
+                line += strspn(line, "\t");
+            }
+            if (delimiter == line) {
+                break;
+            }
+            content += line;
+            content += '\n';
+        }
+
+        int fd = createSealedMemfd(content.data(), content.size());
+        if (fd == -1) {
+            return "";
+        }
+        bool expand = !quoted && content.find_first_of("$`\\") != std::string::npos;
+        m_hereDocuments.push_back(std::make_shared<HereDocument>(fd, expand));
+        result += "<&" + std::to_string(fd);
+    }
+    result.append(cmd_line, pos, std::string::npos);
+    return result;
+}
+
 void SmallShell::executeCommand(const char *cmd_line) {
     if (strlen(cmd_line) == 0) return;
+    LineScope line_scope(*this, cmd_line);
 
+    if (m_executeDepth == 1) {
+        smash_interrupted = 0;
+    }
     // Must remove any finished jobs before executing any command
     m_jobsList.removeFinishedJobs();
+    m_jobLogs.drain();
+    if (m_executeDepth == 1) {
+        m_scheduler.runDue();
+    }
     // Determine the command
-    const std::string cmd_line_resolved = resolveAlias(cmd_line);
+    std::string cmd_line_resolved = resolveAlias(cmd_line);
+    if (m_executeDepth == 1 && cmd_line_resolved.find("<<") != std::string::npos) {
+        cmd_line_resolved = collectHereDocuments(cmd_line_resolved);
+        if (cmd_line_resolved.empty()) {
+            m_lastExitStatus = 1;
+            return;
+        }
+    }
     const char* real_cmd_line = cmd_line_resolved.c_str();
 
-    // removing the & sign
-    bool is_background_intent = _isBackgroundComamnd(real_cmd_line);
-    char removed_background_cmd_line[COMMAND_MAX_LENGTH + 1];
-    strcpy(removed_background_cmd_line, real_cmd_line);
-    if (is_background_intent) {
-        _removeBackgroundSign(removed_background_cmd_line);
+    // Control flow and command lists go through the script compiler
+    if (Script::isCompound(real_cmd_line)) {
+        executeScript(cmd_line_resolved);
+        return;
     }
 
-
-    Command* cmd_obj = CreateCommand(removed_background_cmd_line);
+    Command* cmd_obj = prepareCommand(real_cmd_line);
     if (cmd_obj == nullptr) {
         return;
     }
+    cmd_obj->execute();
+    m_lastExitStatus = cmd_obj->getExitStatus();
+    delete cmd_obj;
+}
 
-    // Execute for Built-in Commands or Special Commands
-    if (!dynamic_cast<ExternalCommand*>(cmd_obj)) {
-        // Ignore &
-        cmd_obj->execute();
-        delete cmd_obj;
+Command* SmallShell::prepareCommand(const char *cmd_line) {
+    // removing the & sign
+    bool is_background_intent = _isBackgroundComamnd(cmd_line);
+    std::string removed_background_cmd_line = _removedBackgroundSign<std::string>(cmd_line);
+
+    SubstitutionReplay replay = {{}, 0, false};
+    SubstitutionReplay* outer_replay = m_substitutionReplay;
+    m_substitutionReplay = &replay;
+    Command* cmd_obj = CreateCommand(removed_background_cmd_line.c_str());
+    if (cmd_obj == nullptr) {
+        m_substitutionReplay = outer_replay;
+        return nullptr;
     }
-    else {
+
+    // Built-in Commands and Special Commands ignore &
+    // (applets, cat and tee run in the shell, so in the background they run as the real binary)
+    bool is_external = dynamic_cast<ExternalCommand*>(cmd_obj) != nullptr ||
+                       (is_background_intent && (dynamic_cast<AppletCommand*>(cmd_obj) != nullptr ||
+                                                 dynamic_cast<CatCommand*>(cmd_obj) != nullptr ||
+                                                 dynamic_cast<TeeCommand*>(cmd_obj) != nullptr));
+    if (is_external && is_background_intent) {
         delete cmd_obj;
-        cmd_obj = new ExternalCommand(real_cmd_line);
         // This will handle background commands too
-        cmd_obj->execute();
+        replay.replaying = true;
+        cmd_obj = new ExternalCommand(cmd_line);
+    } else if (is_background_intent && dynamic_cast<RunCommand*>(cmd_obj) != nullptr) {
+        // run executes its line with the &
         delete cmd_obj;
+        cmd_obj = new RunCommand(cmd_line);
+    } else if (is_background_intent && dynamic_cast<TimeoutCommand*>(cmd_obj) != nullptr) {
+        // timeout waits for its command, so in the background a child shell does
+        delete cmd_obj;
+        cmd_obj = new TimeoutCommand(cmd_line);
     }
+    m_substitutionReplay = outer_replay;
+    return cmd_obj;
 }
 
-void SmallShell::showPrompt() const {
-    std::cout << m_prompt;
-}
+/*
+ * Compiles and runs a compound line. A construct left open at the end of the line (if without fi,
+ * trailing &&, ...) continues on the next lines of the input.
+ */
+void SmallShell::executeScript(std::string source) {
+    Script script;
+    std::string error;
+    while (true) {
+        Script::CompileResult result = script.compile(source, error);
+        if (result == Script::INCOMPLETE && m_executeDepth == 1 && m_input != nullptr) {
+            if (m_interactiveInput) {
+                showPrompt(true);
+                std::cout.flush();
+            }
+            const char* line = m_input->nextLine();
+            if (line != nullptr) {
+                std::string next_line(line);
+                if (next_line.find("<<") != std::string::npos) {
+                    next_line = collectHereDocuments(next_line);
+                }
+                source += '\n';
+                source += next_line;
+                continue;
+            }
+        }
+        if (result == Script::COMPILED) {
+            break;
+        }
+        if (result == Script::INCOMPLETE) {
+            error = "syntax error: unexpected end of file";
+        }
+        std::cerr << "smash error: " << error << std::endl;
+        m_lastExitStatus = 2;
+        return;
+    }
 
-void SmallShell::setPrompt(const std::string& newPrompt) {
-    m_prompt = newPrompt;
+    // Functions defined by the line may run after it, their here-documents must stay open
+    script.keepHereDocuments(m_hereDocuments);
+    script.run(*this);
 }
 
-std::vector<std::pair<std::string, std::string>>& SmallShell::getAliases() {
-    return getInstance().m_aliases;
+void SmallShell::defineFunction(const std::string& name, std::shared_ptr<Script> body) {
+    m_functions[name] = std::move(body);
 }
 
-JobsList& SmallShell::getJobsList() {
-    return m_jobsList;
+std::shared_ptr<Script> SmallShell::findFunction(const std::string& name) const {
+    if (m_functions.empty()) {
+        return nullptr;
+    }
+    auto it = m_functions.find(name);
+    return (it != m_functions.end()) ? it->second : nullptr;
 }
 
+ShellVariables& SmallShell::getVariables() {
+    return m_variables;
+}
 
-// Command class
-Command::Command(const char* cmd_line, bool parse_args) : m_cmd_line(cmd_line), m_cmd_args{},
-          m_num_args(parse_args ? _parseCommandLine(cmd_line, m_cmd_args) : 0) {}
-
-Command::~Command() {
-    for (int i = 0; i < m_num_args; ++i) {
-        free(m_cmd_args[i]);
+void SmallShell::pushPositionalParameters(std::vector<std::string> parameters) {
+    if (parameters.empty()) {
+        parameters.emplace_back();
     }
+    parameters[0] = m_positionalParameters.back()[0];
+    m_positionalParameters.push_back(std::move(parameters));
 }
 
-const string& Command::getCmdLine() const {
-    return m_cmd_line;
+void SmallShell::popPositionalParameters() {
+    if (m_positionalParameters.size() > 1) {
+        m_positionalParameters.pop_back();
+    }
 }
 
-// BuiltInCommand class
-BuiltInCommand::BuiltInCommand(const char* cmd_line, bool parse_args) : Command(cmd_line, parse_args) {}
-
-// ExternalCommand class
+void SmallShell::setScriptParameters(std::vector<std::string> parameters) {
+    if (!parameters.empty()) {
+        m_positionalParameters.front() = std::move(parameters);
+    }
+}
 
-ExternalCommand::ExternalCommand(const char* cmd_line) : Command(cmd_line, false) {
-    strcpy(m_removed_background_cmd_line, m_cmd_line.c_str());
-    _removeBackgroundSign(m_removed_background_cmd_line);
-    m_num_args = _parseCommandLine(m_removed_background_cmd_line, m_cmd_args);
+static void appendNumber(ArenaString& out, long number) {
+    char buffer[24];
+    int length = snprintf(buffer, sizeof(buffer), "%ld", number);
+    out.append(buffer, length);
 }
 
-void ExternalCommand::execute() {
-    bool isComplex = is_complex_command();
-    pid_t pid = fork();
-    if(pid < 0) {
-        perror("smash error: fork failed");
-        return;
+size_t SmallShell::expandParameter(const char* text, size_t length, ArenaString& out) {
+    if (length == 0) {
+        return 0;
     }
-
-    // For the child
-    if(pid == 0) {
-        setpgrp();
-        char *argv[] = {
-                const_cast<char*>("/bin/bash"),
-                const_cast<char*>("-c"),
-                const_cast<char*>(m_removed_background_cmd_line),
-                NULL
-        };
-
-        const char* path =  isComplex ? "/bin/bash" : m_cmd_args[0];
-        char** ArgList = isComplex ? argv : m_cmd_args;
-        execvp(path, ArgList);
-        perror("smash error: execvp failed");
-        exit(1);
+    const std::vector<std::string>& parameters = m_positionalParameters.back();
+
+    // ${...} takes the same names as the short forms, plus positional parameters past 9
+    size_t start = 0;
+    size_t end = length;
+    if (text[0] == '{') {
+        const char* close = static_cast<const char*>(memchr(text, '}', length));
+        if (close == nullptr || close == text + 1) {
+            return 0;
+        }
+        start = 1;
+        end = close - text;
     }
-
-    // For the parent-smash process
-    const char* cmd_line = m_cmd_line.c_str();
-    SmallShell& smash = SmallShell::getInstance();
-
-
-    if(_isBackgroundComamnd(cmd_line)) {
-        smash.getJobsList().addJob(this, pid, false);
-    } else {
-        smash_fg_pid = pid;
-        int status;
-        if (waitpid(pid, &status, WUNTRACED) == -1) {
-            perror("smash error: waitpid failed");
-            smash_fg_pid = 0;
-            return;
+    const char* name = text + start;
+    size_t name_length;
+    if (ShellVariables::isValidName(name, 1)) {
+        name_length = 1;
+        while (start + name_length < end && (isalnum(static_cast<unsigned char>(name[name_length])) ||
+                                             name[name_length] == '_')) {
+            ++name_length;
         }
-
-        smash_fg_pid = 0;
-
-        if (WIFSTOPPED(status)) {
-            smash.getJobsList().addJob(this, pid, true);
+        const char* value = m_variables.get(name, name_length);
+        if (value != nullptr) {
+            out += value;
+        }
+    } else if (isdigit(static_cast<unsigned char>(name[0]))) {
+        size_t index = name[0] - '0';
+        name_length = 1;
+        while (start != 0 && start + name_length < end && isdigit(static_cast<unsigned char>(name[name_length]))) {
+            index = index * 10 + (name[name_length++] - '0');
+        }
+        if (index < parameters.size()) {
+            out.append(parameters[index].data(), parameters[index].size());
+        }
+    } else {
+        name_length = 1;
+        switch (name[0]) {
+            case '?':
+                appendNumber(out, m_lastExitStatus);
+                break;
+            case '$':
+                appendNumber(out, m_pid);
+                break;
+            case '#':
+                appendNumber(out, static_cast<long>(parameters.size()) - 1);
+                break;
+            case '@':
+            case '*':
+                for (size_t i = 1; i < parameters.size(); i++) {
+                    if (i > 1) {
+                        out += ' ';
+                    }
+                    out.append(parameters[i].data(), parameters[i].size());
+                }
+                break;
+            default:
+                return 0;
         }
     }
-}
 
-bool ExternalCommand::is_complex_command() const {
-    return (m_cmd_line.find(WILDCARDS[0]) != std::string::npos ||
-            m_cmd_line.find(WILDCARDS[1]) != std::string::npos);
+    if (start == 0) {
+        return name_length;
+    }
+    // A braced reference must hold exactly one name
+    return (start + name_length == end) ? end + 1 : 0;
 }
 
+void SmallShell::expandParameters(const char* text, size_t length, ArenaString& out, char& quote) {
+    size_t pos = 0;
+    while (pos < length) {
+        // Copies up to the next character that matters in one go
+        size_t plain = pos;
+        while (plain < length && text[plain] != '$' && text[plain] != '\'' && text[plain] != '"' &&
+               text[plain] != '\\' && text[plain] != '`') {
+            ++plain;
+        }
+        out.append(text + pos, plain - pos);
+        pos = plain;
+        if (pos == length) {
+            break;
+        }
 
-// chprompt command
-ChangePromptCommand::ChangePromptCommand(const char *cmd_line, SmallShell *smash) : BuiltInCommand(cmd_line, false), m_sshell(smash) {
-    // find first parameter and ignore the rest of the command line
-    string cmd_s = _trim(string(cmd_line));
-    string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
-    string remaining = cmd_s.substr(firstWord.length());
-    string newPrompt = _trim(remaining);
-    newPrompt = newPrompt.substr(0, newPrompt.find_first_of(" \n"));
-    if(newPrompt.empty()) {
-        newPrompt = "smash> ";
-    } else {
-        newPrompt = newPrompt + "> ";
+        char c = text[pos];
+        size_t substitution_end = (quote != '\'') ? substitutionEnd(text, pos, length) : pos;
+        if (substitution_end != pos && substitution_end != std::string::npos) {
+            size_t command_start = pos + ((c == '$') ? 2 : 1);
+            substituteCommand(text + command_start, substitution_end - 1 - command_start, out);
+            pos = substitution_end;
+            continue;
+        }
+        if (c == '$' && quote != '\'') {
+            size_t used = expandParameter(text + pos + 1, length - pos - 1, out);
+            if (used > 0) {
+                pos += used + 1;
+                continue;
+            }
+        } else if (c == '\\' && quote != '\'' && pos + 1 < length) {
+            out.append(text + pos, 2);
+            pos += 2;
+            continue;
+        } else if ((c == '\'' || c == '"') && (quote == '\0' || quote == c)) {
+            quote = (quote == c) ? '\0' : c;
+        }
+        out += c;
+        ++pos;
     }
-    this->m_prompt = newPrompt;
 }
 
-void ChangePromptCommand::execute() {
-    m_sshell->setPrompt(m_prompt);
-}
-
-// showpid command
-ShowPidCommand::ShowPidCommand(const char* cmd_line) : BuiltInCommand(cmd_line, false) {}
+size_t SmallShell::substitutionEnd(const char* text, size_t pos, size_t length) {
+    if (text[pos] == '`') {
+        for (size_t i = pos + 1; i < length; i++) {
+            if (text[i] == '\\') {
+                ++i;
+            } else if (text[i] == '`') {
+                return i + 1;
+            }
+        }
+        return std::string::npos;
+    }
+    if (text[pos] != '$' || pos + 1 >= length || text[pos + 1] != '(') {
+        return pos;
+    }
 
-void ShowPidCommand::execute() {
-    std::cout << "smash pid is " << getpid() << std::endl;
+    int depth = 0;
+    char quote = '\0';
+    for (size_t i = pos + 1; i < length; i++) {
+        char c = text[i];
+        if (quote != '\0') {
+            if (c == quote) {
+                quote = '\0';
+            } else if (c == '\\' && quote == '"') {
+                ++i;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '\\') {
+            ++i;
+        } else if (c == '(') {
+            ++depth;
+        } else if (c == ')' && --depth == 0) {
+            return i + 1;
+        }
+    }
+    return std::string::npos;
 }
 
-// pwd command
-GetCurrDirCommand::GetCurrDirCommand(const char* cmd_line) : BuiltInCommand(cmd_line, false) {}
-
-void GetCurrDirCommand::execute() {
-    char buffer[PATH_MAX];
-    if (getcwd(buffer, PATH_MAX) != NULL) {
-        std::cout << buffer << std::endl;
+void SmallShell::substituteCommand(const char* command, size_t length, ArenaString& out) {
+    std::string output;
+    SubstitutionReplay* replay = m_substitutionReplay;
+    if (replay != nullptr && replay->replaying && replay->next < replay->outputs.size()) {
+        output = replay->outputs[replay->next++];
     } else {
-        perror("smash error: getcwd failed");
+        // Commands created by the substitution have their own replay, if any
+        m_substitutionReplay = nullptr;
+        runSubstitution(std::string(command, length), output);
+        m_substitutionReplay = replay;
+        if (replay != nullptr && !replay->replaying) {
+            replay->outputs.push_back(output);
+        }
     }
+    size_t end = output.find_last_not_of('\n');
+    out.append(output.data(), (end == std::string::npos) ? 0 : end + 1);
 }
 
-// cd command
-ChangeDirCommand::ChangeDirCommand(const char *cmd_line, char **plastPwd) : BuiltInCommand(cmd_line, true), m_plastPwd(plastPwd)
-{}
+static const size_t SUBSTITUTION_READ_SIZE = 64 * 1024;
 
-void ChangeDirCommand::execute() {
-    if(m_num_args > 2) {
-        std::cerr << "smash error: cd: too many arguments" << std::endl;
-        return;
+/*
+ * Runs a built-in that only prints (pwd, alias, whoami, the applets...) inside the shell, its
+ * output goes to a memfd that is read back with one pread. Returns false when none could be made.
+ */
+bool SmallShell::captureInShell(Command* cmd, std::string& output) {
+    if (m_captureFds.size() <= m_captureDepth) {
+        int fd = memfd_create("smash-substitution", MFD_CLOEXEC);
+        if (fd == -1) {
+            perror("smash error: memfd_create failed");
+            return false;
+        }
+        m_captureFds.push_back(fd);
+    }
+    int fd = m_captureFds[m_captureDepth];
+    if (ftruncate(fd, 0) == -1 || lseek(fd, 0, SEEK_SET) == -1) {
+        perror("smash error: ftruncate failed");
+        return false;
     }
 
-    m_targetPath = (m_num_args == 2) ? std::string(m_cmd_args[1]) : "";
-
-    if(m_targetPath.empty()) {
-        return;
+    ++m_captureDepth;
+    {
+        FdOutputStream capture(fd);
+        cmd->setOutput(&capture);
+        cmd->execute();
     }
+    --m_captureDepth;
+    m_lastExitStatus = cmd->getExitStatus();
+
+    off_t size = lseek(fd, 0, SEEK_CUR);
+    output.resize(size > 0 ? size : 0);
+    size_t done = 0;
+    while (done < output.size()) {
+        ssize_t bytes = pread(fd, &output[done], output.size() - done, done);
+        if (bytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            break;
+        }
+        done += bytes;
+    }
+    output.resize(done);
+    return true;
+}
 
-    char curr_path[PATH_MAX];
-
-    if (getcwd(curr_path, PATH_MAX) == NULL) {
-        perror("smash error: getcwd failed");
+/*
+ * The output of command. Anything but a printing built-in runs in a child writing into a pipe,
+ * read with large reads into a buffer that doubles as needed. $? becomes the command's status.
+ */
+void SmallShell::runSubstitution(const std::string& command, std::string& output) {
+    std::string resolved = resolveAlias(command.c_str());
+    if (resolved.empty()) {
+        m_lastExitStatus = 0;
+        return;
+    }
+    Command* cmd = Script::isCompound(resolved.c_str()) ? nullptr : CreateCommand(resolved.c_str());
+    if (cmd != nullptr && cmd->canRunInPipeline() && captureInShell(cmd, output)) {
+        delete cmd;
         return;
     }
 
-    std::string target_path = m_targetPath;
-
-    if(m_targetPath == "-") {
-        if(*m_plastPwd == NULL || strlen(*m_plastPwd) == 0) {
-            std::cerr << "smash error: cd: OLDPWD not set" << std::endl;
-            return;
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        perror("smash error: pipe failed");
+        delete cmd;
+        m_lastExitStatus = 1;
+        return;
+    }
+    pid_t pid;
+    auto* external_cmd = dynamic_cast<ExternalCommand*>(cmd);
+    if (external_cmd != nullptr) {
+        FdRedirections redirections;
+        redirections.emplace_back(pipe_fds[1], STDOUT_FILENO);
+        external_cmd->setRedirections(redirections);
+        pid = external_cmd->spawn();
+    } else {
+        std::cout.flush();
+        pid = fork();
+        if (pid == -1) {
+            perror("smash error: fork failed");
+        }
+        if (pid == 0) {
+            setpgrp();
+            if (dup2(pipe_fds[1], STDOUT_FILENO) == -1) {
+                perror("smash error: dup2 failed");
+                exit(1);
+            }
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+            if (cmd != nullptr) {
+                // Already expanded, running the line again would substitute twice
+                cmd->execute();
+                std::cout.flush();
+                exit(cmd->getExitStatus());
+            }
+            executeCommand(command.c_str());
+            std::cout.flush();
+            exit(m_lastExitStatus);
         }
-        target_path = std::string(*m_plastPwd);
     }
-
-    if(chdir(target_path.c_str()) == -1) {
-        perror("smash error: chdir failed");
+    close(pipe_fds[1]);
+    delete cmd;
+    if (pid == -1) {
+        close(pipe_fds[0]);
+        m_lastExitStatus = 1;
         return;
     }
 
-    if (*m_plastPwd != NULL) {
-        free(*m_plastPwd);
+    smash_fg_pid = pid;
+    size_t used = 0;
+    output.resize(SUBSTITUTION_READ_SIZE);
+    while (true) {
+        if (used == output.size()) {
+            output.resize(output.size() * 2);
+        }
+        ssize_t bytes = read(pipe_fds[0], &output[used], output.size() - used);
+        if (bytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            break;
+        }
+        used += bytes;
     }
+    output.resize(used);
+    close(pipe_fds[0]);
 
-    *m_plastPwd = strdup(curr_path);
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+    smash_fg_pid = 0;
+    m_lastExitStatus = exitStatusOf(status);
 }
 
-// jobs command
-
-JobsCommand::JobsCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line, false),
-m_jobsList(jobs) {}
-
+int SmallShell::getLastExitStatus() const {
+    return m_lastExitStatus;
+}
 
-void JobsCommand::execute() {
-    // Finished jobs will be removed inside printJobsList()
-    m_jobsList->printJobsList();
+void SmallShell::setLastExitStatus(int status) {
+    m_lastExitStatus = status;
 }
 
-// fg command
-ForegroundCommand::ForegroundCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line, true),
-m_jobsList(jobs){}
+// Keeps the captured background jobs' pipes drained and starts the scheduled commands that are
+// due while the shell waits for a command line
+static void drainJobLogsUntilReadable(int fd) {
+    SmallShell& smash = SmallShell::getInstance();
+    while (!smash.getJobLogs().waitForInput(fd, smash.getScheduler().fd())) {
+        smash.getScheduler().runDue();
+    }
+}
 
+// Also indexes the history while the user types, HISTORY_CHUNK records (a few ms) at a time
+static void indexHistoryUntilReadable(int fd) {
+    static const size_t HISTORY_CHUNK = 4096;
+    History& history = SmallShell::getInstance().getHistory();
+    struct pollfd input = {fd, POLLIN, 0};
+    while (poll(&input, 1, 0) == 0 && history.indexSome(HISTORY_CHUNK)) {}
+    drainJobLogsUntilReadable(fd);
+}
 
-void ForegroundCommand::execute() {
-    if(m_num_args > 2) {
-        std::cerr << "smash error: fg: invalid arguments" << std::endl;
-        return;
+void SmallShell::setInput(LineReader* reader, bool interactive) {
+    m_input = reader;
+    m_interactiveInput = interactive;
+    if (m_input != nullptr) {
+        m_input->setWaitHandler(interactive ? indexHistoryUntilReadable : drainJobLogsUntilReadable);
     }
+}
 
-    int job_id = m_jobsList->getMaxJobId();
+void SmallShell::showPrompt(bool continuation) {
+    m_shownPrompt = continuation ? "> " : m_prompt;
+    std::cout << m_shownPrompt;
+}
 
-    // Check if the arguments represent a valid number
-    if (m_num_args == 2) {
-        if(!isStringRepValidNum(m_cmd_args[1])) {
-            std::cerr << "smash error: fg: invalid arguments" << std::endl;
-            return;
-        }
-        job_id = std::stoi(m_cmd_args[1]);
-    }
+const std::string& SmallShell::getShownPrompt() const {
+    return m_shownPrompt;
+}
 
-    JobsList::JobEntry* job = m_jobsList->getJobById(job_id);
+void SmallShell::setPrompt(const std::string& newPrompt) {
+    m_prompt = newPrompt;
+}
 
-    if(job == nullptr && m_num_args == 2) {
-        std::cerr << "smash error: fg: job-id " << job_id << " does not exist" << std::endl;
-        return;
-    }
+const std::string& SmallShell::getPrompt() const {
+    return m_prompt;
+}
 
-    // No argument specified, hence print empty list error
-    if(m_jobsList->empty()) {
-        std::cerr << "smash error: fg: jobs list is empty" << std::endl;
-        return;
+const char* SmallShell::getLastPwd() const {
+    return m_lastPwd;
+}
+
+void SmallShell::setLastPwd(const char* path) {
+    if (m_lastPwd != NULL) {
+        free(m_lastPwd);
     }
+    m_lastPwd = strdup(path);
+}
 
-    pid_t job_pid = job->getJobPID();
-    std::string cmd_line = job->getCmdLine();
+std::vector<std::pair<std::string, std::string>>& SmallShell::getAliases() {
+    return getInstance().m_aliases;
+}
 
-    std::cout << job->getCmdLine() << " " << job_pid <<  std::endl;
+JobsList& SmallShell::getJobsList() {
+    return m_jobsList;
+}
 
-    m_jobsList->removeJobById(job_id);
-    smash_fg_pid = job_pid;
+Scheduler& SmallShell::getScheduler() {
+    return m_scheduler;
+}
 
-    if (kill(job_pid, SIGCONT) == -1) {
-        perror("smash error: kill failed");
-        smash_fg_pid = 0;
-        return;
+/*
+ * External commands are spawned directly, anything else runs in a forked child shell. The
+ * command line is kept as text and expanded by the child.
+ */
+pid_t SmallShell::startJob(const std::string& cmd_line) {
+    std::string resolved = resolveAlias(cmd_line.c_str());
+    Command* cmd = Script::isCompound(resolved.c_str()) ? nullptr : CreateCommand(resolved.c_str());
+    auto* external_cmd = dynamic_cast<ExternalCommand*>(cmd);
+    pid_t pid;
+    if (external_cmd != nullptr) {
+        pid = external_cmd->spawn();
+    } else {
+        std::cout.flush();
+        pid = fork();
+        if (pid == -1) {
+            perror("smash error: fork failed");
+        }
+        if (pid == 0) {
+            setpgrp();
+            if (cmd != nullptr) {
+                cmd->execute();
+                std::cout.flush();
+                exit(cmd->getExitStatus());
+            }
+            executeCommand(cmd_line.c_str());
+            std::cout.flush();
+            exit(m_lastExitStatus);
+        }
     }
+    delete cmd;
+    if (pid <= 0) {
+        return -1;
+    }
+    m_jobsList.addJob(cmd_line, pid);
+    return pid;
+}
 
-    int status;
-    if (waitpid(job_pid, &status, WUNTRACED) == -1) {
-        perror("smash error: waitpid failed");
-        smash_fg_pid = 0;
+const std::shared_ptr<LaunchOptions>& SmallShell::getLaunch() const {
+    return m_launch;
+}
+
+void SmallShell::setLaunch(std::shared_ptr<LaunchOptions> launch) {
+    m_launch = std::move(launch);
+}
+
+void SmallShell::auditLine() {
+    if (!m_auditPending) {
         return;
     }
+    const JobsList::JobEntry* job = (m_lastStartedPid != 0) ? m_jobsList.getJobByPid(m_lastStartedPid) : nullptr;
+    m_auditLog.record(m_auditedTimeNs, clockNs(CLOCK_MONOTONIC) - m_auditedStartNs, m_lastStartedPid,
+                      job != nullptr ? job->getJobID() : -1, m_lastExitStatus, m_auditedLine, m_auditedLength);
+    m_auditPending = false;
+}
 
-    if (WIFSTOPPED(status)) {
-        m_jobsList->addJob(std::move(cmd_line), job_pid, true);
-    }
-    smash_fg_pid = 0;
+AuditLog& SmallShell::getAuditLog() {
+    return m_auditLog;
+}
 
+void SmallShell::setLastStartedPid(pid_t pid) {
+    m_lastStartedPid = pid;
 }
 
-// quit command
+History& SmallShell::getHistory() {
+    return m_history;
+}
 
-QuitCommand::QuitCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line, true), m_jobs_list(jobs) {
-    if(m_num_args > 1 && strcmp(m_cmd_args[1], "kill") == 0) {
-        m_is_kill_specified = true;
-    }
+JobLogs& SmallShell::getJobLogs() {
+    return m_jobLogs;
 }
 
-void QuitCommand::execute() {
-    if (m_is_kill_specified) {
-        m_jobs_list->killAllJobs();
+
+// Command class
+Command::Command(const char* cmd_line, bool parse_args) : m_arena(Arena::current()), m_cmd_line(cmd_line),
+          m_parseArgs(parse_args), m_cmd_args{}, m_num_args(parse_args ? _parseCommandLine(cmd_line, m_cmd_args, m_arena) : 0),
+          m_exitStatus(0), m_out(&std::cout), m_outFd(STDOUT_FILENO), m_inFd(STDIN_FILENO) {}
+
+Command::~Command() {
+    if (m_arena != nullptr) {
+        return; // The arguments are released together with the arena
+    }
+    for (int i = 0; i < m_num_args; ++i) {
+        free(m_cmd_args[i]);
     }
-    // The QuitCommand pointer and all process memory will be reclaimed by the OS when calling exit()
-    exit(0);
 }
 
+// Every allocation is prefixed with the arena it came from (NULL for the global heap)
+static const size_t COMMAND_HEADER_SIZE = alignof(std::max_align_t);
 
-// kill command
-KillCommand::KillCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line, true), m_jobsList(jobs){}
+void* Command::operator new(size_t size) {
+    Arena* arena = Arena::current();
+    void* block = (arena != nullptr) ? arena->allocate(size + COMMAND_HEADER_SIZE)
+                                     : ::operator new(size + COMMAND_HEADER_SIZE);
+    *static_cast<Arena**>(block) = arena;
+    return static_cast<char*>(block) + COMMAND_HEADER_SIZE;
+}
 
-void KillCommand::execute() {
-    if (m_num_args != 3) {
-        std::cerr << "smash error: kill: invalid arguments" << std::endl;
+void Command::operator delete(void* ptr) {
+    if (ptr == nullptr) {
         return;
     }
+    void* block = static_cast<char*>(ptr) - COMMAND_HEADER_SIZE;
+    if (*static_cast<Arena**>(block) == nullptr) {
+        ::operator delete(block);
+    }
+}
 
-    const char* signum_str = m_cmd_args[1];
+const ArenaString& Command::getCmdLine() const {
+    return m_cmd_line;
+}
 
-    if (signum_str[0] == '-') {
-        signum_str = signum_str + 1;
-    } else {
-        std::cerr << "smash error: kill: invalid arguments" << std::endl;
-        return;
+void Command::parseArguments(const char* line) {
+    if (m_arena == nullptr) {
+        for (int i = 0; i < m_num_args; ++i) {
+            free(m_cmd_args[i]);
+        }
     }
+    m_num_args = _parseCommandLine(line, m_cmd_args, m_arena);
+}
 
-    if (!isStringRepValidNum(signum_str) || !isStringRepValidNum(m_cmd_args[2])) {
-        std::cerr << "smash error: kill: invalid arguments" << std::endl;
-        return;
+void Command::expandArguments() {
+    if (m_parseArgs) {
+        parseArguments(m_cmd_line.c_str());
     }
+}
 
-    int signum = std::stoi(signum_str);
-    int job_id = std::stoi(m_cmd_args[2]);
-    auto job = m_jobsList->getJobById(job_id);
-
-    if (job == nullptr) {
-        std::cerr << "smash error: kill: job-id " << job_id << " does not exist" << std::endl;
-        return;
+void Command::executeAgain(bool expand) {
+    if (expand) {
+        expandArguments();
     }
+    m_exitStatus = 0;
+    execute();
+}
 
-    pid_t job_pid = job->getJobPID();
+int Command::getExitStatus() const {
+    return m_exitStatus;
+}
 
-    if (kill(job_pid, signum) == -1) {
-        perror("smash error: kill failed");
-        return;
-    }
-    std::cout << "signal number " << signum << " was sent to pid " << job_pid << std::endl;
+void Command::setOutput(FdOutputStream* out) {
+    m_out = out;
+    m_outFd = out->fd();
+}
 
+void Command::setInput(int fd) {
+    m_inFd = fd;
 }
 
-// alias command
-const std::unordered_set<std::string> AliasCommand::RESERVED_KEYWORDS = {
-        "chprompt", "showpid", "pwd", "cd", "jobs", "fg",
-        "quit", "kill", "alias", "unalias", "unsetenv", "sysinfo",
-        "du", "whoami", "usbinfo"
-};
+int Command::outputFd() {
+    m_out->flush();
+    return m_outFd;
+}
 
+bool Command::canRunInPipeline() const {
+    return false;
+}
 
-AliasCommand::AliasCommand(const char *cmd_line) : BuiltInCommand(cmd_line, true) {}
+bool Command::canExpandAgain() const {
+    // Commands that parse their arguments themselves or keep what they made of them do not
+    return m_parseArgs;
+}
 
-void AliasCommand::execute() {
-    auto& allAlias = SmallShell::getAliases();
-    if(m_num_args == 1) {
-        for(const auto& al : allAlias) {
-            std::cout << al.first << "='" << al.second << "'" << std::endl;
-        }
-        return;
+// Converts a waitpid() status to a shell exit status
+static int exitStatusOf(int wait_status) {
+    if (WIFEXITED(wait_status)) {
+        return WEXITSTATUS(wait_status);
     }
-    extractNameAndCommand();
-    if (m_name.empty() || m_command.empty()) {
-        // Parsing error already printed inside extractNameAndCommand
-        return;
+    if (WIFSIGNALED(wait_status)) {
+        return 128 + WTERMSIG(wait_status);
     }
-    insertNewAlias(allAlias);
+    return 128 + WSTOPSIG(wait_status);
 }
 
-void AliasCommand::extractNameAndCommand() {
-    std::string cmd_s = _trim(m_cmd_line);
-    size_t alias_end_pos = 5;
-    size_t definition_start = cmd_s.find_first_not_of(WHITESPACE, alias_end_pos);
-    std::string raw_definition = cmd_s.substr(definition_start);
-    size_t eq_pos = raw_definition.find('=');
-    if (eq_pos == std::string::npos || eq_pos == 0) {
-        // '=' must exist and cannot be the first character.
-        std::cerr << "smash error: alias: invalid alias format" << std::endl;
-        return;
+// BuiltInCommand class
+BuiltInCommand::BuiltInCommand(const char* cmd_line, bool parse_args) : Command(cmd_line, parse_args) {}
+
+void BuiltInCommand::executeExternal() {
+    ExternalCommand external(m_cmd_line.c_str());
+    FdRedirections redirections;
+    if (m_inFd != STDIN_FILENO) {
+        redirections.emplace_back(m_inFd, STDIN_FILENO);
     }
-    // Extract the name
-    m_name = _trim(raw_definition.substr(0, eq_pos));
-    // Extract the command part
-    std::string command_part = raw_definition.substr(eq_pos + 1);
-    if (command_part.length() < 2 || command_part.front() != '\'' || command_part.back() != '\'') {
-        std::cerr << "smash error: alias: invalid alias format" << std::endl;
-        return;
+    if (outputFd() != STDOUT_FILENO) {
+        redirections.emplace_back(m_outFd, STDOUT_FILENO);
     }
-    // Extract the command
-    m_command = command_part.substr(1, command_part.length() - 2);
+    external.setRedirections(redirections);
+    external.execute();
+    m_exitStatus = external.getExitStatus();
 }
 
-bool AliasCommand::isValidName() const {
-    // Assuming the name is not empty
-    if (RESERVED_KEYWORDS.count(m_name) > 0) {
-        std::cerr << "smash error: alias: " << m_name << " already exists or is a reserved command" << std::endl;
-        return false;
-    }
+// ExternalCommand class
 
-    for(const auto& name_pair: SmallShell::getAliases()) {
-        if(name_pair.first == m_name) {
-            std::cerr << "smash error: alias: " << m_name << " already exists or is a reserved command" << std::endl;
-            return false;
-        }
+ExternalCommand::ExternalCommand(const char* cmd_line) : Command(cmd_line, false) {
+    m_removed_background_cmd_line = _removedBackgroundSign<ArenaString>(m_cmd_line.c_str());
+    expandArguments();
+}
+
+void ExternalCommand::expandArguments() {
+    if (is_complex_command()) {
+        // bash sees neither the shell variables nor $? of smash, the line reaches it expanded
+        char quote = '\0';
+        m_bashScript.clear();
+        SmallShell::getInstance().expandParameters(m_removed_background_cmd_line.c_str(),
+                                                   m_removed_background_cmd_line.size(), m_bashScript, quote);
+    } else {
+        parseArguments(m_removed_background_cmd_line.c_str());
     }
+}
+
+bool ExternalCommand::canExpandAgain() const {
     return true;
 }
 
-bool AliasCommand::isLegalName() const {
-    if(m_name.empty()) {
-        std::cerr << "smash error: alias: invalid alias format" << std::endl;
-        return false;
+pid_t ExternalCommand::spawn() {
+    bool isComplex = is_complex_command();
+    char *argv[] = {
+            const_cast<char*>("/bin/bash"),
+            const_cast<char*>("-c"),
+            const_cast<char*>(m_bashScript.c_str()),
+            NULL
+    };
+    char** ArgList = isComplex ? argv : m_cmd_args;
+
+    // The child writes to the same stdout, after what the shell printed so far
+    std::cout.flush();
+    // The launcher cannot apply run options (the child does it between fork and exec)
+    const std::shared_ptr<LaunchOptions>& launch = SmallShell::getInstance().getLaunch();
+    const Cgroup* cgroup = (launch != nullptr) ? launch->cgroup.get() : nullptr;
+    pid_t pid = (launch == nullptr) ? Launcher::spawn(ArgList, m_redirections.data(), m_redirections.size()) : -1;
+    if (pid == -1) {
+        pid = (cgroup != nullptr) ? cgroup->fork() : fork();
     }
-    for(char c: m_name) {
-        if (!std::isalnum(c) && c != '_') {
-            std::cerr << "smash error: alias: invalid alias format" << std::endl;
-            return false;
+    if(pid < 0) {
+        perror("smash error: fork failed");
+        return -1;
+    }
+
+    // For the child
+    if(pid == 0) {
+        setpgrp();
+        if (launch != nullptr && !launch->apply()) {
+            exit(1);
+        }
+        for (const auto& redirection : m_redirections) {
+            if (dup2(redirection.first, redirection.second) == -1) {
+                perror("smash error: dup2 failed");
+                exit(1);
+            }
         }
+        execvp(ArgList[0], ArgList);
+        perror("smash error: execvp failed");
+        exit(1);
     }
-    return true;
+    SmallShell::getInstance().setLastStartedPid(pid);
+    return pid;
 }
 
-void AliasCommand::insertNewAlias(std::vector<std::pair<std::string, std::string>>& allAlias) const {
-    if(isValidName() && isLegalName()) {
-            allAlias.emplace_back(m_name, m_command);
+void ExternalCommand::execute() {
+    const char* cmd_line = m_cmd_line.c_str();
+    SmallShell& smash = SmallShell::getInstance();
+    bool is_background = _isBackgroundComamnd(cmd_line);
+
+    // A captured background job writes stdout and stderr into a pipe drained by the shell,
+    // its own redirections still apply on top
+    int log_pipe[2] = {-1, -1};
+    if (is_background && smash.getJobLogs().isCapturing() && pipe2(log_pipe, O_CLOEXEC) == 0) {
+        m_redirections.insert(m_redirections.begin(), {{log_pipe[1], STDOUT_FILENO}, {log_pipe[1], STDERR_FILENO}});
     }
-}
+
+    pid_t pid = spawn();
+    if (log_pipe[1] != -1) {
+        close(log_pipe[1]);
+        m_redirections.erase(m_redirections.begin(), m_redirections.begin() + 2);
+    }
+    if (pid < 0) {
+        if (log_pipe[0] != -1) {
+            close(log_pipe[0]);
+        }
+        m_exitStatus = 1;
+        return;
+    }
+
+    // For the parent-smash process
+    if(is_background) {
+        smash.getJobsList().addJob(this, pid, false, smash.getLaunch());
+        if (log_pipe[0] != -1) {
+            smash.getJobLogs().add(smash.getJobsList().getMaxJobId(), cmd_line, log_pipe[0]);
+        }
+    } else {
+        smash_fg_pid = pid;
+        int status;
+        if (waitpid(pid, &status, WUNTRACED) == -1) {
+            perror("smash error: waitpid failed");
+            smash_fg_pid = 0;
+            m_exitStatus = 1;
+            return;
+        }
+
+        smash_fg_pid = 0;
+        m_exitStatus = exitStatusOf(status);
+
+        if (WIFSTOPPED(status)) {
+            smash.getJobsList().addJob(this, pid, true, smash.getLaunch());
+        }
+    }
+}
+
+void ExternalCommand::setRedirections(const FdRedirections& redirections) {
+    m_redirections = redirections;
+}
+
+bool ExternalCommand::is_complex_command() const {
+    return _hasWildcards(m_cmd_line.c_str());
+}
+
+
+// chprompt command
+ChangePromptCommand::ChangePromptCommand(const char *cmd_line, SmallShell *smash) : BuiltInCommand(cmd_line, false), m_sshell(smash) {
+    // find first parameter and ignore the rest of the command line
+    string cmd_s = _trim(string(cmd_line));
+    string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
+    string remaining = cmd_s.substr(firstWord.length());
+    string newPrompt = _trim(remaining);
+    newPrompt = newPrompt.substr(0, newPrompt.find_first_of(" \n"));
+    if(newPrompt.empty()) {
+        newPrompt = "smash> ";
+    } else {
+        newPrompt = newPrompt + "> ";
+    }
+    this->m_prompt = newPrompt.c_str();
+}
+
+void ChangePromptCommand::execute() {
+    m_sshell->setPrompt(m_prompt.c_str());
+}
+
+// showpid command
+ShowPidCommand::ShowPidCommand(const char* cmd_line) : BuiltInCommand(cmd_line, false) {}
+
+void ShowPidCommand::execute() {
+    *m_out << "smash pid is " << getpid() << '\n';
+}
+
+bool ShowPidCommand::canRunInPipeline() const {
+    return true;
+}
+
+// pwd command
+GetCurrDirCommand::GetCurrDirCommand(const char* cmd_line) : BuiltInCommand(cmd_line, false) {}
+
+void GetCurrDirCommand::execute() {
+    char buffer[PATH_MAX];
+    if (getcwd(buffer, PATH_MAX) != NULL) {
+        *m_out << buffer << '\n';
+    } else {
+        perror("smash error: getcwd failed");
+    }
+}
+
+bool GetCurrDirCommand::canRunInPipeline() const {
+    return true;
+}
+
+// cd command
+ChangeDirCommand::ChangeDirCommand(const char *cmd_line, char **plastPwd) : BuiltInCommand(cmd_line, true), m_plastPwd(plastPwd)
+{}
+
+void ChangeDirCommand::execute() {
+    if(m_num_args > 2) {
+        std::cerr << "smash error: cd: too many arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    m_targetPath = (m_num_args == 2) ? m_cmd_args[1] : "";
+
+    if(m_targetPath.empty()) {
+        return;
+    }
+
+    char curr_path[PATH_MAX];
+
+    if (getcwd(curr_path, PATH_MAX) == NULL) {
+        perror("smash error: getcwd failed");
+        m_exitStatus = 1;
+        return;
+    }
+
+    const char* target_path = m_targetPath.c_str();
+
+    if(m_targetPath == "-") {
+        if(*m_plastPwd == NULL || strlen(*m_plastPwd) == 0) {
+            std::cerr << "smash error: cd: OLDPWD not set" << std::endl;
+            m_exitStatus = 1;
+            return;
+        }
+        target_path = *m_plastPwd;
+    }
+
+    if(chdir(target_path) == -1) {
+        perror("smash error: chdir failed");
+        m_exitStatus = 1;
+        return;
+    }
+
+    if (*m_plastPwd != NULL) {
+        free(*m_plastPwd);
+    }
+
+    *m_plastPwd = strdup(curr_path);
+}
+
+// jobs command
+
+JobsCommand::JobsCommand(const char *cmd_line, JobsList *jobs, ProcessTree *tree) : BuiltInCommand(cmd_line, true),
+m_jobsList(jobs), m_processTree(tree) {}
+
+
+void JobsCommand::execute() {
+    // Finished jobs will be removed inside printJobsList()
+    if (m_num_args >= 2 && strcmp(m_cmd_args[1], "-t") == 0) {
+        m_jobsList->printJobsTree(*m_out, *m_processTree);
+        return;
+    }
+    m_jobsList->printJobsList(*m_out, m_num_args >= 2 && strcmp(m_cmd_args[1], "-l") == 0);
+}
+
+bool JobsCommand::canRunInPipeline() const {
+    return true;
+}
+
+// fg command
+ForegroundCommand::ForegroundCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line, true),
+m_jobsList(jobs){}
+
+
+void ForegroundCommand::execute() {
+    if(m_num_args > 2) {
+        std::cerr << "smash error: fg: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    int job_id = m_jobsList->getMaxJobId();
+
+    // Check if the arguments represent a valid number
+    if (m_num_args == 2) {
+        if(!isStringRepValidNum(m_cmd_args[1])) {
+            std::cerr << "smash error: fg: invalid arguments" << std::endl;
+            m_exitStatus = 1;
+            return;
+        }
+        job_id = std::stoi(m_cmd_args[1]);
+    }
+
+    JobsList::JobEntry* job = m_jobsList->getJobById(job_id);
+
+    if(job == nullptr && m_num_args == 2) {
+        std::cerr << "smash error: fg: job-id " << job_id << " does not exist" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    // No argument specified, hence print empty list error
+    if(m_jobsList->empty()) {
+        std::cerr << "smash error: fg: jobs list is empty" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    pid_t job_pid = job->getJobPID();
+    std::string cmd_line = job->getCmdLine();
+    std::shared_ptr<LaunchOptions> launch = job->getLaunch();
+
+    // Shown before the job writes anything more
+    *m_out << job->getCmdLine() << " " << job_pid << std::endl;
+
+    m_jobsList->removeJobById(job_id);
+    smash_fg_pid = job_pid;
+
+    if (kill(job_pid, SIGCONT) == -1) {
+        perror("smash error: kill failed");
+        smash_fg_pid = 0;
+        m_exitStatus = 1;
+        return;
+    }
+
+    int status;
+    if (waitpid(job_pid, &status, WUNTRACED) == -1) {
+        perror("smash error: waitpid failed");
+        smash_fg_pid = 0;
+        m_exitStatus = 1;
+        return;
+    }
+
+    if (WIFSTOPPED(status)) {
+        m_jobsList->addJob(std::move(cmd_line), job_pid, true, launch);
+    }
+    smash_fg_pid = 0;
+    m_exitStatus = exitStatusOf(status);
+
+}
+
+// quit command
+
+QuitCommand::QuitCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line, true), m_jobs_list(jobs) {
+    if(m_num_args > 1 && strcmp(m_cmd_args[1], "kill") == 0) {
+        m_is_kill_specified = true;
+        if (m_num_args > 2) {
+            m_grace = parseDuration(m_cmd_args[2]);
+        }
+    }
+}
+
+void QuitCommand::execute() {
+    if (m_grace < 0) {
+        std::cerr << "smash error: quit: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+    if (m_is_kill_specified) {
+        m_jobs_list->killAllJobs(m_grace);
+    }
+    SmallShell::getInstance().auditLine();
+    std::cout.flush();
+    // The QuitCommand pointer and all process memory will be reclaimed by the OS when calling exit()
+    exit(0);
+}
+
+bool QuitCommand::canExpandAgain() const {
+    return false;
+}
+
+
+// kill command
+KillCommand::KillCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line, true), m_jobsList(jobs){}
+
+void KillCommand::execute() {
+    if (m_num_args != 3) {
+        std::cerr << "smash error: kill: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    const char* signum_str = m_cmd_args[1];
+
+    if (signum_str[0] == '-') {
+        signum_str = signum_str + 1;
+    } else {
+        std::cerr << "smash error: kill: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    if (!isStringRepValidNum(signum_str) || !isStringRepValidNum(m_cmd_args[2])) {
+        std::cerr << "smash error: kill: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    int signum = std::stoi(signum_str);
+    int job_id = std::stoi(m_cmd_args[2]);
+    auto job = m_jobsList->getJobById(job_id);
+
+    if (job == nullptr) {
+        std::cerr << "smash error: kill: job-id " << job_id << " does not exist" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    pid_t job_pid = job->getJobPID();
+
+    if (job->sendSignal(signum) == -1) {
+        perror("smash error: kill failed");
+        m_exitStatus = 1;
+        return;
+    }
+    *m_out << "signal number " << signum << " was sent to pid " << job_pid << '\n';
+
+}
+
+// alias command
+const std::unordered_set<std::string> AliasCommand::RESERVED_KEYWORDS = {
+        "chprompt", "showpid", "pwd", "cd", "jobs", "fg",
+        "quit", "kill", "alias", "unalias", "unsetenv", "sysinfo",
+        "du", "whoami", "usbinfo", "cat", "tee", "parallel", "applet",
+        "joblog", "export", "unset", "timeout", "every", "history", "watchrun", "run", "audit", "if", "then", "elif", "else", "fi", "while", "until", "do", "done", "for", "in",
+        "function"
+};
+
+
+AliasCommand::AliasCommand(const char *cmd_line) : BuiltInCommand(cmd_line, true) {}
+
+void AliasCommand::execute() {
+    auto& allAlias = SmallShell::getAliases();
+    if(m_num_args == 1) {
+        for(const auto& al : allAlias) {
+            *m_out << al.first << "='" << al.second << "'\n";
+        }
+        return;
+    }
+    extractNameAndCommand();
+    if (m_name.empty() || m_command.empty()) {
+        // Parsing error already printed inside extractNameAndCommand
+        m_exitStatus = 1;
+        return;
+    }
+    if (!insertNewAlias(allAlias)) {
+        m_exitStatus = 1;
+    }
+}
+
+bool AliasCommand::canRunInPipeline() const {
+    // Only listing the aliases, defining one inside a pipeline has no effect on the shell
+    return m_num_args == 1;
+}
+
+void AliasCommand::extractNameAndCommand() {
+    std::string cmd_s = _trim(m_cmd_line.c_str());
+    size_t alias_end_pos = 5;
+    size_t definition_start = cmd_s.find_first_not_of(WHITESPACE, alias_end_pos);
+    std::string raw_definition = cmd_s.substr(definition_start);
+    size_t eq_pos = raw_definition.find('=');
+    if (eq_pos == std::string::npos || eq_pos == 0) {
+        // '=' must exist and cannot be the first character.
+        std::cerr << "smash error: alias: invalid alias format" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+    // Extract the name
+    m_name = _trim(raw_definition.substr(0, eq_pos)).c_str();
+    // Extract the command part
+    std::string command_part = raw_definition.substr(eq_pos + 1);
+    if (command_part.length() < 2 || command_part.front() != '\'' || command_part.back() != '\'') {
+        std::cerr << "smash error: alias: invalid alias format" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+    // Extract the command
+    m_command = command_part.substr(1, command_part.length() - 2).c_str();
+}
+
+bool AliasCommand::isValidName() const {
+    // Assuming the name is not empty
+    if (RESERVED_KEYWORDS.count(m_name.c_str()) > 0) {
+        std::cerr << "smash error: alias: " << m_name << " already exists or is a reserved command" << std::endl;
+        return false;
+    }
+
+    for(const auto& name_pair: SmallShell::getAliases()) {
+        if(name_pair.first == m_name.c_str()) {
+            std::cerr << "smash error: alias: " << m_name << " already exists or is a reserved command" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AliasCommand::isLegalName() const {
+    if(m_name.empty()) {
+        std::cerr << "smash error: alias: invalid alias format" << std::endl;
+        return false;
+    }
+    for(char c: m_name) {
+        if (!std::isalnum(c) && c != '_') {
+            std::cerr << "smash error: alias: invalid alias format" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AliasCommand::insertNewAlias(std::vector<std::pair<std::string, std::string>>& allAlias) const {
+    if(isValidName() && isLegalName()) {
+            allAlias.emplace_back(m_name.c_str(), m_command.c_str());
+            return true;
+    }
+    return false;
+}
 
 // unalias command
 UnAliasCommand::UnAliasCommand(const char *cmd_line) : BuiltInCommand(cmd_line, true) {}
 
-void UnAliasCommand::execute() {
-    if(m_num_args <= 1) {
-        std::cerr << "smash error: unalias: not enough arguments" << std::endl;
+void UnAliasCommand::execute() {
+    if(m_num_args <= 1) {
+        std::cerr << "smash error: unalias: not enough arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    auto& allAlias = SmallShell::getAliases();
+    for(int i = 1; i < m_num_args; i++) {
+        std::string alias_to_delete = m_cmd_args[i];
+        bool isFound = false;
+
+        for (auto it = allAlias.begin(); it != allAlias.end(); ++it) {
+            if (it->first == alias_to_delete) {
+                allAlias.erase(it);
+                isFound = true;
+                break;
+            }
+        }
+        if(!isFound) {
+            std::cerr << "smash error: unalias: " << alias_to_delete << " alias does not exist" << std::endl;
+            m_exitStatus = 1;
+            return;
+        }
+    }
+
+}
+
+// Variable assignment commands
+
+// The line without the leading words_to_skip words and a trailing '&'
+static std::string _argumentsText(const ArenaString& cmd_line, int words_to_skip) {
+    std::string line(cmd_line.c_str());
+    size_t end = line.find_last_not_of(WHITESPACE);
+    if (end != std::string::npos && line[end] == '&') {
+        line.erase(end);
+    }
+    size_t pos = line.find_first_not_of(WHITESPACE);
+    for (int i = 0; i < words_to_skip && pos != std::string::npos; i++) {
+        pos = line.find_first_not_of(WHITESPACE, line.find_first_of(WHITESPACE, pos));
+    }
+    return (pos == std::string::npos) ? "" : line.substr(pos);
+}
+
+/*
+ * Reads the NAME=value word at pos of line into name and value, with the value's quotes removed
+ * and its parameters and command substitutions expanded ('...' is taken literally). pos moves
+ * past the word, substituted is set when a command ran. Returns false, leaving pos as is, when
+ * the word is not an assignment.
+ */
+static bool _parseAssignment(const std::string& line, size_t& pos, std::string& name, ArenaString& value,
+                             bool& substituted) {
+    size_t name_end = pos;
+    while (name_end < line.size() && line[name_end] != '=' && WHITESPACE.find(line[name_end]) == std::string::npos) {
+        ++name_end;
+    }
+    if (name_end == line.size() || line[name_end] != '=' ||
+        !ShellVariables::isValidName(line.c_str() + pos, name_end - pos)) {
+        return false;
+    }
+    name.assign(line, pos, name_end - pos);
+
+    SmallShell& smash = SmallShell::getInstance();
+    char quote = '\0';
+    size_t i = name_end + 1;
+    while (i < line.size() && (quote != '\0' || WHITESPACE.find(line[i]) == std::string::npos)) {
+        char c = line[i];
+        size_t substitution_end = (quote != '\'') ? SmallShell::substitutionEnd(line.c_str(), i, line.size()) : i;
+        if (substitution_end != i && substitution_end != std::string::npos) {
+            size_t command_start = i + ((c == '$') ? 2 : 1);
+            smash.substituteCommand(line.c_str() + command_start, substitution_end - 1 - command_start, value);
+            i = substitution_end;
+            substituted = true;
+        } else if (c == quote) {
+            quote = '\0';
+            ++i;
+        } else if (quote == '\0' && (c == '\'' || c == '"')) {
+            quote = c;
+            ++i;
+        } else if (c == '\\' && quote != '\'' && i + 1 < line.size()) {
+            value += line[i + 1];
+            i += 2;
+        } else {
+            size_t used = 0;
+            if (c == '$' && quote != '\'') {
+                used = smash.expandParameter(line.c_str() + i + 1, line.size() - i - 1, value);
+            }
+            if (used == 0) {
+                value += c;
+            }
+            i += used + 1;
+        }
+    }
+    pos = i;
+    return true;
+}
+
+// NAME=value command
+AssignmentCommand::AssignmentCommand(const char *cmd_line) : BuiltInCommand(cmd_line, false) {}
+
+void AssignmentCommand::execute() {
+    // Values are expanded as the assignments are made, so "a=1 b=$a" sets b to 1
+    SmallShell& smash = SmallShell::getInstance();
+    ShellVariables& variables = smash.getVariables();
+    std::string line = _argumentsText(m_cmd_line, 0);
+    size_t pos = 0;
+    bool substituted = false;
+    while (pos < line.size()) {
+        std::string name;
+        ArenaString value;
+        if (!_parseAssignment(line, pos, name, value, substituted)) {
+            std::cerr << "smash error: " << line.substr(pos, line.find_first_of(WHITESPACE, pos) - pos)
+                      << ": assignments before a command are not supported" << std::endl;
+            m_exitStatus = 1;
+            return;
+        }
+        variables.set(name.data(), name.size(), value.data(), value.size());
+        pos = std::min(line.size(), line.find_first_not_of(WHITESPACE, pos));
+    }
+    // Like bash, x=$(cmd) has the exit status of cmd
+    if (substituted) {
+        m_exitStatus = smash.getLastExitStatus();
+    }
+}
+
+bool AssignmentCommand::canExpandAgain() const {
+    // The values are expanded by execute()
+    return true;
+}
+
+// export command
+ExportCommand::ExportCommand(const char *cmd_line) : BuiltInCommand(cmd_line, false) {}
+
+void ExportCommand::execute() {
+    std::string line = _argumentsText(m_cmd_line, 1);
+    if (line.empty()) {
+        for (char** entry = environ; *entry != nullptr; entry++) {
+            *m_out << "export " << *entry << '\n';
+        }
+        return;
+    }
+
+    ShellVariables& variables = SmallShell::getInstance().getVariables();
+    size_t pos = 0;
+    bool substituted = false;
+    while (pos < line.size()) {
+        std::string name;
+        ArenaString value;
+        if (_parseAssignment(line, pos, name, value, substituted)) {
+            variables.exportName(name.data(), name.size(), value.data(), value.size());
+        } else {
+            size_t end = std::min(line.size(), line.find_first_of(WHITESPACE, pos));
+            if (ShellVariables::isValidName(line.c_str() + pos, end - pos)) {
+                variables.exportName(line.c_str() + pos, end - pos, nullptr, 0);
+            } else {
+                std::cerr << "smash error: export: " << line.substr(pos, end - pos) << ": not a valid identifier"
+                          << std::endl;
+                m_exitStatus = 1;
+            }
+            pos = end;
+        }
+        pos = std::min(line.size(), line.find_first_not_of(WHITESPACE, pos));
+    }
+}
+
+bool ExportCommand::canRunInPipeline() const {
+    return _argumentsText(m_cmd_line, 1).empty();
+}
+
+bool ExportCommand::canExpandAgain() const {
+    return true;
+}
+
+// unset command
+UnsetCommand::UnsetCommand(const char *cmd_line) : BuiltInCommand(cmd_line, true) {}
+
+void UnsetCommand::execute() {
+    ShellVariables& variables = SmallShell::getInstance().getVariables();
+    for (int i = 1; i < m_num_args; i++) {
+        size_t length = strlen(m_cmd_args[i]);
+        if (!ShellVariables::isValidName(m_cmd_args[i], length)) {
+            std::cerr << "smash error: unset: " << m_cmd_args[i] << ": not a valid identifier" << std::endl;
+            m_exitStatus = 1;
+            continue;
+        }
+        variables.unset(m_cmd_args[i], length);
+    }
+}
+
+// timeout command
+
+// Seconds of a GNU timeout duration ("1.5", "30s", "2m", "1h", "1d"), -1 when invalid
+static double parseDuration(const std::string& word) {
+    char* end;
+    double seconds = strtod(word.c_str(), &end);
+    if (end == word.c_str() || seconds < 0) {
+        return -1;
+    }
+    std::string suffix(end);
+    if (suffix == "m") {
+        seconds *= 60;
+    } else if (suffix == "h") {
+        seconds *= 60 * 60;
+    } else if (suffix == "d") {
+        seconds *= 24 * 60 * 60;
+    } else if (!suffix.empty() && suffix != "s") {
+        return -1;
+    }
+    return seconds;
+}
+
+// A signal given as a number, a name or a name with the SIG prefix, -1 when unknown
+static int parseSignal(const std::string& word) {
+    static const struct {
+        const char* name;
+        int number;
+    } SIGNALS[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL}, {"USR1", SIGUSR1},
+        {"USR2", SIGUSR2}, {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}
+    };
+    if (isStringRepValidNum(word.c_str())) {
+        int number = atoi(word.c_str());
+        return (number > 0 && number < NSIG) ? number : -1;
+    }
+    std::string name = (word.compare(0, 3, "SIG") == 0) ? word.substr(3) : word;
+    for (const auto& signal : SIGNALS) {
+        if (name == signal.name) {
+            return signal.number;
+        }
+    }
+    return -1;
+}
+
+static void armTimer(int timer_fd, double seconds) {
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = static_cast<time_t>(seconds);
+    spec.it_value.tv_nsec = static_cast<long>((seconds - spec.it_value.tv_sec) * 1e9);
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+        spec.it_value.tv_nsec = 1; // An all zero value would disarm the timer
+    }
+    timerfd_settime(timer_fd, 0, &spec, nullptr);
+}
+
+TimeoutCommand::TimeoutCommand(const char *cmd_line) : BuiltInCommand(cmd_line, false) {
+    // The command is kept as text, it is expanded once, when it is created in execute()
+    std::string line = _argumentsText(m_cmd_line, 1);
+    std::istringstream words(line);
+    std::string word;
+    int skipped = 1;
+    while (words >> word) {
+        ++skipped;
+        if (word == "-s" || word == "-k") {
+            std::string value;
+            if (!(words >> value)) {
+                m_syntaxError = true;
+                return;
+            }
+            ++skipped;
+            if (word == "-s") {
+                m_signal = parseSignal(value);
+                m_syntaxError = m_syntaxError || (m_signal == -1);
+            } else {
+                m_killAfter = parseDuration(value);
+                m_syntaxError = m_syntaxError || (m_killAfter < 0);
+            }
+            continue;
+        }
+        m_duration = parseDuration(word);
+        m_syntaxError = m_syntaxError || (m_duration < 0);
+        break;
+    }
+    m_command = _argumentsText(m_cmd_line, skipped);
+    m_syntaxError = m_syntaxError || m_command.empty();
+    m_background = _isBackgroundComamnd(m_cmd_line.c_str());
+}
+
+/*
+ * Waits for the pidfd (exit), the timerfd (deadline) and a signalfd of SIGCHLD (stop) together,
+ * so nothing polls nor sleeps. The signals go to the process group, -pid cannot have been reused
+ * since the child is only reaped once its pidfd reported the exit.
+ */
+void TimeoutCommand::execute() {
+    if (m_syntaxError) {
+        std::cerr << "smash error: timeout: invalid arguments" << std::endl;
+        m_exitStatus = 125;
+        return;
+    }
+    SmallShell& smash = SmallShell::getInstance();
+    if (m_background) {
+        std::string cmd_line = _removedBackgroundSign<std::string>(m_cmd_line.c_str());
+        m_exitStatus = (smash.startJob(cmd_line) == -1) ? 125 : 0;
+        return;
+    }
+
+    sigset_t child_mask;
+    sigset_t old_mask;
+    sigemptyset(&child_mask);
+    sigaddset(&child_mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &child_mask, &old_mask);
+    // Without them the deadline could not be kept, the command is not started
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    int signal_fd = signalfd(-1, &child_mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (timer_fd == -1 || signal_fd == -1) {
+        perror("smash error: timeout failed");
+        for (int fd : {timer_fd, signal_fd}) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+        sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+        m_exitStatus = 125;
+        return;
+    }
+
+    ExternalCommand* cmd = new ExternalCommand(m_command.c_str());
+    FdRedirections redirections;
+    int out_fd = outputFd();
+    if (out_fd != STDOUT_FILENO) {
+        redirections.emplace_back(out_fd, STDOUT_FILENO);
+    }
+    if (m_inFd != STDIN_FILENO) {
+        redirections.emplace_back(m_inFd, STDIN_FILENO);
+    }
+    cmd->setRedirections(redirections);
+    pid_t pid = cmd->spawn();
+    delete cmd;
+    if (pid < 0) {
+        close(timer_fd);
+        close(signal_fd);
+        sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+        m_exitStatus = 1;
+        return;
+    }
+    // Without pidfd support (-1 is ignored by poll) the exit shows up as SIGCHLD
+    int pid_fd = syscall(SYS_pidfd_open, pid, 0);
+    if (m_duration > 0) {
+        armTimer(timer_fd, m_duration);
+    }
+
+    smash_fg_pid = pid;
+    bool timed_out = false;
+    bool killed = false;
+    int status = 0;
+    while (true) {
+        struct pollfd fds[] = {{pid_fd, POLLIN, 0}, {timer_fd, POLLIN, 0}, {signal_fd, POLLIN, 0}};
+        if (poll(fds, 3, -1) == -1) {
+            if (errno == EINTR) {
+                continue; // ctrl-C killed the command, the pidfd or SIGCHLD reports it
+            }
+            perror("smash error: poll failed");
+            waitpid(pid, &status, 0);
+            break;
+        }
+        if (fds[2].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) > 0) {}
+        }
+        // A stop only shows up as SIGCHLD, an exit on the pidfd too
+        pid_t waited = waitpid(pid, &status, WNOHANG | WUNTRACED);
+        if (waited == pid) {
+            if (WIFSTOPPED(status)) {
+                smash.getJobsList().addJob(this, pid, true);
+            }
+            break;
+        }
+        if ((fds[0].revents & POLLIN) && waited == -1) {
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) == -1) {
+                continue;
+            }
+            if (!timed_out) {
+                timed_out = true;
+                kill(-pid, m_signal);
+                kill(-pid, SIGCONT);
+                if (m_killAfter > 0) {
+                    armTimer(timer_fd, m_killAfter);
+                }
+            } else {
+                killed = true;
+                kill(-pid, SIGKILL);
+            }
+        }
+    }
+    smash_fg_pid = 0;
+
+    for (int fd : {pid_fd, timer_fd, signal_fd}) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+
+    // Like GNU timeout, a command killed by SIGKILL (-k, or -s KILL) is not reported as timed out
+    if (killed || (timed_out && m_signal == SIGKILL && WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL)) {
+        m_exitStatus = 128 + SIGKILL;
+    } else if (timed_out && !WIFSTOPPED(status)) {
+        m_exitStatus = 124;
+    } else {
+        m_exitStatus = exitStatusOf(status);
+    }
+}
+
+// audit command
+AuditCommand::AuditCommand(const char *cmd_line, AuditLog *log) : BuiltInCommand(cmd_line, true), m_auditLog(log) {}
+
+void AuditCommand::execute() {
+    if (m_num_args == 1) {
+        m_auditLog->printStatus(*m_out);
+    } else if (m_num_args == 2 && strcmp(m_cmd_args[1], "off") == 0) {
+        m_auditLog->close();
+    } else if (m_num_args == 2) {
+        m_exitStatus = m_auditLog->open(m_cmd_args[1]) ? 0 : 1;
+    } else {
+        std::cerr << "smash error: audit: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+    }
+}
+
+bool AuditCommand::canRunInPipeline() const {
+    // Only the status, opening or closing the log inside a pipeline has no effect on the shell
+    return m_num_args == 1;
+}
+
+// run command
+
+// cpu.max for QUOTA[/PERIOD] microseconds or N% of one CPU, empty when invalid
+static std::string parseCpuMax(const std::string& word) {
+    static const unsigned long DEFAULT_PERIOD = 100000;
+    if (word.empty() || !isdigit(static_cast<unsigned char>(word[0]))) {
+        return "";
+    }
+    char* end;
+    unsigned long quota = strtoul(word.c_str(), &end, 10);
+    unsigned long period = DEFAULT_PERIOD;
+    if (strcmp(end, "%") == 0) {
+        quota = quota * DEFAULT_PERIOD / 100;
+    } else if (*end == '/' && isdigit(static_cast<unsigned char>(end[1]))) {
+        period = strtoul(end + 1, &end, 10);
+    }
+    if (*end != '\0' && strcmp(end, "%") != 0) {
+        return "";
+    }
+    return std::to_string(quota) + " " + std::to_string(period);
+}
+
+// "max" or a number, with a K, M or G suffix for a size, empty when invalid
+static std::string parseLimit(const std::string& word, bool is_size) {
+    size_t digits = word.find_first_not_of("0123456789");
+    if (word == "max" || (digits == std::string::npos && !word.empty())) {
+        return word;
+    }
+    bool suffixed = is_size && digits > 0 && digits + 1 == word.size() && strchr("KMGkmg", word[digits]);
+    return suffixed ? word : "";
+}
+
+RunCommand::RunCommand(const char *cmd_line) : BuiltInCommand(cmd_line, false) {
+    // The command is kept as text and executed as a line of its own
+    std::istringstream words(_argumentsText(m_cmd_line, 1));
+    std::string word;
+    int skipped = 1;
+    while (words >> word && word.compare(0, 2, "--") == 0) {
+        ++skipped;
+        if (word == "--") {
+            break;
+        }
+        if (word == "--cgroup") {
+            m_cgroup = true;
+            continue;
+        }
+        std::string value;
+        if (!(words >> value)) {
+            m_syntaxError = true;
+            return;
+        }
+        ++skipped;
+        std::string* limit = nullptr;
+        if (word == "--cpu-max") {
+            limit = &m_limits.cpuMax;
+            *limit = parseCpuMax(value);
+        } else if (word == "--memory-max" || word == "--pids-max") {
+            limit = (word == "--memory-max") ? &m_limits.memoryMax : &m_limits.pidsMax;
+            *limit = parseLimit(value, word == "--memory-max");
+        } else {
+            m_syntaxError = m_syntaxError || !m_options.parse(word, value);
+            continue;
+        }
+        m_syntaxError = m_syntaxError || limit->empty();
+        m_cgroup = true;
+    }
+    m_command = _argumentsText(m_cmd_line, skipped);
+    m_syntaxError = m_syntaxError || m_command.empty();
+    if (_isBackgroundComamnd(m_cmd_line.c_str())) {
+        m_command += "&";
+    }
+}
+
+void RunCommand::execute() {
+    if (m_syntaxError) {
+        std::cerr << "smash error: run: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+    SmallShell& smash = SmallShell::getInstance();
+    std::shared_ptr<LaunchOptions> outer = smash.getLaunch();
+    auto launch = std::make_shared<LaunchOptions>(m_options);
+    if (m_cgroup) {
+        launch->cgroup = Cgroup::create(m_limits);
+        if (launch->cgroup == nullptr) {
+            m_exitStatus = 1;
+            return;
+        }
+    }
+    // A run inside another one keeps the options it does not set
+    if (outer != nullptr) {
+        launch->inherit(*outer);
+    }
+    smash.setLaunch(std::move(launch));
+    smash.executeCommand(m_command.c_str());
+    smash.setLaunch(outer);
+    m_exitStatus = smash.getLastExitStatus();
+}
+
+// history command
+HistoryCommand::HistoryCommand(const char *cmd_line, History *history) : BuiltInCommand(cmd_line, true),
+        m_history(history) {}
+
+void HistoryCommand::execute() {
+    if (m_num_args == 1) {
+        m_history->print(*m_out, 0);
+        return;
+    }
+    if (m_num_args == 2 && isStringRepValidNum(m_cmd_args[1]) && atoi(m_cmd_args[1]) > 0) {
+        m_history->print(*m_out, atoi(m_cmd_args[1]));
+        return;
+    }
+    std::string pattern = _argumentsText(m_cmd_line, 2);
+    if (strcmp(m_cmd_args[1], "-s") != 0 || pattern.empty()) {
+        std::cerr << "smash error: history: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+    if (pattern.size() >= 2 && (pattern[0] == '"' || pattern[0] == '\'') && pattern.back() == pattern[0]) {
+        pattern = pattern.substr(1, pattern.size() - 2);
+    }
+    m_history->search(*m_out, pattern);
+}
+
+bool HistoryCommand::canRunInPipeline() const {
+    return true;
+}
+
+// every command
+EveryCommand::EveryCommand(const char *cmd_line, Scheduler *scheduler) : BuiltInCommand(cmd_line, false),
+        m_scheduler(scheduler) {}
+
+void EveryCommand::execute() {
+    // The command is kept as text, expanded anew by every run
+    std::istringstream words(_argumentsText(m_cmd_line, 1));
+    std::string option;
+    words >> option;
+    if (option == "-l" || option.empty()) {
+        m_scheduler->list(*m_out);
+        return;
+    }
+    if (option == "-d") {
+        std::string id;
+        if (!(words >> id) || !isStringRepValidNum(id.c_str()) || !m_scheduler->remove(atoi(id.c_str()))) {
+            std::cerr << "smash error: every: invalid arguments" << std::endl;
+            m_exitStatus = 1;
+        }
         return;
     }
 
-    auto& allAlias = SmallShell::getAliases();
-    for(int i = 1; i < m_num_args; i++) {
-        std::string alias_to_delete = m_cmd_args[i];
-        bool isFound = false;
+    int skipped = 2;
+    Scheduler::OverlapPolicy policy = Scheduler::SKIP;
+    std::string interval = option;
+    if (option == "-q") {
+        policy = Scheduler::QUEUE;
+        words >> interval;
+        ++skipped;
+    }
+    double seconds = parseDuration(interval);
+    std::string command = _argumentsText(m_cmd_line, skipped);
+    int64_t interval_ms = static_cast<int64_t>(seconds * 1000);
+    if (seconds < 0 || interval_ms < Scheduler::TICK_MS || command.empty()) {
+        std::cerr << "smash error: every: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+    if (m_scheduler->add(interval_ms, command, policy) == -1) {
+        m_exitStatus = 1;
+    }
+}
 
-        for (auto it = allAlias.begin(); it != allAlias.end(); ++it) {
-            if (it->first == alias_to_delete) {
-                allAlias.erase(it);
-                isFound = true;
+bool EveryCommand::canRunInPipeline() const {
+    // Only listing the scheduled commands, adding or removing one inside a pipeline has no effect
+    // on the shell
+    std::istringstream words(_argumentsText(m_cmd_line, 1));
+    std::string option;
+    words >> option;
+    return option.empty() || option == "-l";
+}
+
+// watchrun command
+static const int DEFAULT_DEBOUNCE_MS = 100;
+// A burst that never pauses still runs the command after this many debounce periods
+static const int MAX_DEBOUNCE_PERIODS = 10;
+static const int CANCEL_GRACE_MS = 1000;
+// How often the directories past the inotify watch limit are polled
+static const int POLL_INTERVAL_MS = 1000;
+// How often a run is checked for its exit without pidfd support
+static const int EXIT_CHECK_INTERVAL_MS = 10;
+
+// True once the process exited, leaving it to be reaped
+static bool hasExited(pid_t pid) {
+    siginfo_t info;
+    info.si_pid = 0;
+    return waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid;
+}
+
+// Waits up to timeout_ms for the process to exit, on its pidfd when there is one
+static bool waitExit(pid_t pid, int pid_fd, int timeout_ms) {
+    if (pid_fd != -1) {
+        struct pollfd exited = {pid_fd, POLLIN, 0};
+        return poll(&exited, 1, timeout_ms) == 1;
+    }
+    for (int waited_ms = 0; !hasExited(pid); waited_ms += EXIT_CHECK_INTERVAL_MS) {
+        if (waited_ms >= timeout_ms) {
+            return false;
+        }
+        poll(nullptr, 0, EXIT_CHECK_INTERVAL_MS);
+    }
+    return true;
+}
+
+static double monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+// "12.3 ms", without touching the format flags of the output stream
+static std::string formatMs(double ms) {
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1) << ms << " ms";
+    return text.str();
+}
+
+WatchRunCommand::WatchRunCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line, false),
+        m_jobsList(jobs) {}
+
+/*
+ * One poll() loop over the inotify descriptor, a timerfd for the debounce period and the pidfd of
+ * the run in flight. The runs are ordinary background jobs, so they show in jobs meanwhile.
+ */
+void WatchRunCommand::execute() {
+    // The command is kept as text, expanded anew by every run
+    std::istringstream words(_argumentsText(m_cmd_line, 1));
+    std::string word;
+    bool recursive = false;
+    bool queue = false;
+    int debounce_ms = DEFAULT_DEBOUNCE_MS;
+    bool valid = true;
+    std::vector<std::string> paths;
+    int skipped = 1;
+    bool separated = false;
+    while (!separated && words >> word) {
+        ++skipped;
+        if (word == "--") {
+            separated = true;
+        } else if (paths.empty() && word == "-r") {
+            recursive = true;
+        } else if (paths.empty() && word == "-q") {
+            queue = true;
+        } else if (paths.empty() && word == "--debounce") {
+            ++skipped;
+            valid = (words >> word) && isStringRepValidNum(word.c_str()) && atoi(word.c_str()) >= 0;
+            debounce_ms = valid ? atoi(word.c_str()) : 0;
+        } else {
+            paths.push_back(word);
+        }
+    }
+    std::string command = _argumentsText(m_cmd_line, skipped);
+    if (!valid || !separated || paths.empty() || command.empty()) {
+        std::cerr << "smash error: watchrun: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    FileWatcher watcher(recursive);
+    for (const std::string& path : paths) {
+        if (!watcher.add(path)) {
+            std::cerr << "smash error: watchrun: cannot watch " << path << std::endl;
+            m_exitStatus = 1;
+            return;
+        }
+    }
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer_fd == -1) {
+        perror("smash error: timerfd_create failed");
+        m_exitStatus = 1;
+        return;
+    }
+
+    SmallShell& smash = SmallShell::getInstance();
+    pid_t running = -1;
+    int pid_fd = -1;
+    bool pending = false;           // A burst is over, its run waits for the last one (-q)
+    size_t burst_events = 0;
+    double burst_start = 0;
+    std::string burst_path;
+    int runs = 0;
+    int cancelled = 0;
+    double total_latency = 0;
+    double max_latency = 0;
+    double next_poll = monotonicMs() + POLL_INTERVAL_MS;
+
+    auto note_change = [&](const std::string& path, size_t events) {
+        double now = monotonicMs();
+        if (burst_events == 0) {
+            burst_start = now;
+            burst_path = path;
+        }
+        burst_events += events;
+        if (!pending) {
+            double deadline = std::min(now + debounce_ms, burst_start + MAX_DEBOUNCE_PERIODS * debounce_ms);
+            armTimer(timer_fd, std::max(0.0, deadline - now) / 1000);
+        }
+    };
+    auto reap = [&]() {
+        int status = 0;
+        waitpid(running, &status, 0);
+        m_jobsList->removeFinishedJobs();
+        if (pid_fd != -1) {
+            close(pid_fd);
+        }
+        smash_fg_pid = 0;
+        running = -1;
+        pid_fd = -1;
+        return status;
+    };
+    auto start = [&]() {
+        watcher.rewatch();
+        running = smash.startJob(command);
+        pending = false;
+        if (running == -1) {
+            burst_events = 0;
+            return;
+        }
+        pid_fd = syscall(SYS_pidfd_open, running, 0);
+        smash_fg_pid = running;
+        double latency = monotonicMs() - burst_start;
+        ++runs;
+        total_latency += latency;
+        max_latency = std::max(max_latency, latency);
+        *m_out << "smash: watchrun: " << burst_path << " changed (" << burst_events << " events), run " << runs
+               << " started after " << formatMs(latency) << std::endl;
+        burst_events = 0;
+    };
+
+    while (!smash_interrupted) {
+        struct pollfd fds[] = {{watcher.fd(), POLLIN, 0}, {timer_fd, POLLIN, 0}, {pid_fd, POLLIN, 0}};
+        int timeout = -1;
+        if (watcher.unwatchedCount() > 0) {
+            timeout = std::max(0, static_cast<int>(next_poll - monotonicMs()));
+        }
+        if (running != -1 && pid_fd == -1 && (timeout == -1 || timeout > EXIT_CHECK_INTERVAL_MS)) {
+            timeout = EXIT_CHECK_INTERVAL_MS;
+        }
+        if (poll(fds, 3, timeout) == -1) {
+            if (errno != EINTR) {
+                perror("smash error: poll failed");
                 break;
             }
+            continue;
         }
-        if(!isFound) {
-            std::cerr << "smash error: unalias: " << alias_to_delete << " alias does not exist" << std::endl;
-            return;
+        std::string path;
+        size_t events = watcher.readEvents(path);
+        if (events > 0) {
+            note_change(path, events);
+        }
+        if (watcher.unwatchedCount() > 0 && monotonicMs() >= next_poll) {
+            next_poll = monotonicMs() + POLL_INTERVAL_MS;
+            if (watcher.pollUnwatched(path)) {
+                note_change(path, 1);
+            }
+        }
+
+        if ((fds[2].revents & POLLIN) || (running != -1 && pid_fd == -1 && hasExited(running))) {
+            int status = reap();
+            *m_out << "smash: watchrun: run " << runs << " exited with status " << exitStatusOf(status)
+                   << std::endl;
+            if (pending) {
+                start();
+            }
+        }
+        uint64_t expirations;
+        if ((fds[1].revents & POLLIN) && read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+            if (running == -1) {
+                start();
+            } else if (queue) {
+                pending = true;
+            } else {
+                kill(-running, SIGTERM);
+                kill(-running, SIGCONT);
+                if (!waitExit(running, pid_fd, CANCEL_GRACE_MS)) {
+                    kill(-running, SIGKILL);
+                }
+                reap();
+                ++cancelled;
+                *m_out << "smash: watchrun: run " << runs << " cancelled" << std::endl;
+                start();
+            }
         }
     }
 
+    if (running != -1) {
+        kill(-running, SIGKILL);
+        reap();
+    }
+    close(timer_fd);
+    *m_out << "smash: watchrun: " << runs << " runs, " << cancelled << " cancelled, change to start avg "
+           << formatMs(runs == 0 ? 0 : total_latency / runs) << " max " << formatMs(max_latency) << '\n';
 }
 
 // unsetenv command
@@ -692,6 +2645,7 @@ UnSetEnvCommand::UnSetEnvCommand(const char *cmd_line) : BuiltInCommand(cmd_line
 void UnSetEnvCommand::execute() {
     if(m_num_args <= 1) {
         std::cerr << "smash error: unsetenv: not enough arguments" << std::endl;
+        m_exitStatus = 1;
         return;
     }
     pid_t smash_pid = getpid();
@@ -700,6 +2654,7 @@ void UnSetEnvCommand::execute() {
 
     if (env_file == -1) {
         perror("smash error: open failed");
+        m_exitStatus = 1;
         return;
     }
 
@@ -714,236 +2669,923 @@ void UnSetEnvCommand::execute() {
         if(bytes == -1) {
             perror("smash error: read failed");
             close(env_file);
+            m_exitStatus = 1;
+            return;
+        }
+
+        int curr_pos = 0;
+        while(curr_pos < bytes) {
+            // This will read until encounter null terminator
+            std::string entry(buffer + curr_pos);
+
+            if (entry.find(var_name + "=") == 0) {
+                found_in_file = true;
+                break;
+            }
+
+            curr_pos += entry.size() + 1;
+        }
+
+        if(!found_in_file) {
+            std::cerr << "smash error: unsetenv: " << var_name << " does not exist" << std::endl;
+            close(env_file);
+            m_exitStatus = 1;
+            return;
+        }
+
+        // Removing from char **__environ array:
+        for(int j = 0; environ[j] != NULL; j++) {
+            std::string key_prefix = var_name + "=";
+            if (strncmp(environ[j], key_prefix.c_str(), key_prefix.length()) == 0) {
+                // Shifting the array
+                for(int k = j; environ[k] != NULL; k++) {
+                    environ[k] = environ[k + 1];
+                }
+                break; // variable is found and removed
+            }
+        }
+    }
+
+    close(env_file);
+}
+
+// sysinfo command
+
+SysInfoCommand::SysInfoCommand(const char *cmd_line) : BuiltInCommand(cmd_line, false) {}
+
+void SysInfoCommand::execute() {
+    struct utsname uts;
+    if(uname(&uts) == -1) {
+        perror("smash error: uname failed");
+        m_exitStatus = 1;
+        return;
+    }
+
+    struct sysinfo info;
+    if(sysinfo(&info) == -1) {
+        perror("smash error: sysinfo failed");
+        m_exitStatus = 1;
+        return;
+    }
+
+    time_t boot_time = time(NULL) - info.uptime;
+    struct tm *tm_info = localtime(&boot_time);
+
+    /*
+     * "%Y-%m-%d %H:%M:%S" Format needs at most:
+     * 4 bytes for Year (4 digits e.g, 2025)
+     * 2 bytes for Month (2 digits : 0-12)
+     * 2 bytes for Days (2 digits : 0-31)
+     * 2 bytes for Hours (2 digits : 0-23)
+     * 2 bytes for Minutes (2 digits : 0-59)
+     * 2 bytes for Seconds (2 digits : 0-59)
+     * 1 byte for each char: '-' twice, ' ' once, ':' twice
+     * 1 byte for null terminator
+     * Overall it needs 20 bytes - Use 24 for more safety.
+    */
+    char buffer_time[24];
+    strftime(buffer_time, sizeof(buffer_time), "%Y-%m-%d %H:%M:%S", tm_info);
+
+    *m_out << "System: " << uts.sysname << '\n';
+    *m_out << "Hostname: " << uts.nodename << '\n';
+    *m_out << "Kernel: " << uts.release << '\n';
+    *m_out << "Architecture: " << uts.machine << '\n';
+    *m_out << "Boot Time: " << buffer_time << '\n';
+}
+
+bool SysInfoCommand::canRunInPipeline() const {
+    return true;
+}
+
+
+// cat command
+CatCommand::CatCommand(const char *cmd_line) : BuiltInCommand(cmd_line, true) {}
+
+void CatCommand::execute() {
+    // Only plain operands are copied here, options are left to the real cat
+    for (int i = 1; i < m_num_args; i++) {
+        if (m_cmd_args[i][0] == '-' && m_cmd_args[i][1] != '\0') {
+            executeExternal();
+            return;
+        }
+    }
+    int out_fd = outputFd();
+    if (m_num_args == 1) {
+        if (!copyFd(m_inFd, out_fd) && errno != EPIPE) {
+            perror("smash error: cat failed");
+            m_exitStatus = 1;
+        }
+        return;
+    }
+
+    for (int i = 1; i < m_num_args; i++) {
+        bool is_stdin = (strcmp(m_cmd_args[i], "-") == 0);
+        int file = is_stdin ? m_inFd : open(m_cmd_args[i], O_RDONLY | O_CLOEXEC);
+        if (file == -1) {
+            perror("smash error: open failed");
+            m_exitStatus = 1;
+            continue;
+        }
+        bool copied = copyFd(file, out_fd);
+        int copy_errno = errno;
+        if (!is_stdin) {
+            close(file);
+        }
+        if (!copied) {
+            if (copy_errno == EPIPE) {
+                // The reader went away, nothing more to do
+                m_exitStatus = 1;
+                return;
+            }
+            errno = copy_errno;
+            perror("smash error: cat failed");
+            m_exitStatus = 1;
+        }
+    }
+}
+
+bool CatCommand::canRunInPipeline() const {
+    return true;
+}
+
+// tee command
+TeeCommand::TeeCommand(const char *cmd_line) : BuiltInCommand(cmd_line, true) {}
+
+void TeeCommand::execute() {
+    // Only a leading -a is handled here, other options are left to the real tee
+    bool append = (m_num_args > 1 && strcmp(m_cmd_args[1], "-a") == 0);
+    for (int i = append ? 2 : 1; i < m_num_args; i++) {
+        if (m_cmd_args[i][0] == '-') {
+            executeExternal();
+            return;
+        }
+    }
+    std::vector<int> out_fds(1, outputFd());
+
+    for (int i = append ? 2 : 1; i < m_num_args; i++) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+        int file = open(m_cmd_args[i], flags, 0666);
+        if (file == -1) {
+            perror("smash error: open failed");
+            m_exitStatus = 1;
+            continue;
+        }
+        out_fds.push_back(file);
+    }
+
+    if (!teeFd(m_inFd, out_fds) && errno != EPIPE) {
+        perror("smash error: tee failed");
+        m_exitStatus = 1;
+    }
+
+    for (size_t i = 1; i < out_fds.size(); i++) {
+        close(out_fds[i]);
+    }
+}
+
+bool TeeCommand::canRunInPipeline() const {
+    return true;
+}
+
+
+/*
+ * parallel command
+ * parallel [-j N] [-k] [-u] <template> [::: <args>...]
+ * Runs the template once per argument (or per line of the input when no ::: is given), "{}" in the
+ * template is replaced by the argument, otherwise it is appended. At most N tasks run at a time.
+ * -k prints the output of the tasks in the order of the arguments instead of as they finish,
+ * -u lets the tasks write straight to the terminal instead of grouping the output per task.
+ * The command line is split here rather than by _parseCommandLine so there is no limit on the
+ * number of arguments.
+ */
+ParallelCommand::ParallelCommand(const char *cmd_line) : BuiltInCommand(cmd_line, false) {
+    std::istringstream words(m_cmd_line.c_str());
+    std::string word;
+    words >> word; // "parallel"
+
+    bool in_template = false;
+    while (words >> word) {
+        if (!in_template && word == "-j") {
+            if (!(words >> word) || !isStringRepValidNum(word.c_str())) {
+                m_syntaxError = true;
+                return;
+            }
+            m_maxJobs = std::stoi(word);
+        } else if (!in_template && word == "-k") {
+            m_keepOrder = true;
+        } else if (!in_template && word == "-u") {
+            m_grouped = false;
+        } else if (word == ":::") {
+            m_readInputs = false;
+            while (words >> word) {
+                m_inputs.push_back(word);
+            }
+        } else {
+            in_template = true;
+            m_template += m_template.empty() ? word : " " + word;
+        }
+    }
+    m_syntaxError = m_template.empty();
+}
+
+std::string ParallelCommand::buildCommandLine(const std::string& input) const {
+    size_t placeholder = m_template.find("{}");
+    if (placeholder == std::string::npos) {
+        return m_template + " " + input;
+    }
+    std::string result;
+    size_t pos = 0;
+    while (placeholder != std::string::npos) {
+        result.append(m_template, pos, placeholder - pos);
+        result += input;
+        pos = placeholder + 2;
+        placeholder = m_template.find("{}", pos);
+    }
+    result.append(m_template, pos, std::string::npos);
+    return result;
+}
+
+// Forks a child shell running the task, its output goes to per-task memfds when grouped
+bool ParallelCommand::startTask(Task& task) {
+    task.stdoutFd = task.stderrFd = -1;
+    if (m_grouped) {
+        task.stdoutFd = memfd_create("smash-parallel-stdout", MFD_CLOEXEC);
+        task.stderrFd = memfd_create("smash-parallel-stderr", MFD_CLOEXEC);
+        if (task.stdoutFd == -1 || task.stderrFd == -1) {
+            perror("smash error: memfd_create failed");
+            return false;
+        }
+    }
+
+    std::cout.flush();
+    task.pid = fork();
+    if (task.pid == -1) {
+        perror("smash error: fork failed");
+        return false;
+    }
+    if (task.pid == 0) {
+        setpgrp();
+        if (m_grouped) {
+            dup2(task.stdoutFd, STDOUT_FILENO);
+            dup2(task.stderrFd, STDERR_FILENO);
+        } else if (m_outFd != STDOUT_FILENO) {
+            dup2(m_outFd, STDOUT_FILENO);
+        }
+        SmallShell& smash = SmallShell::getInstance();
+        smash.executeCommand(task.cmdLine.c_str());
+        exit(smash.getLastExitStatus());
+    }
+
+    // Without pidfd support the scheduler falls back to waiting for the oldest task
+    task.pidfd = syscall(SYS_pidfd_open, task.pid, 0);
+    return true;
+}
+
+void ParallelCommand::finishTask(Task& task, int wait_status) {
+    task.exitStatus = exitStatusOf(wait_status);
+    if (task.pidfd != -1) {
+        close(task.pidfd);
+        task.pidfd = -1;
+    }
+}
+
+void ParallelCommand::printTaskOutput(Task& task) {
+    if (task.stdoutFd != -1) {
+        lseek(task.stdoutFd, 0, SEEK_SET);
+        copyFd(task.stdoutFd, m_outFd);
+        close(task.stdoutFd);
+    }
+    if (task.stderrFd != -1) {
+        lseek(task.stderrFd, 0, SEEK_SET);
+        copyFd(task.stderrFd, STDERR_FILENO);
+        close(task.stderrFd);
+    }
+    if (task.exitStatus != 0) {
+        std::cerr << "smash: parallel: " << task.cmdLine << ": exited with status " << task.exitStatus << std::endl;
+    }
+}
+
+void ParallelCommand::execute() {
+    if (m_syntaxError) {
+        std::cerr << "smash error: parallel: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    LineReader* input_reader = m_readInputs ? new LineReader(m_inFd) : nullptr;
+    size_t next_input = 0;
+    size_t next_to_print = 0;
+    int failed = 0;
+    bool interrupted = false;
+
+    std::vector<Task> running;
+    std::map<size_t, Task> finished; // Only used with -k, waiting for earlier tasks
+    outputFd();
+    std::cout.flush();
+
+    auto complete = [&](Task& task) {
+        failed += (task.exitStatus != 0);
+        if (!m_keepOrder) {
+            printTaskOutput(task);
             return;
         }
+        finished.emplace(task.index, std::move(task));
+        for (auto it = finished.find(next_to_print); it != finished.end(); it = finished.find(next_to_print)) {
+            printTaskOutput(it->second);
+            finished.erase(it);
+            next_to_print++;
+        }
+    };
+
+    while (true) {
+        // Fill the free slots
+        while (!interrupted && static_cast<int>(running.size()) < m_maxJobs) {
+            std::string input;
+            if (input_reader != nullptr) {
+                const char* line = input_reader->nextLine();
+                if (line == nullptr) {
+                    break;
+                }
+                input = line;
+            } else if (next_input < m_inputs.size()) {
+                input = m_inputs[next_input];
+            } else {
+                break;
+            }
+
+            Task task;
+            task.index = next_input++;
+            task.pidfd = -1;
+            task.exitStatus = 0;
+            task.cmdLine = buildCommandLine(input);
+            if (task.cmdLine.size() > COMMAND_MAX_LENGTH) {
+                std::cerr << "smash error: parallel: command too long: " << task.cmdLine << std::endl;
+                task.stdoutFd = task.stderrFd = -1;
+                task.exitStatus = 1;
+                complete(task);
+                continue;
+            }
+            if (!startTask(task)) {
+                interrupted = true;
+                break;
+            }
+            running.push_back(std::move(task));
+        }
+        if (running.empty()) {
+            break;
+        }
+
+        // Wait for at least one task to exit
+        std::vector<struct pollfd> pollfds;
+        bool use_poll = std::all_of(running.begin(), running.end(), [](const Task& task) {
+            return task.pidfd != -1;
+        });
+        if (use_poll) {
+            for (const auto& task : running) {
+                pollfds.push_back({task.pidfd, POLLIN, 0});
+            }
+            if (poll(pollfds.data(), pollfds.size(), -1) == -1 && errno == EINTR && !interrupted) {
+                // ctrl-C: stop scheduling and kill what is still running
+                interrupted = true;
+                for (const auto& task : running) {
+                    kill(task.pid, SIGKILL);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < running.size(); ) {
+            if (use_poll && !(pollfds[i].revents & POLLIN) && !interrupted) {
+                ++i;
+                continue;
+            }
+            int status;
+            // Blocks only in fallback mode (oldest task first) or after the tasks were killed
+            if (waitpid(running[i].pid, &status, 0) == -1) {
+                status = 1 << 8;
+            }
+            Task task = std::move(running[i]);
+            running.erase(running.begin() + i);
+            finishTask(task, status);
+            complete(task);
+            if (!use_poll) {
+                break;
+            }
+            pollfds.erase(pollfds.begin() + i);
+        }
+    }
+
+    // Tasks that never started (ctrl-C) leave gaps with -k, print whatever is left in order
+    for (auto& entry : finished) {
+        printTaskOutput(entry.second);
+    }
+    delete input_reader;
+    m_exitStatus = std::min(failed, 101);
+}
+
+
+// applets
+AppletCommand::AppletCommand(const char *cmd_line, const Applet *applet) : BuiltInCommand(cmd_line, true),
+        m_applet(applet) {}
+
+void AppletCommand::execute() {
+    int status = m_applet->main(m_num_args, m_cmd_args, m_inFd, *m_out);
+    if (status == APPLET_FALLBACK) {
+        executeExternal();
+        return;
+    }
+    m_exitStatus = status;
+}
 
-        int curr_pos = 0;
-        while(curr_pos < bytes) {
-            // This will read until encounter null terminator
-            std::string entry(buffer + curr_pos);
+bool AppletCommand::canRunInPipeline() const {
+    return true;
+}
 
-            if (entry.find(var_name + "=") == 0) {
-                found_in_file = true;
-                break;
-            }
+// applet command
+AppletsCommand::AppletsCommand(const char *cmd_line) : BuiltInCommand(cmd_line, true) {}
 
-            curr_pos += entry.size() + 1;
+void AppletsCommand::execute() {
+    if (m_num_args == 1) {
+        printApplets(*m_out);
+        return;
+    }
+    if (m_num_args < 3 || (strcmp(m_cmd_args[1], "-d") != 0 && strcmp(m_cmd_args[1], "-e") != 0)) {
+        std::cerr << "smash error: applet: invalid arguments" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+    bool enable = (strcmp(m_cmd_args[1], "-e") == 0);
+    for (int i = 2; i < m_num_args; i++) {
+        if (!setAppletEnabled(m_cmd_args[i], enable)) {
+            std::cerr << "smash error: applet: " << m_cmd_args[i] << " does not exist" << std::endl;
+            m_exitStatus = 1;
         }
+    }
+}
 
-        if(!found_in_file) {
-            std::cerr << "smash error: unsetenv: " << var_name << " does not exist" << std::endl;
-            close(env_file);
-            return;
-        }
 
-        // Removing from char **__environ array:
-        for(int j = 0; environ[j] != NULL; j++) {
-            std::string key_prefix = var_name + "=";
-            if (strncmp(environ[j], key_prefix.c_str(), key_prefix.length()) == 0) {
-                // Shifting the array
-                for(int k = j; environ[k] != NULL; k++) {
-                    environ[k] = environ[k + 1];
-                }
-                break; // variable is found and removed
-            }
+// joblog command
+JobLogCommand::JobLogCommand(const char *cmd_line, JobLogs *logs) : BuiltInCommand(cmd_line, true), m_jobLogs(logs) {
+    for (int i = 1; i < m_num_args; i++) {
+        if (strcmp(m_cmd_args[i], "--follow") == 0) {
+            m_follow = true;
         }
     }
-
-    close(env_file);
 }
 
-// sysinfo command
-
-SysInfoCommand::SysInfoCommand(const char *cmd_line) : BuiltInCommand(cmd_line, false) {}
+void JobLogCommand::execute() {
+    if (m_num_args == 1) {
+        m_jobLogs->printSummaries(*m_out);
+        return;
+    }
+    if (m_num_args == 2 && strcmp(m_cmd_args[1], "--capture") == 0) {
+        m_jobLogs->setCapturing(true);
+        return;
+    }
+    if (m_num_args == 2 && strcmp(m_cmd_args[1], "--no-capture") == 0) {
+        m_jobLogs->setCapturing(false);
+        return;
+    }
+    if (m_num_args == 2 && m_follow) {
+        m_jobLogs->follow(nullptr, *m_out);
+        return;
+    }
 
-void SysInfoCommand::execute() {
-    struct utsname uts;
-    if(uname(&uts) == -1) {
-        perror("smash error: uname failed");
+    bool valid = isStringRepValidNum(m_cmd_args[1]) &&
+                 (m_num_args == 2 || (m_num_args == 3 && strcmp(m_cmd_args[2], "--follow") == 0));
+    if (!valid) {
+        std::cerr << "smash error: joblog: invalid arguments" << std::endl;
+        m_exitStatus = 1;
         return;
     }
 
-    struct sysinfo info;
-    if(sysinfo(&info) == -1) {
-        perror("smash error: sysinfo failed");
-        return ;
+    int job_id = std::stoi(m_cmd_args[1]);
+    JobLog* log = m_jobLogs->find(job_id);
+    if (log == nullptr) {
+        std::cerr << "smash error: joblog: job-id " << job_id << " does not exist" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+    log->writeTo(*m_out);
+    if (m_follow) {
+        m_jobLogs->follow(log, *m_out);
     }
+}
 
-    time_t boot_time = time(NULL) - info.uptime;
-    struct tm *tm_info = localtime(&boot_time);
+bool JobLogCommand::canRunInPipeline() const {
+    // The logs live in the shell, a forked stage would drain them into its own copy. Turning the
+    // capture on or off inside a pipeline has no effect on the shell.
+    return !(m_num_args == 2 && (strcmp(m_cmd_args[1], "--capture") == 0 ||
+                                 strcmp(m_cmd_args[1], "--no-capture") == 0));
+}
 
-    /*
-     * "%Y-%m-%d %H:%M:%S" Format needs at most:
-     * 4 bytes for Year (4 digits e.g, 2025)
-     * 2 bytes for Month (2 digits : 0-12)
-     * 2 bytes for Days (2 digits : 0-31)
-     * 2 bytes for Hours (2 digits : 0-23)
-     * 2 bytes for Minutes (2 digits : 0-59)
-     * 2 bytes for Seconds (2 digits : 0-59)
-     * 1 byte for each char: '-' twice, ' ' once, ':' twice
-     * 1 byte for null terminator
-     * Overall it needs 20 bytes - Use 24 for more safety.
-    */
-    char buffer_time[24];
-    strftime(buffer_time, sizeof(buffer_time), "%Y-%m-%d %H:%M:%S", tm_info);
+bool JobLogCommand::canExpandAgain() const {
+    // --follow is looked for once, by the constructor
+    return false;
+}
+
+
+// function call
+int FunctionCommand::s_depth = 0;
+
+FunctionCommand::FunctionCommand(const char *cmd_line, const std::string& name) : BuiltInCommand(cmd_line, true),
+        m_name(name.c_str()) {}
 
-    std::cout << "System: " << uts.sysname << std::endl;
-    std::cout << "Hostname: " << uts.nodename << std::endl;
-    std::cout << "Kernel: " << uts.release << std::endl;
-    std::cout << "Architecture: " << uts.machine << std::endl;
-    std::cout << "Boot Time: " << buffer_time << std::endl;
+void FunctionCommand::execute() {
+    SmallShell& smash = SmallShell::getInstance();
+    std::shared_ptr<Script> body = smash.findFunction(m_name.c_str());
+    if (body == nullptr) {
+        return;
+    }
+    if (s_depth == MAX_DEPTH) {
+        std::cerr << "smash error: " << m_name << ": maximum function nesting level exceeded" << std::endl;
+        m_exitStatus = 1;
+        return;
+    }
+
+    int out_fd = outputFd();
+    std::cout.flush();
+    int saved_out = (out_fd != STDOUT_FILENO) ? dup(STDOUT_FILENO) : -1;
+    int saved_in = (m_inFd != STDIN_FILENO) ? dup(STDIN_FILENO) : -1;
+    if (saved_out != -1) {
+        dup2(out_fd, STDOUT_FILENO);
+    }
+    if (saved_in != -1) {
+        dup2(m_inFd, STDIN_FILENO);
+    }
+
+    ++s_depth;
+    smash.pushPositionalParameters(std::vector<std::string>(m_cmd_args, m_cmd_args + m_num_args));
+    body->run(smash);
+    smash.popPositionalParameters();
+    --s_depth;
+    m_exitStatus = smash.getLastExitStatus();
+
+    std::cout.flush();
+    if (saved_out != -1) {
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_out);
+    }
+    if (saved_in != -1) {
+        dup2(saved_in, STDIN_FILENO);
+        close(saved_in);
+    }
 }
 
 
 // Special commands
 
 // IO redirection command
+RedirectionCommand::Redirection::Redirection(int redirected_fd, Type redirection_type, ArenaString redirection_target) :
+        fd(redirected_fd), type(redirection_type), target(std::move(redirection_target)) {}
+
+/*
+ * Supported forms (N is an optional file descriptor number written right before the operator):
+ * N<file, N>file, N>>file, N>&M, N<&M, &>file, &>>file and <<<word.
+ * Here-documents (<<DELIM) were already turned into <&fd by SmallShell::collectHereDocuments.
+ */
 RedirectionCommand::RedirectionCommand(const char *cmd_line) : Command(cmd_line, false)
 {
-    size_t temp1 = m_cmd_line.find(">>");
-    size_t temp2 = m_cmd_line.find('>');
-    size_t redirection_pos = (temp1 != std::string::npos) ? temp1 : temp2;
-    m_redirection_char = (temp1 != std::string::npos) ? ">>" : ">";
+    const char* line = m_cmd_line.c_str();
+    size_t len = m_cmd_line.size();
+    size_t pos = 0;
+
+    while (pos < len) {
+        size_t substitution_end = SmallShell::substitutionEnd(line, pos, len);
+        if (substitution_end != pos && substitution_end != std::string::npos) {
+            m_command_line.append(line + pos, substitution_end - pos);
+            pos = substitution_end;
+            continue;
+        }
+        char c = line[pos];
+        bool is_both = (c == '&' && pos + 1 < len && line[pos + 1] == '>');
+        if (c != '<' && c != '>' && !is_both) {
+            m_command_line += c;
+            ++pos;
+            continue;
+        }
 
-    m_command_line = m_cmd_line.substr(0, redirection_pos);
-    m_output_file = m_cmd_line.substr(redirection_pos + m_redirection_char.size());
-    m_output_file = _trim(m_output_file);
+        // An fd number is only taken when it is a separate word, e.g. "2>" but not "file2>"
+        int fd = -1;
+        size_t digits = m_command_line.size();
+        while (digits > 0 && isdigit(m_command_line[digits - 1])) {
+            --digits;
+        }
+        if (!is_both && digits < m_command_line.size() &&
+            (digits == 0 || WHITESPACE.find(m_command_line[digits - 1]) != std::string::npos)) {
+            fd = atoi(m_command_line.c_str() + digits);
+            m_command_line.erase(digits);
+        }
+
+        Redirection::Type type;
+        if (is_both) {
+            pos += 2;
+            type = Redirection::WRITE;
+            if (pos < len && line[pos] == '>') {
+                type = Redirection::APPEND;
+                ++pos;
+            }
+        } else if (m_cmd_line.compare(pos, 3, "<<<") == 0) {
+            type = Redirection::HERE_STRING;
+            pos += 3;
+        } else if (m_cmd_line.compare(pos, 2, "<&") == 0 || m_cmd_line.compare(pos, 2, ">&") == 0) {
+            type = Redirection::DUPLICATE;
+            pos += 2;
+        } else if (m_cmd_line.compare(pos, 2, ">>") == 0) {
+            type = Redirection::APPEND;
+            pos += 2;
+        } else {
+            type = (c == '<') ? Redirection::READ : Redirection::WRITE;
+            ++pos;
+        }
+        if (fd == -1) {
+            fd = (c == '<') ? 0 : 1;
+        }
+
+        // The target word, a quoted here-string may contain spaces
+        pos = std::min(len, m_cmd_line.find_first_not_of(WHITESPACE.c_str(), pos));
+        size_t target_end;
+        ArenaString target;
+        if (type == Redirection::HERE_STRING && pos < len && (line[pos] == '\'' || line[pos] == '"')) {
+            target_end = m_cmd_line.find(line[pos], pos + 1);
+            target_end = (target_end == std::string::npos) ? len : target_end;
+            target = m_cmd_line.substr(pos + 1, target_end - pos - 1);
+            target_end = std::min(len, target_end + 1);
+        } else {
+            target_end = std::min(len, m_cmd_line.find_first_of(" \t\n<>&", pos));
+            target = m_cmd_line.substr(pos, target_end - pos);
+        }
+        if (line[pos] != '\'' && target.find('$') != ArenaString::npos) {
+            ArenaString expanded;
+            char quote = (line[pos] == '"') ? '"' : '\0';
+            SmallShell::getInstance().expandParameters(target.data(), target.size(), expanded, quote);
+            target = std::move(expanded);
+        }
+        pos = target_end;
+
+        if (target.empty() && type != Redirection::HERE_STRING) {
+            m_syntax_error = true;
+        }
+        m_redirections.emplace_back(fd, type, std::move(target));
+        if (is_both) {
+            m_redirections.emplace_back(2, Redirection::DUPLICATE, "1");
+        }
+    }
 
-    strcpy(m_removed_background_cmd_line, m_command_line.c_str());
-    _removeBackgroundSign(m_removed_background_cmd_line);
+    m_removed_background_cmd_line = _removedBackgroundSign<ArenaString>(m_command_line.c_str());
 
 }
 
-void RedirectionCommand::execute() {
-    int stdout_backup = dup(1);
-    if (stdout_backup == -1) {
-        perror("smash error: dup failed");
-        return;
+// Opens the redirection targets (close-on-exec) in the order they were written.
+bool RedirectionCommand::openRedirections(FdRedirections& fds, std::vector<int>& opened_fds) {
+    for (const auto& redirection : m_redirections) {
+        int source = -1;
+        switch (redirection.type) {
+            case Redirection::READ:
+                source = open(redirection.target.c_str(), O_RDONLY | O_CLOEXEC);
+                break;
+            case Redirection::WRITE:
+                source = open(redirection.target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+                break;
+            case Redirection::APPEND:
+                source = open(redirection.target.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+                break;
+            case Redirection::HERE_STRING: {
+                ArenaString content = redirection.target + "\n";
+                source = createSealedMemfd(content.data(), content.size());
+                break;
+            }
+            case Redirection::DUPLICATE: {
+                // The source is either open in the shell or set up by an earlier redirection
+                int duplicated = isdigit(redirection.target[0]) ? atoi(redirection.target.c_str()) : -1;
+                bool is_defined = std::any_of(fds.begin(), fds.end(), [duplicated](const std::pair<int, int>& fd) {
+                    return fd.second == duplicated;
+                });
+                if (duplicated == -1 || (!is_defined && fcntl(duplicated, F_GETFD) == -1)) {
+                    std::cerr << "smash error: " << redirection.target << ": bad file descriptor" << std::endl;
+                    return false;
+                }
+                const HereDocument* document = is_defined ? nullptr : HereDocument::find(duplicated);
+                if (document != nullptr) {
+                    source = document->open();
+                    break;
+                }
+                fds.emplace_back(duplicated, redirection.fd);
+                continue;
+            }
+        }
+        if (source == -1) {
+            if (redirection.type != Redirection::HERE_STRING) {
+                perror("smash error: open failed");
+            }
+            return false;
+        }
+        opened_fds.push_back(source);
+        fds.emplace_back(source, redirection.fd);
     }
+    return true;
+}
 
+/*
+ * Built-ins print through their output stream, so stdout is pointed at the final target without
+ * touching the shell's fd 1. Only stderr (used by perror) is swapped for the duration of the command.
+ * The buffered output must still interleave with stderr the way an external command's would:
+ * std::cerr flushes it before writing, and when both go to the same file (2>&1) it is not buffered
+ * at all, since perror writes around std::cerr.
+ */
+void RedirectionCommand::executeBuiltIn(Command* cmd, const FdRedirections& fds) {
+    int targets[3] = {0, 1, 2};
+    for (const auto& redirection : fds) {
+        int source = (redirection.first <= 2) ? targets[redirection.first] : redirection.first;
+        if (redirection.second <= 2) {
+            targets[redirection.second] = source;
+        }
+    }
 
-    if (close(1) == -1) {
-        perror("smash error: close failed");
-        dup2(stdout_backup, 1);
-        close(stdout_backup);
-        return;
+    int stderr_backup = -1;
+    if (targets[2] != 2) {
+        stderr_backup = dup(2);
+        if (stderr_backup == -1 || dup2(targets[2], 2) == -1) {
+            perror("smash error: dup2 failed");
+            m_exitStatus = 1;
+            return;
+        }
     }
 
-    int flags = O_WRONLY | O_CREAT;
-    if (m_redirection_char == ">") {
-        flags |= O_TRUNC;
+    auto execute = [cmd, &targets](std::ostream& out) {
+        std::ostream* cerr_tie = std::cerr.tie(&out);
+        std::ios_base::fmtflags flags = out.flags();
+        if (targets[1] == targets[2]) {
+            out << std::unitbuf;
+        }
+        cmd->execute();
+        out.flags(flags);
+        std::cerr.tie(cerr_tie);
+    };
+    cmd->setInput(targets[0]);
+    if (targets[1] != 1) {
+        FdOutputStream out(targets[1]);
+        cmd->setOutput(&out);
+        execute(out);
     } else {
-        flags |= O_APPEND;
+        execute(std::cout);
     }
+    m_exitStatus = cmd->getExitStatus();
 
+    if (stderr_backup != -1) {
+        dup2(stderr_backup, 2);
+        close(stderr_backup);
+    }
+}
 
-    int file = open(m_output_file.c_str(), flags, 0666);
-    if(file == -1) {
-        perror("smash error: open failed");
-        dup2(stdout_backup, 1);
-        close(stdout_backup);
+void RedirectionCommand::execute() {
+    if (m_syntax_error) {
+        std::cerr << "smash error: syntax error: missing redirection target" << std::endl;
+        m_exitStatus = 1;
         return;
     }
 
+    FdRedirections fds;
+    std::vector<int> opened_fds;
+    if (!openRedirections(fds, opened_fds)) {
+        for (int fd : opened_fds) {
+            close(fd);
+        }
+        m_exitStatus = 1;
+        return;
+    }
 
     SmallShell& smash = SmallShell::getInstance();
-    smash.executeCommand(m_removed_background_cmd_line);
-
-    close(1);
-    if (dup2(stdout_backup, 1) == -1) {
-        perror("smash error: dup2 failed");
+    const std::string inner_cmd_line = smash.resolveAlias(m_removed_background_cmd_line.c_str());
+    Command* inner_cmd = smash.CreateCommand(inner_cmd_line.c_str());
+
+    if (inner_cmd != nullptr) {
+        // External commands set up their descriptors in the child, right before exec
+        auto* external_cmd = dynamic_cast<ExternalCommand*>(inner_cmd);
+        if (external_cmd != nullptr) {
+            external_cmd->setRedirections(fds);
+            external_cmd->execute();
+            m_exitStatus = external_cmd->getExitStatus();
+        } else {
+            executeBuiltIn(inner_cmd, fds);
+        }
+        delete inner_cmd;
     }
-    close(stdout_backup);
 
+    for (int fd : opened_fds) {
+        close(fd);
+    }
 }
 
 // Pipes command
 PipeCommand::PipeCommand(const char *cmd_line) : Command(cmd_line, false) {
-    size_t temp1 = m_cmd_line.find("|&");
-    size_t temp2 = m_cmd_line.find('|');
-    size_t pipe_pos = temp1 != (std::string::npos) ? temp1 : temp2;
-    m_pipe_char = temp1 != (std::string::npos) ? "|&" : "|";
+    // The first "|&", or else the first '|', outside command substitutions
+    const std::string line(m_cmd_line.c_str());
+    size_t pipe_pos = _findUnsubstituted(line, "|");
+    m_pipe_char = "|";
+    for (size_t pos = pipe_pos; pos != std::string::npos; pos = _findUnsubstituted(line, "|", pos + 1)) {
+        if (line.compare(pos, 2, "|&") == 0) {
+            pipe_pos = pos;
+            m_pipe_char = "|&";
+            break;
+        }
+    }
 
     m_command_line1 = m_cmd_line.substr(0, pipe_pos);
     m_command_line2 = m_cmd_line.substr(pipe_pos + m_pipe_char.size());
 
 
-    strcpy(m_removed_background_command1, m_command_line1.c_str());
-    strcpy(m_removed_background_command2, m_command_line2.c_str());
-    _removeBackgroundSign(m_removed_background_command1);
-    _removeBackgroundSign(m_removed_background_command2);
+    m_removed_background_command1 = _removedBackgroundSign<ArenaString>(m_command_line1.c_str());
+    m_removed_background_command2 = _removedBackgroundSign<ArenaString>(m_command_line2.c_str());
 
 }
 
-void PipeCommand::execute() {
-    int redirected_write_channel = (m_pipe_char == "|") ? 1 : 2;
-
-    int my_pipe[2];
-    if(pipe(my_pipe) == -1) {
-        perror("smash error: pipe failed");
-        return;
+/*
+ * Starts one side of the pipe with pipe_fd as its target_fd. External commands are spawned
+ * directly, anything else runs in a forked child shell. Returns the pid, or -1 on failure.
+ */
+pid_t PipeCommand::startStage(const char* cmd_line, Command* cmd, int pipe_fd, int target_fd, const int pipe_fds[2]) {
+    auto* external_cmd = dynamic_cast<ExternalCommand*>(cmd);
+    if (external_cmd != nullptr) {
+        FdRedirections redirections;
+        redirections.emplace_back(pipe_fd, target_fd);
+        external_cmd->setRedirections(redirections);
+        return external_cmd->spawn();
     }
 
-    // Implementation for "|" pipe char
-    pid_t first_child = fork();
-    if (first_child == -1) {
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == -1) {
         perror("smash error: fork failed");
-        close(my_pipe[0]);
-        close(my_pipe[1]);
-        return;
+        return -1;
     }
-
-    // === First child (writer) ===
-    if(first_child == 0) {
+    if (pid == 0) {
         setpgrp();
-        close(my_pipe[0]);
-
-        // Redirect stdout to pipe write channel
-        if (dup2(my_pipe[1], redirected_write_channel) == -1) {
+        if (dup2(pipe_fd, target_fd) == -1) {
             perror("smash error: dup2 failed");
             exit(1);
         }
-
-        close(my_pipe[1]);
-        SmallShell& smash1 = SmallShell::getInstance();
-        smash1.executeCommand(m_removed_background_command1);
-        exit(0);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        SmallShell& smash = SmallShell::getInstance();
+        smash.executeCommand(cmd_line);
+        exit(smash.getLastExitStatus());
     }
+    return pid;
+}
 
+void PipeCommand::execute() {
+    int redirected_write_channel = (m_pipe_char == "|") ? 1 : 2;
+    SmallShell& smash = SmallShell::getInstance();
 
-    // Continue parent process
-    pid_t second_child = fork();
-    if (second_child == -1) {
-        perror("smash error: fork failed");
-        close(my_pipe[0]);
-        close(my_pipe[1]);
+    int my_pipe[2];
+    if(pipe2(my_pipe, O_CLOEXEC) == -1) {
+        perror("smash error: pipe failed");
+        m_exitStatus = 1;
         return;
     }
 
-
-    // === Second child (reader) ===
-    if(second_child == 0) {
-        setpgrp();
+    // === Reader ===
+    const std::string reader_cmd_line = smash.resolveAlias(m_removed_background_command2.c_str());
+    Command* reader_cmd = smash.CreateCommand(reader_cmd_line.c_str());
+    pid_t reader_pid = startStage(m_removed_background_command2.c_str(), reader_cmd, my_pipe[0], STDIN_FILENO,
+                                  my_pipe);
+    delete reader_cmd;
+    close(my_pipe[0]);
+    if (reader_pid == -1) {
         close(my_pipe[1]);
+        m_exitStatus = 1;
+        return;
+    }
 
-        // Redirect stdin to pipe read channel
-        if (dup2(my_pipe[0], 0) == -1) {
-            perror("smash error: dup2 failed");
-            exit(1);
+    // === Writer ===
+    const std::string writer_cmd_line = smash.resolveAlias(m_removed_background_command1.c_str());
+    Command* writer_cmd = smash.CreateCommand(writer_cmd_line.c_str());
+
+    // A built-in writer that only prints runs inside the shell, writing into the pipe
+    if (writer_cmd != nullptr && redirected_write_channel == 1 && writer_cmd->canRunInPipeline()) {
+        // The reader may exit before consuming everything, which must not kill the shell
+        sighandler_t old_sigpipe = signal(SIGPIPE, SIG_IGN);
+        {
+            FdOutputStream pipe_out(my_pipe[1]);
+            writer_cmd->setOutput(&pipe_out);
+            writer_cmd->execute();
+        }
+        signal(SIGPIPE, old_sigpipe);
+        close(my_pipe[1]);
+    } else {
+        pid_t writer_pid = startStage(m_removed_background_command1.c_str(), writer_cmd, my_pipe[1],
+                                      redirected_write_channel, my_pipe);
+        close(my_pipe[1]);
+        if (writer_pid != -1) {
+            waitpid(writer_pid, NULL, 0);
         }
-
-        close(my_pipe[0]);
-        SmallShell& smash1 = SmallShell::getInstance();
-        smash1.executeCommand(m_removed_background_command2);
-        exit(0);
     }
+    delete writer_cmd;
 
-
-    // Parent process
-    close(my_pipe[0]);
-    close(my_pipe[1]);
-    waitpid(first_child, NULL, 0);
-    waitpid(second_child, NULL, 0);
+    int status;
+    if (waitpid(reader_pid, &status, 0) != -1) {
+        m_exitStatus = exitStatusOf(status);
+    }
 }
 
 // du command
@@ -952,6 +3594,7 @@ DiskUsageCommand::DiskUsageCommand(const char *cmd_line) : Command(cmd_line, tru
 void DiskUsageCommand::execute() {
     if (m_num_args > 2) {
         std::cerr << "smash error: du: too many arguments" << std::endl;
+        m_exitStatus = 1;
         return;
     }
 
@@ -961,6 +3604,7 @@ void DiskUsageCommand::execute() {
         char buffer[COMMAND_MAX_LENGTH];
         if (getcwd(buffer, PATH_MAX) == NULL) {
             perror("smash error: getcwd failed");
+            m_exitStatus = 1;
             return;
         }
         directory_path = std::string(buffer);
@@ -971,7 +3615,11 @@ void DiskUsageCommand::execute() {
     auto size_in_bytes = calculateDirectorySize(directory_path);
     auto size_in_kb = (size_in_bytes + 1023) / 1024;
 
-    std::cout << "Total disk usage: " << size_in_kb  << " KB" << std::endl;
+    *m_out << "Total disk usage: " << size_in_kb  << " KB\n";
+}
+
+bool DiskUsageCommand::canRunInPipeline() const {
+    return true;
 }
 
 // whoami command
@@ -983,6 +3631,7 @@ void WhoAmICommand::execute() {
     int file = open("/etc/passwd", O_RDONLY);
     if(file == -1) {
         perror("smash error: open failed");
+        m_exitStatus = 1;
         return;
     }
 
@@ -992,6 +3641,7 @@ void WhoAmICommand::execute() {
 
     if(bytes_read == -1) {
         perror("smash error: read failed");
+        m_exitStatus = 1;
         return;
     } else if (bytes_read == 0) {
         return;
@@ -1014,15 +3664,19 @@ void WhoAmICommand::execute() {
         }
 
         if(fields.size() >= 6 && static_cast<uid_t>(std::stoi(fields[2])) == user_id) {
-            std::cout << fields[0] << std::endl; // user name
-            std::cout << user_id << std::endl; // user id
-            std::cout << fields[3] << std::endl; // user id
-            std::cout << fields[5] << std::endl; // home dir
+            *m_out << fields[0] << '\n'; // user name
+            *m_out << user_id << '\n'; // user id
+            *m_out << fields[3] << '\n'; // user id
+            *m_out << fields[5] << '\n'; // home dir
             return;
         }
     }
 }
 
+bool WhoAmICommand::canRunInPipeline() const {
+    return true;
+}
+
 
 // usbinfo command
 
@@ -1071,6 +3725,7 @@ void USBInfoCommand::execute() {
     int dir = open("/sys/bus/usb/devices", O_RDONLY | O_DIRECTORY);
     if(dir == -1) {
         perror("smash error: open failed");
+        m_exitStatus = 1;
         return;
     }
 
@@ -1099,6 +3754,7 @@ void USBInfoCommand::execute() {
 
     if (devices.empty()) {
         std::cerr << "smash error: usbinfo: no USB devices found" << std::endl;
+        m_exitStatus = 1;
         return;
     }
 
@@ -1110,23 +3766,29 @@ void USBInfoCommand::execute() {
 
 
     for (const auto &dev: devices) {
-        std::cout << "Device " << dev.devNum << ": ID " << dev.idVendor << ":"
+        *m_out << "Device " << dev.devNum << ": ID " << dev.idVendor << ":"
         << dev.idProduct << " " << dev.manufacturer << " " << dev.product << " MaxPower: " <<
-        dev.maxPower << "mA" << std::endl;
+        dev.maxPower << "mA\n";
     }
 
 }
 
+bool USBInfoCommand::canRunInPipeline() const {
+    return true;
+}
+
 
 
 
 // TODO: JobsList Entry class
 
 JobsList::JobEntry::JobEntry(int job_id, pid_t pid, State curr_state, const Command *cmd) :
-   m_jobId(job_id), m_pid(pid), m_cmdLine(cmd->getCmdLine()), m_currentState(curr_state) {}
+   m_jobId(job_id), m_pid(pid), m_cmdLine(cmd->getCmdLine().c_str()), m_currentState(curr_state) {}
 
-JobsList::JobEntry::JobEntry(int job_id, pid_t pid, State curr_state, std::string  cmd_line) :
-        m_jobId(job_id), m_pid(pid), m_cmdLine(std::move(cmd_line)), m_currentState(curr_state) {}
+JobsList::JobEntry::JobEntry(int job_id, pid_t pid, State curr_state, std::string  cmd_line,
+                             std::shared_ptr<LaunchOptions> launch) :
+        m_jobId(job_id), m_pid(pid), m_cmdLine(std::move(cmd_line)), m_currentState(curr_state),
+        m_launch(std::move(launch)) {}
 
 int JobsList::JobEntry::getJobID() const {
     return m_jobId;
@@ -1140,6 +3802,17 @@ const std::string& JobsList::JobEntry::getCmdLine() const {
     return m_cmdLine;
 }
 
+const std::shared_ptr<LaunchOptions>& JobsList::JobEntry::getLaunch() const {
+    return m_launch;
+}
+
+int JobsList::JobEntry::sendSignal(int signum) const {
+    if (signum == SIGKILL && m_launch != nullptr && m_launch->cgroup != nullptr) {
+        return m_launch->cgroup->killAll() ? 0 : -1;
+    }
+    return kill(m_pid, signum);
+}
+
 
 
 // TODO: JobsList class
@@ -1154,42 +3827,172 @@ void JobsList::addJob(Command *cmd, pid_t pid, bool isStopped) {
     m_jobs.emplace_back(new_job_id, pid, state, cmd);
 }
  */
-void JobsList::addJob(const Command *cmd, pid_t pid, bool isStopped) {
-    addJob(cmd->getCmdLine(), pid, isStopped);
+void JobsList::addJob(const Command *cmd, pid_t pid, bool isStopped, std::shared_ptr<LaunchOptions> launch) {
+    addJob(cmd->getCmdLine().c_str(), pid, isStopped, std::move(launch));
 }
 
 // May make std::string cmd_line of type const std::string&
-void JobsList::addJob(const std::string& cmd_line, pid_t pid, bool isStopped) {
+void JobsList::addJob(const std::string& cmd_line, pid_t pid, bool isStopped, std::shared_ptr<LaunchOptions> launch) {
     removeFinishedJobs();
     int new_job_id = 1;
     if(!m_jobs.empty()) {
         new_job_id = m_jobs.back().getJobID() + 1;
     }
     auto state = isStopped ? State::stopped : State::running;
-    m_jobs.emplace_back(new_job_id, pid, state, cmd_line);
+    m_jobs.emplace_back(new_job_id, pid, state, cmd_line, std::move(launch));
+}
+
+/*
+ * [<job-id>] <command>, followed by the usage of its cgroup when it has one. The long format puts
+ * the pid before the command and the run options on a line of their own.
+ */
+static void printJob(std::ostream& out, const JobsList::JobEntry& job, bool long_format = false) {
+    out << "[" << job.getJobID() << "] ";
+    if (long_format) {
+        out << job.getJobPID() << " ";
+    }
+    out << job.getCmdLine();
+    const std::shared_ptr<LaunchOptions>& launch = job.getLaunch();
+    if (launch != nullptr && launch->cgroup != nullptr) {
+        std::string usage = launch->cgroup->usage();
+        out << " (cgroup " << launch->cgroup->path() << (usage.empty() ? "" : ": ") << usage << ")";
+    }
+    std::string options = (long_format && launch != nullptr) ? launch->describe() : "";
+    if (!options.empty()) {
+        out << "\n        run " << options;
+    }
 }
 
-void JobsList::printJobsList() {
+void JobsList::printJobsList(std::ostream& out, bool long_format) {
     removeFinishedJobs();
     // The vector is already sorted
     for (const auto& job : m_jobs) {
-        // Print format: [<job-id>] <command>
-        std::cout << "[" << job.getJobID() << "] "
-                  << job.getCmdLine() << std::endl;
+        printJob(out, job, long_format);
+        out << '\n';
     }
 }
 
-void JobsList::killAllJobs() {
+void JobsList::printJobsTree(std::ostream& out, ProcessTree& tree) {
     removeFinishedJobs();
-    std::cout << "smash: sending SIGKILL signal to "<< m_jobs.size() << " jobs:" << std::endl;
+    tree.refresh();
+    for (const auto& job : m_jobs) {
+        printJob(out, job);
+        out << '\n';
+        tree.print(out, job.getJobPID());
+    }
+}
 
-    for(const auto& job: m_jobs) {
-        std::cout << job.getJobPID() << ": " << job.getCmdLine() << std::endl;
-        if (kill(job.getJobPID(), SIGKILL) == -1) {
+/*
+ * Every job gets SIGTERM (and SIGCONT, so stopped ones see it) on its whole process group, then
+ * all of them are waited for at once: their pidfds are in one epoll set with a timerfd for the
+ * deadline. Only the jobs still running at the deadline (or at ctrl-C) get SIGKILL, on their
+ * cgroup when they have one. Every job is reaped before returning.
+ */
+void JobsList::killAllJobs(double grace) {
+    static const uint64_t DEADLINE = UINT64_MAX;
+    removeFinishedJobs();
+    if (m_jobs.empty()) {
+        return;
+    }
+    std::cout << "smash: sending SIGTERM signal to " << m_jobs.size() << " jobs, SIGKILL to those left after "
+              << grace << "s" << std::endl;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The shell exits next, it may hold a descriptor for every job
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = DEADLINE;
+    if (epoll_fd == -1 || timer_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event) == -1) {
+        perror("smash error: epoll failed");
+    }
+
+    // A job without a pidfd (none left, or an old kernel) is checked with waitpid() every few ms
+    std::vector<int> pid_fds(m_jobs.size(), -1);
+    std::vector<bool> ended(m_jobs.size(), false);
+    size_t running = m_jobs.size();
+    size_t unwatched = 0;
+    for (size_t i = 0; i < m_jobs.size(); i++) {
+        pid_t pid = m_jobs[i].getJobPID();
+        pid_fds[i] = syscall(SYS_pidfd_open, pid, 0);
+        event.data.u64 = i;
+        if (pid_fds[i] != -1 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pid_fds[i], &event) == -1) {
+            close(pid_fds[i]);
+            pid_fds[i] = -1;
+        }
+        unwatched += (pid_fds[i] == -1);
+        if (killpg(pid, SIGTERM) == -1 && kill(pid, SIGTERM) == -1 && errno != ESRCH) {
             perror("smash error: kill failed");
         }
+        killpg(pid, SIGCONT);
+    }
+    if (grace > 0) {
+        armTimer(timer_fd, grace);
+    }
+
+    auto reap = [&](size_t i) {
+        if (!ended[i] && waitpid(m_jobs[i].getJobPID(), nullptr, WNOHANG) != 0) {
+            ended[i] = true;
+            --running;
+        }
+    };
+    bool deadline = (grace == 0);
+    struct epoll_event events[64];
+    while (running > 0 && !deadline && !smash_interrupted) {
+        int count = epoll_wait(epoll_fd, events, 64, unwatched > 0 ? 10 : -1);
+        if (count == -1 && errno != EINTR) {
+            perror("smash error: epoll_wait failed");
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.u64 == DEADLINE) {
+                deadline = true;
+            } else {
+                reap(events[i].data.u64);
+            }
+        }
+        for (size_t i = 0; i < m_jobs.size() && unwatched > 0; i++) {
+            if (pid_fds[i] == -1) {
+                reap(i);
+            }
+        }
+    }
+    size_t terminated = m_jobs.size() - running;
+
+    for (size_t i = 0; i < m_jobs.size(); i++) {
+        if (!ended[i]) {
+            m_jobs[i].sendSignal(SIGKILL);
+            killpg(m_jobs[i].getJobPID(), SIGKILL);
+        }
+    }
+    for (size_t i = 0; i < m_jobs.size(); i++) {
+        if (!ended[i]) {
+            while (waitpid(m_jobs[i].getJobPID(), nullptr, 0) == -1 && errno == EINTR) {}
+        }
+        if (pid_fds[i] != -1) {
+            close(pid_fds[i]);
+        }
+    }
+    for (int fd : {epoll_fd, timer_fd}) {
+        if (fd != -1) {
+            close(fd);
+        }
     }
 
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    char summary[160];
+    snprintf(summary, sizeof(summary), "smash: %zu jobs ended: %zu after SIGTERM, %zu killed with SIGKILL (%.2fs)",
+             m_jobs.size(), terminated, m_jobs.size() - terminated,
+             (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    std::cout << summary << '\n';
     m_jobs.clear();
 }
 
@@ -1208,6 +4011,15 @@ void JobsList::removeFinishedJobs() {
 }
 
 
+JobsList::JobEntry* JobsList::getJobByPid(pid_t pid) const {
+    for (const auto& job : m_jobs) {
+        if (job.getJobPID() == pid) {
+            return const_cast<JobEntry *>(&job);
+        }
+    }
+    return nullptr;
+}
+
 JobsList::JobEntry* JobsList::getJobById(int jobId) const {
     for(const auto& job: m_jobs) {
         if(job.getJobID() == jobId) {
@@ -1333,6 +4145,30 @@ static std::string read_content(const std::string& path) {
     return res.empty() ? "N/A" : res;
 }
 
+// Returns a read-only, sealed in-memory file holding data, positioned at its start
+static int createSealedMemfd(const char* data, size_t len) {
+    int fd = memfd_create("smash-here-document", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        perror("smash error: memfd_create failed");
+        return -1;
+    }
+
+    size_t written = 0;
+    while (written < len) {
+        ssize_t bytes = write(fd, data + written, len - written);
+        if (bytes == -1) {
+            perror("smash error: write failed");
+            close(fd);
+            return -1;
+        }
+        written += bytes;
+    }
+
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
 void addUsbDevice(const std::string& path, std::vector<UsbDevice>& devices) {
     const std::string devnum_path = path + "/devnum";
     const int file = open(devnum_path.c_str(), O_RDONLY);
@@ -6,49 +6,121 @@
 #include <string>
 #include <limits.h>     // For PATH_MAX
 #include <stdio.h>
+#include <signal.h>
 #include <unordered_set>
+#include <unordered_map>
+#include <memory>
+#include <ostream>
+#include "Arena.h"
+#include "JobLog.h"
+#include "Variables.h"
+#include "Scheduler.h"
+#include "History.h"
+#include "ProcessTree.h"
+#include "LaunchOptions.h"
+#include "AuditLog.h"
 
 #define COMMAND_MAX_LENGTH (200)
 #define COMMAND_MAX_ARGS (20)
 class SmallShell;
+class Script;
+class LineReader;
+class FdOutputStream;
 enum State {stopped, running};
 
 class Command {
 protected:
-    const std::string m_cmd_line;
+    Arena* const m_arena;
+    const ArenaString m_cmd_line;
+    const bool m_parseArgs;
     char* m_cmd_args[COMMAND_MAX_ARGS + 1];
     int m_num_args;
+    int m_exitStatus;
+    std::ostream* m_out;
+    int m_outFd;
+    int m_inFd;
+
+    // Flushes the output stream, for commands writing to the output descriptor directly
+    int outputFd();
+    // Splits line into m_cmd_args again, with the current values of its parameters
+    void parseArguments(const char* line);
+    // Expands the parameters of the command line again before executeAgain (m_cmd_args by default)
+    virtual void expandArguments();
 
 public:
     explicit Command(const char* cmd_line, bool parse_args = true);
     virtual ~Command();
     virtual void execute() = 0;
-
-    const std::string& getCmdLine() const;
+    // Runs the command once more, for the command objects kept by a compiled Script. With expand,
+    // the parameters of its line get their current values first.
+    void executeAgain(bool expand);
+
+    // Commands live in the per-line arena of the shell (see SmallShell::executeCommand)
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
+
+    const ArenaString& getCmdLine() const;
+    // 0 on success, like the exit status of a process
+    int getExitStatus() const;
+
+    // Where the command prints its output (std::cout unless redirected)
+    void setOutput(FdOutputStream* out);
+    // Where the command reads its input from (the shell's stdin unless redirected)
+    void setInput(int fd);
+    // True for built-ins that only print and may run inside the shell as a pipeline stage
+    virtual bool canRunInPipeline() const;
+    // True when nothing but expandArguments() depends on the parameters of the line, so the command
+    // may run again with other values through executeAgain(true)
+    virtual bool canExpandAgain() const;
 };
 
 class BuiltInCommand : public Command {
+protected:
+    // Runs the real binary of the same name instead, with the same input and output
+    void executeExternal();
 public:
     explicit BuiltInCommand(const char *cmd_line, bool parse_args = true);
     virtual ~BuiltInCommand() = default;
 };
 
+// (source fd, target fd) pairs applied with dup2() in order
+typedef std::vector<std::pair<int, int>, ArenaAllocator<std::pair<int, int>>> FdRedirections;
+
 class ExternalCommand : public Command {
-    static const char WILDCARDS[];
-    char m_removed_background_cmd_line[COMMAND_MAX_LENGTH + 1]{};
+    ArenaString m_removed_background_cmd_line;
+    ArenaString m_bashScript;   // The line with its parameters expanded, for bash -c
+    FdRedirections m_redirections;
     bool is_complex_command() const;
+protected:
+    void expandArguments() override;
 public:
     explicit ExternalCommand(const char *cmd_line);
     virtual ~ExternalCommand() = default;
     void execute() override;
+    bool canExpandAgain() const override;
+
+    // File descriptors to set up in the child before exec
+    void setRedirections(const FdRedirections& redirections);
+    // Starts the command in a new process group without waiting for it, returns its pid or -1
+    pid_t spawn();
 };
 
 
 class RedirectionCommand : public Command {
-    std::string m_redirection_char;
-    std::string m_command_line;
-    std::string m_output_file;
-    char m_removed_background_cmd_line[COMMAND_MAX_LENGTH + 1]{};
+    struct Redirection {
+        enum Type {READ, WRITE, APPEND, DUPLICATE, HERE_STRING};
+        int fd;
+        Type type;
+        ArenaString target;
+        Redirection(int redirected_fd, Type redirection_type, ArenaString redirection_target);
+    };
+
+    std::vector<Redirection, ArenaAllocator<Redirection>> m_redirections;
+    ArenaString m_command_line;
+    bool m_syntax_error = false;
+    ArenaString m_removed_background_cmd_line;
+    bool openRedirections(FdRedirections& fds, std::vector<int>& opened_fds);
+    void executeBuiltIn(Command* cmd, const FdRedirections& fds);
 public:
     explicit RedirectionCommand(const char *cmd_line);
 
@@ -59,11 +131,12 @@ public:
 
 
 class PipeCommand : public Command {
-    std::string m_pipe_char;
-    std::string m_command_line1;
-    std::string m_command_line2;
-    char m_removed_background_command1[COMMAND_MAX_LENGTH + 1]{};
-    char m_removed_background_command2[COMMAND_MAX_LENGTH + 1]{};
+    ArenaString m_pipe_char;
+    ArenaString m_command_line1;
+    ArenaString m_command_line2;
+    ArenaString m_removed_background_command1;
+    ArenaString m_removed_background_command2;
+    static pid_t startStage(const char* cmd_line, Command* cmd, int pipe_fd, int target_fd, const int pipe_fds[2]);
 public:
     explicit PipeCommand(const char *cmd_line);
 
@@ -80,6 +153,7 @@ public:
     virtual ~DiskUsageCommand() = default;
 
     void execute() override;
+    bool canRunInPipeline() const override;
 };
 
 
@@ -90,6 +164,7 @@ public:
     virtual ~WhoAmICommand() = default;
 
     void execute() override;
+    bool canRunInPipeline() const override;
 };
 
 
@@ -100,11 +175,12 @@ public:
     virtual ~USBInfoCommand()  = default;
 
     void execute() override;
+    bool canRunInPipeline() const override;
 };
 
 
 class ChangeDirCommand : public BuiltInCommand {
-    std::string m_targetPath;
+    ArenaString m_targetPath;
     char** m_plastPwd;
 public:
     ChangeDirCommand(const char *cmd_line, char **plastPwd);
@@ -117,6 +193,7 @@ public:
     explicit GetCurrDirCommand(const char *cmd_line);
     virtual ~GetCurrDirCommand() = default;
     void execute() override;
+    bool canRunInPipeline() const override;
 };
 
 class ShowPidCommand : public BuiltInCommand {
@@ -124,11 +201,12 @@ public:
     explicit ShowPidCommand(const char *cmd_line);
     virtual ~ShowPidCommand() = default;
     void execute() override;
+    bool canRunInPipeline() const override;
 };
 
 class ChangePromptCommand : public BuiltInCommand {
     SmallShell* const m_sshell;
-    std::string m_prompt;
+    ArenaString m_prompt;
 public:
     ChangePromptCommand(const char *cmd_line, SmallShell *smash);
     virtual ~ChangePromptCommand() = default;
@@ -137,8 +215,14 @@ public:
 
 class JobsList;
 
+/*
+ * quit             - exits the shell
+ * quit kill [GRACE] - first ends the jobs: SIGTERM, then SIGKILL for those still running GRACE
+ *                    seconds later (3 by default, s, m, h and d suffixes allowed)
+ */
 class QuitCommand : public BuiltInCommand {
     bool m_is_kill_specified = false;
+    double m_grace = 3;
     JobsList* const m_jobs_list;
 public:
     QuitCommand(const char *cmd_line, JobsList *jobs);
@@ -146,6 +230,7 @@ public:
     virtual ~QuitCommand() = default;
 
     void execute() override;
+    bool canExpandAgain() const override;
 };
 
 class JobsList {
@@ -155,14 +240,20 @@ public:
         pid_t m_pid;
         std::string m_cmdLine;
         State m_currentState;
+        std::shared_ptr<LaunchOptions> m_launch;
 
     public:
         JobEntry(int job_id, pid_t pid, State curr_state, const Command *cmd);
-        JobEntry(int job_id, pid_t pid, State curr_state, std::string  cmd_line);
+        JobEntry(int job_id, pid_t pid, State curr_state, std::string  cmd_line,
+                 std::shared_ptr<LaunchOptions> launch = nullptr);
         ~JobEntry() = default;
         int getJobID() const;
         pid_t getJobPID() const;
         const std::string& getCmdLine() const;
+        // The run options the job was started with, NULL if none
+        const std::shared_ptr<LaunchOptions>& getLaunch() const;
+        // Sends signum to the job, SIGKILL to every process of its cgroup when it has one
+        int sendSignal(int signum) const;
     };
 
 private:
@@ -173,25 +264,38 @@ public:
 
     ~JobsList() = default;
 
-    void addJob(const Command* cmd, pid_t pid, bool isStopped = false);
-    void addJob(const std::string& cmdLine, pid_t pid, bool isStopped = false);
-    void printJobsList();
-    void killAllJobs();
+    void addJob(const Command* cmd, pid_t pid, bool isStopped = false,
+                std::shared_ptr<LaunchOptions> launch = nullptr);
+    void addJob(const std::string& cmdLine, pid_t pid, bool isStopped = false,
+                std::shared_ptr<LaunchOptions> launch = nullptr);
+    void printJobsList(std::ostream& out, bool long_format = false);
+    // Prints every job followed by its processes (see ProcessTree)
+    void printJobsTree(std::ostream& out, ProcessTree& tree);
+    // Ends every job (quit kill): SIGTERM, then SIGKILL for the ones left after grace seconds
+    void killAllJobs(double grace);
     void removeFinishedJobs();
     JobEntry* getJobById(int jobId) const;
+    JobEntry* getJobByPid(pid_t pid) const;
     void removeJobById(int jobId);
     bool empty() const;
     int getMaxJobId() const;
 };
 
+/*
+ * jobs      - lists the background and stopped jobs
+ * jobs -t   - also prints the processes of every job as a tree: pid, state, CPU time, RSS and name
+ * jobs -l   - also prints the pid of every job and the run options it was started with
+ */
 class JobsCommand : public BuiltInCommand {
     JobsList* const m_jobsList;
+    ProcessTree* const m_processTree;
 public:
-    JobsCommand(const char *cmd_line, JobsList *jobs);
+    JobsCommand(const char *cmd_line, JobsList *jobs, ProcessTree *tree);
 
     virtual ~JobsCommand() = default;
 
     void execute() override;
+    bool canRunInPipeline() const override;
 };
 
 class KillCommand : public BuiltInCommand {
@@ -215,19 +319,22 @@ public:
 };
 
 class AliasCommand : public BuiltInCommand {
-    std::string m_name;
-    std::string m_command;
+    ArenaString m_name;
+    ArenaString m_command;
     void extractNameAndCommand();
     bool isValidName() const;
     bool isLegalName() const;
-    void insertNewAlias(std::vector<std::pair<std::string, std::string>>& allAlias) const;
-    static const std::unordered_set<std::string> RESERVED_KEYWORDS;
+    bool insertNewAlias(std::vector<std::pair<std::string, std::string>>& allAlias) const;
 public:
+    // The built-in commands and shell keywords, which no alias may shadow
+    static const std::unordered_set<std::string> RESERVED_KEYWORDS;
+
     explicit AliasCommand(const char *cmd_line);
 
     virtual ~AliasCommand() = default;
 
     void execute() override;
+    bool canRunInPipeline() const override;
 
 };
 
@@ -251,6 +358,48 @@ public:
 };
 
 
+/*
+ * NAME=value [NAME=value ...]
+ * The value may be quoted ('...' is taken literally, "..." and unquoted values are expanded).
+ * Assignments are made left to right, so a value may refer to a name assigned before it.
+ */
+class AssignmentCommand : public BuiltInCommand {
+public:
+    explicit AssignmentCommand(const char *cmd_line);
+
+    virtual ~AssignmentCommand() = default;
+
+    void execute() override;
+    bool canExpandAgain() const override;
+};
+
+
+/*
+ * export                       - prints the environment
+ * export NAME[=value] ...      - moves shell variables to the environment of the commands smash runs
+ */
+class ExportCommand : public BuiltInCommand {
+public:
+    explicit ExportCommand(const char *cmd_line);
+
+    virtual ~ExportCommand() = default;
+
+    void execute() override;
+    bool canRunInPipeline() const override;
+    bool canExpandAgain() const override;
+};
+
+
+class UnsetCommand : public BuiltInCommand {
+public:
+    explicit UnsetCommand(const char *cmd_line);
+
+    virtual ~UnsetCommand() = default;
+
+    void execute() override;
+};
+
+
 class SysInfoCommand : public BuiltInCommand {
 public:
     explicit SysInfoCommand(const char *cmd_line);
@@ -258,6 +407,269 @@ public:
     virtual ~SysInfoCommand() = default;
 
     void execute() override;
+    bool canRunInPipeline() const override;
+};
+
+
+class CatCommand : public BuiltInCommand {
+public:
+    explicit CatCommand(const char *cmd_line);
+
+    virtual ~CatCommand() = default;
+
+    void execute() override;
+    bool canRunInPipeline() const override;
+};
+
+
+class TeeCommand : public BuiltInCommand {
+public:
+    explicit TeeCommand(const char *cmd_line);
+
+    virtual ~TeeCommand() = default;
+
+    void execute() override;
+    bool canRunInPipeline() const override;
+};
+
+
+class ParallelCommand : public BuiltInCommand {
+    struct Task {
+        size_t index;
+        pid_t pid;
+        int pidfd;
+        int stdoutFd;
+        int stderrFd;
+        int exitStatus;
+        std::string cmdLine;
+    };
+
+    int m_maxJobs = 1;
+    bool m_keepOrder = false;
+    bool m_grouped = true;
+    std::string m_template;
+    std::vector<std::string> m_inputs;
+    bool m_readInputs = true;
+    bool m_syntaxError = false;
+
+    std::string buildCommandLine(const std::string& input) const;
+    bool startTask(Task& task);
+    void finishTask(Task& task, int wait_status);
+    void printTaskOutput(Task& task);
+public:
+    explicit ParallelCommand(const char *cmd_line);
+
+    virtual ~ParallelCommand() = default;
+
+    void execute() override;
+};
+
+
+struct Applet;
+
+// Runs one of the in-shell utilities of Applets.h, or the real binary when the applet cannot
+class AppletCommand : public BuiltInCommand {
+    const Applet* const m_applet;
+public:
+    AppletCommand(const char *cmd_line, const Applet *applet);
+
+    virtual ~AppletCommand() = default;
+
+    void execute() override;
+    bool canRunInPipeline() const override;
+};
+
+
+class AppletsCommand : public BuiltInCommand {
+public:
+    explicit AppletsCommand(const char *cmd_line);
+
+    virtual ~AppletsCommand() = default;
+
+    void execute() override;
+};
+
+
+/*
+ * joblog --capture | --no-capture    - turns capturing of new background jobs' output on or off
+ * joblog                             - lists the captured logs
+ * joblog <job-id> [--follow]         - prints a job's output, --follow keeps printing until it is done
+ * joblog --follow                    - prints the output of every captured job as it arrives
+ */
+class JobLogCommand : public BuiltInCommand {
+    JobLogs* const m_jobLogs;
+    bool m_follow = false;
+public:
+    JobLogCommand(const char *cmd_line, JobLogs *logs);
+
+    virtual ~JobLogCommand() = default;
+
+    void execute() override;
+    bool canRunInPipeline() const override;
+    bool canExpandAgain() const override;
+};
+
+
+/*
+ * history              - prints every command line entered interactively, by any shell (see History)
+ * history <n>          - prints the last n
+ * history -s <pattern> - prints the ones containing pattern (quotes around it are removed)
+ */
+class HistoryCommand : public BuiltInCommand {
+    History* const m_history;
+public:
+    HistoryCommand(const char *cmd_line, History *history);
+
+    virtual ~HistoryCommand() = default;
+
+    void execute() override;
+    bool canRunInPipeline() const override;
+};
+
+
+/*
+ * every [-q] <interval> <command>   - runs command as a background job every interval (see Scheduler),
+ *                                     -q queues a run that comes while the last one still runs
+ * every -l                          - lists the scheduled commands with their run statistics
+ * every -d <id>                     - stops running the command
+ */
+class EveryCommand : public BuiltInCommand {
+    Scheduler* const m_scheduler;
+public:
+    EveryCommand(const char *cmd_line, Scheduler *scheduler);
+
+    virtual ~EveryCommand() = default;
+
+    void execute() override;
+    bool canRunInPipeline() const override;
+};
+
+
+/*
+ * watchrun [-r] [-q] [--debounce <ms>] <paths...> -- <command>
+ * Runs command as a background job whenever one of the paths (files or directories, -r for the
+ * whole trees below them) changes, until ctrl-C (see FileWatcher). A burst of changes makes one run,
+ * once no change came for the debounce period (100 ms by default). A change while the last run
+ * still runs cancels it (TERM, then KILL a second later), or with -q starts a new run once it is
+ * done. Every start is reported with its latency from the first change seen in the burst.
+ */
+class WatchRunCommand : public BuiltInCommand {
+    JobsList* const m_jobsList;
+public:
+    WatchRunCommand(const char *cmd_line, JobsList *jobs);
+
+    virtual ~WatchRunCommand() = default;
+
+    void execute() override;
+};
+
+
+/*
+ * audit        - prints where the command lines are logged and how many records were written and dropped
+ * audit <file> - appends a record of every command line executed from now on to file (see AuditLog)
+ * audit off    - stops logging
+ */
+class AuditCommand : public BuiltInCommand {
+    AuditLog* const m_auditLog;
+public:
+    AuditCommand(const char *cmd_line, AuditLog *log);
+
+    virtual ~AuditCommand() = default;
+
+    void execute() override;
+    bool canRunInPipeline() const override;
+};
+
+
+/*
+ * run [--cgroup] [--cpu-max QUOTA[/PERIOD] | N%] [--memory-max SIZE] [--pids-max N]
+ *     [--cpus LIST] [--sched other|batch|idle|fifo|rr] [--prio N] [--nice N] [--numa NODE] command
+ * Runs command, a whole line with its pipes, redirections and &, with the options applying to
+ * every external command it starts (and to the jobs they become, see jobs -l). The CPU affinity,
+ * scheduling policy (--prio for fifo and rr), niceness increment and NUMA node (its memory, and
+ * its CPUs unless --cpus is given) are set by the child before exec (see LaunchOptions).
+ * --cgroup puts the processes together in a new cgroup v2 (see Cgroup), the limits imply it:
+ * cpu.max as QUOTA microseconds per PERIOD (100000 by default) or N percent of one CPU,
+ * memory.max in bytes (K, M, G suffixes) and pids.max. jobs then shows the cgroup's memory and
+ * CPU usage, kill -9 and quit kill kill all of its processes.
+ */
+class RunCommand : public BuiltInCommand {
+    Cgroup::Limits m_limits;
+    bool m_cgroup = false;
+    LaunchOptions m_options;
+    std::string m_command;
+    bool m_syntaxError = false;
+public:
+    explicit RunCommand(const char *cmd_line);
+
+    virtual ~RunCommand() = default;
+
+    void execute() override;
+};
+
+
+/*
+ * timeout [-s SIG] [-k KILL_AFTER] DURATION command
+ * Runs command as an external command and sends its process group SIG (TERM by default) after
+ * DURATION seconds (s, m, h and d suffixes allowed, 0 means never), then KILL once KILL_AFTER
+ * more seconds passed. Exits with 124 when the command timed out (137 if it had to be killed),
+ * like GNU timeout. A command that gets stopped becomes a stopped job and is no longer timed.
+ */
+class TimeoutCommand : public BuiltInCommand {
+    int m_signal = SIGTERM;
+    double m_duration = 0;
+    double m_killAfter = 0;
+    std::string m_command;
+    bool m_syntaxError = false;
+    bool m_background = false;  // Runs as a job, in a child shell
+public:
+    explicit TimeoutCommand(const char *cmd_line);
+
+    virtual ~TimeoutCommand() = default;
+
+    void execute() override;
+};
+
+
+/*
+ * Calls a shell function (name () { ...; }). Redirected input and output become the shell's own
+ * stdin and stdout while the body runs.
+ */
+class FunctionCommand : public BuiltInCommand {
+    static const int MAX_DEPTH = 1000;
+    static int s_depth;
+    const ArenaString m_name;
+public:
+    FunctionCommand(const char *cmd_line, const std::string& name);
+
+    virtual ~FunctionCommand() = default;
+
+    void execute() override;
+};
+
+
+/*
+ * The content of a here-document, in a sealed memfd the line refers to as "<&fd". The lines and
+ * function bodies compiled from the line share it, the memfd is closed once the last one is gone.
+ * A loop or a function runs the same "<&fd" again, so every redirection from it opens the content
+ * anew instead of sharing the offset of the memfd. Unless its delimiter was quoted, the content is
+ * expanded then, with the values of that run.
+ */
+class HereDocument {
+    static std::unordered_map<int, const HereDocument*> s_open;
+    const int m_fd;
+    const bool m_expand;
+    bool read(std::string& content) const;
+public:
+    HereDocument(int fd, bool expand);
+    ~HereDocument();
+    HereDocument(HereDocument const &) = delete;
+    void operator=(HereDocument const &) = delete;
+
+    // The here-document fd refers to, NULL if it is not one
+    static const HereDocument* find(int fd);
+    // A new close-on-exec descriptor reading the content from its start, -1 on failure
+    int open() const;
 };
 
 
@@ -265,14 +677,57 @@ class SmallShell {
 private:
     SmallShell();
     std::string m_prompt;
+    std::string m_shownPrompt;
     char *m_lastPwd;
     std::vector<std::pair<std::string, std::string>> m_aliases;
     std::string m_real_cmd_line;
-    std::string resolveAlias(const char *cmd_line) const;
     JobsList m_jobsList;
+    JobLogs m_jobLogs;
+    Scheduler m_scheduler;
+    History m_history;
+    ProcessTree m_processTree;
+    Arena m_lineArena;
+    int m_executeDepth;
+    int m_lastExitStatus;
+    LineReader* m_input;
+    bool m_interactiveInput;
+    std::vector<std::shared_ptr<HereDocument>> m_hereDocuments;   // Read for the outermost line executing
+    std::unordered_map<std::string, std::shared_ptr<Script>> m_functions;
+    ShellVariables m_variables;
+    // $0, $1, ... of the script and of every running function call, innermost last
+    std::vector<std::vector<std::string>> m_positionalParameters;
+    const pid_t m_pid;
+    std::shared_ptr<LaunchOptions> m_launch;    // Of the run command executing, NULL if none
+    AuditLog m_auditLog;
+    // The outermost line executing while the audit log is open, with its start. A copy: reading
+    // here-documents and continuation lines reuses the input buffer the line was in.
+    bool m_auditPending;
+    char m_auditedLine[AuditLog::COMMAND_SIZE];
+    size_t m_auditedLength;
+    int64_t m_auditedTimeNs;
+    int64_t m_auditedStartNs;
+    pid_t m_lastStartedPid;
+    // Outputs of the substitutions made while prepareCommand creates a command, so creating it
+    // again (as a background job) does not run them twice
+    struct SubstitutionReplay {
+        std::vector<std::string> outputs;
+        size_t next;
+        bool replaying;
+    };
+    SubstitutionReplay* m_substitutionReplay;
+    std::vector<int> m_captureFds;  // memfds the in-shell substitutions print into, one per nesting level
+    size_t m_captureDepth;
+    class LineScope;
+    std::string collectHereDocuments(const std::string& cmd_line);
+    void executeScript(std::string source);
+    void runSubstitution(const std::string& command, std::string& output);
+    bool captureInShell(Command* cmd, std::string& output);
 
 public:
     Command *CreateCommand(const char *cmd_line);
+    // The command executeCommand runs for an alias-resolved simple command line (NULL if none)
+    Command *prepareCommand(const char *cmd_line);
+    std::string resolveAlias(const char *cmd_line) const;
 
     SmallShell(SmallShell const &) = delete; // disable copy ctor
     void operator=(SmallShell const &) = delete; // disable = operator
@@ -287,10 +742,63 @@ public:
 
     void executeCommand(const char *cmd_line);
 
+    int getLastExitStatus() const;
+    void setLastExitStatus(int status);
+    // The source of the command lines, here-documents read their content from it (NULL for none)
+    void setInput(LineReader* reader, bool interactive);
+
     void setPrompt(const std::string& newPrompt);
-    void showPrompt() const;
+    // Prints the prompt, or "> " for the next line of a construct or a here-document
+    void showPrompt(bool continuation = false);
+    // The prompt printed last, which the line editor redraws
+    const std::string& getShownPrompt() const;
+    const std::string& getPrompt() const;
+    // The directory cd - goes to, NULL if none
+    const char* getLastPwd() const;
+    void setLastPwd(const char* path);
     static std::vector<std::pair<std::string, std::string>>& getAliases();
     JobsList& getJobsList();
+    JobLogs& getJobLogs();
+    Scheduler& getScheduler();
+    History& getHistory();
+    // Starts cmd_line as a background job in its own process group, returns its pid (-1 on failure)
+    pid_t startJob(const std::string& cmd_line);
+    // The options external commands are started with, set by run while its line executes
+    const std::shared_ptr<LaunchOptions>& getLaunch() const;
+    void setLaunch(std::shared_ptr<LaunchOptions> launch);
+    AuditLog& getAuditLog();
+    // Queues the audit record of the outermost line executing, done once it returns or before quit exits
+    void auditLine();
+    // The process an external command was started as, the pid the audit record of the line shows
+    void setLastStartedPid(pid_t pid);
+
+    // Shell functions, defined by compiled scripts
+    void defineFunction(const std::string& name, std::shared_ptr<Script> body);
+    std::shared_ptr<Script> findFunction(const std::string& name) const;
+
+    ShellVariables& getVariables();
+    // Sets $0, $1, ... for a function call (parameters[0] is ignored, $0 stays) until the pop
+    void pushPositionalParameters(std::vector<std::string> parameters);
+    void popPositionalParameters();
+    // Sets $0, $1, ... of the whole session (smash <script> args, smash -c <commands> $0 args)
+    void setScriptParameters(std::vector<std::string> parameters);
+
+    /*
+     * Appends the value of the parameter referenced right after a '$' in text ($NAME, ${NAME},
+     * $?, $$, $#, $0-$9, $@, $*) to out and returns the length of the reference, or 0 (and
+     * appends nothing) when text does not start with one.
+     */
+    size_t expandParameter(const char* text, size_t length, ArenaString& out);
+    /*
+     * Appends text to out with its parameters and command substitutions expanded, except inside
+     * single quotes or after a backslash. Quotes are kept. quote holds the quote ('\'', '"' or 0)
+     * open at the start of text and is updated, so a line may be expanded one word at a time.
+     */
+    void expandParameters(const char* text, size_t length, ArenaString& out, char& quote);
+    // Runs command ($(command) or `command`) and appends its output without the trailing newlines
+    void substituteCommand(const char* command, size_t length, ArenaString& out);
+    // The end of the command substitution starting at text[pos], pos when none starts there, npos if unclosed
+    static size_t substitutionEnd(const char* text, size_t pos, size_t length);
 };
 
 #endif //SMASH_COMMAND_H_
@@ -0,0 +1,353 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include "Completion.h"
+#include "Commands.h"
+
+struct linux_dirent64 {
+    unsigned long  d_ino;
+    off_t          d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+static const uint32_t PATH_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                                    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+// Calls visit(name, d_type) for every entry of the open directory dir but . and ..
+template <typename Visitor>
+static void forEachEntry(int dir, Visitor visit) {
+    char buffer[32 * 1024];
+    long nread;
+    while ((nread = syscall(SYS_getdents64, dir, buffer, sizeof(buffer))) > 0) {
+        for (long pos = 0; pos < nread; ) {
+            auto* entry = reinterpret_cast<struct linux_dirent64*>(buffer + pos);
+            pos += entry->d_reclen;
+            const char* name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            visit(name, entry->d_type);
+        }
+    }
+}
+
+static bool isExecutable(int dir, const char* name, unsigned char type) {
+    if (type != DT_REG) {
+        struct stat st;
+        if (fstatat(dir, name, &st, 0) == -1 || !S_ISREG(st.st_mode)) {
+            return false;
+        }
+    }
+    return faccessat(dir, name, X_OK, 0) == 0;
+}
+
+static void shortenToCommonPrefix(std::string& common, const std::string& name) {
+    size_t length = 0;
+    while (length < common.size() && length < name.size() && common[length] == name[length]) {
+        ++length;
+    }
+    common.resize(length);
+}
+
+// CommandTrie
+
+CommandTrie::CommandTrie() : m_nodes(1) {}
+
+uint32_t CommandTrie::child(uint32_t node, char c) const {
+    const auto& children = m_nodes[node].children;
+    auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(c, static_cast<uint32_t>(0)));
+    return (it != children.end() && it->first == c) ? it->second : 0;
+}
+
+void CommandTrie::insert(const std::string& name) {
+    uint32_t node = 0;
+    for (char c : name) {
+        uint32_t next = child(node, c);
+        if (next == 0) {
+            next = m_nodes.size();
+            m_nodes.emplace_back();
+            auto& children = m_nodes[node].children;
+            children.insert(std::lower_bound(children.begin(), children.end(), std::make_pair(c, next)),
+                            std::make_pair(c, next));
+        }
+        node = next;
+    }
+    if (m_nodes[node].count++ == 0) {
+        adjustBelow(name, 1);
+    }
+}
+
+void CommandTrie::remove(const std::string& name) {
+    uint32_t node = 0;
+    for (char c : name) {
+        node = child(node, c);
+        if (node == 0) {
+            return;
+        }
+    }
+    if (m_nodes[node].count > 0 && --m_nodes[node].count == 0) {
+        adjustBelow(name, -1);
+    }
+}
+
+// Counts a name appearing or disappearing in every node on its path
+void CommandTrie::adjustBelow(const std::string& name, int delta) {
+    uint32_t node = 0;
+    m_nodes[0].below += delta;
+    for (char c : name) {
+        node = child(node, c);
+        m_nodes[node].below += delta;
+    }
+}
+
+void CommandTrie::clear() {
+    m_nodes.assign(1, Node());
+}
+
+void CommandTrie::collect(uint32_t node, std::string& name, std::vector<std::string>& out, size_t limit) const {
+    if (m_nodes[node].count > 0) {
+        out.push_back(name);
+    }
+    for (const auto& next : m_nodes[node].children) {
+        if (out.size() >= limit) {
+            return;
+        }
+        if (m_nodes[next.second].below > 0) {
+            name.push_back(next.first);
+            collect(next.second, name, out, limit);
+            name.pop_back();
+        }
+    }
+}
+
+size_t CommandTrie::complete(const std::string& prefix, std::vector<std::string>& names, size_t limit,
+                             std::string& common) const {
+    common = prefix;
+    uint32_t node = 0;
+    for (char c : prefix) {
+        node = child(node, c);
+        if (node == 0) {
+            return 0;
+        }
+    }
+    size_t total = m_nodes[node].below;
+    std::string name(prefix);
+    collect(node, name, names, limit);
+
+    // Down the single path the names share
+    while (m_nodes[node].count == 0) {
+        uint32_t only = 0;
+        char only_char = '\0';
+        for (const auto& next : m_nodes[node].children) {
+            if (m_nodes[next.second].below > 0) {
+                if (only != 0) {
+                    return total;
+                }
+                only = next.second;
+                only_char = next.first;
+            }
+        }
+        if (only == 0) {
+            break;
+        }
+        common.push_back(only_char);
+        node = only;
+    }
+    return total;
+}
+
+// Completer
+
+Completer::Completer() : m_inotifyFd(-1), m_nextScan(0) {
+    reset();
+}
+
+Completer::~Completer() {
+    if (m_inotifyFd != -1) {
+        close(m_inotifyFd);
+    }
+}
+
+// Starts over for the current $PATH, the directories are scanned later
+void Completer::reset() {
+    const char* path = getenv("PATH");
+    m_path = (path != nullptr) ? path : "";
+    if (m_inotifyFd != -1) {
+        close(m_inotifyFd);
+    }
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    m_trie.clear();
+    for (const std::string& name : AliasCommand::RESERVED_KEYWORDS) {
+        m_trie.insert(name);
+    }
+
+    m_directories.clear();
+    m_nextScan = 0;
+    size_t start = 0;
+    while (start <= m_path.size()) {
+        size_t end = m_path.find(':', start);
+        end = (end == std::string::npos) ? m_path.size() : end;
+        std::string directory = (end == start) ? "." : m_path.substr(start, end - start);
+        bool seen = false;
+        for (const Directory& existing : m_directories) {
+            seen = seen || existing.path == directory;
+        }
+        if (!seen) {
+            m_directories.push_back({directory, -1, false, {}});
+        }
+        start = end + 1;
+    }
+}
+
+void Completer::scan(Directory& directory) {
+    directory.scanned = true;
+    // Watched first, so nothing that changes during the scan is missed
+    if (m_inotifyFd != -1) {
+        directory.watch = inotify_add_watch(m_inotifyFd, directory.path.c_str(), PATH_EVENTS);
+    }
+    int dir = open(directory.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir == -1) {
+        return;
+    }
+    forEachEntry(dir, [this, dir, &directory](const char* name, unsigned char type) {
+        if (type != DT_DIR && isExecutable(dir, name, type) && directory.names.insert(name).second) {
+            m_trie.insert(name);
+        }
+    });
+    close(dir);
+}
+
+// Adds or removes name of directory, whichever it takes now
+void Completer::update(Directory& directory, const std::string& name) {
+    int dir = open(directory.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    bool executable = (dir != -1 && isExecutable(dir, name.c_str(), DT_UNKNOWN));
+    if (dir != -1) {
+        close(dir);
+    }
+    if (executable && directory.names.insert(name).second) {
+        m_trie.insert(name);
+    } else if (!executable && directory.names.erase(name) > 0) {
+        m_trie.remove(name);
+    }
+}
+
+void Completer::processEvents() {
+    if (m_inotifyFd == -1) {
+        return;
+    }
+    alignas(struct inotify_event) char buffer[16 * 1024];
+    ssize_t nread;
+    while ((nread = read(m_inotifyFd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t pos = 0; pos < nread; ) {
+            auto* event = reinterpret_cast<struct inotify_event*>(buffer + pos);
+            pos += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                reset();
+                return;
+            }
+            for (Directory& directory : m_directories) {
+                if (directory.watch != event->wd || !directory.scanned) {
+                    continue;
+                }
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    for (const std::string& name : directory.names) {
+                        m_trie.remove(name);
+                    }
+                    directory.names.clear();
+                    directory.watch = -1;
+                } else if (event->len > 0) {
+                    update(directory, event->name);
+                }
+            }
+        }
+    }
+}
+
+void Completer::refresh() {
+    const char* path = getenv("PATH");
+    if (m_path != ((path != nullptr) ? path : "")) {
+        reset();
+    } else {
+        processEvents();
+    }
+}
+
+bool Completer::buildSome() {
+    refresh();
+    if (m_nextScan < m_directories.size()) {
+        scan(m_directories[m_nextScan++]);
+    }
+    return m_nextScan < m_directories.size();
+}
+
+size_t Completer::complete(const std::string& word, bool command_name, std::vector<std::string>& candidates,
+                           std::string& common) {
+    size_t count = 0;
+    size_t slash = word.rfind('/');
+    if (command_name && slash == std::string::npos) {
+        while (buildSome()) {}
+        count = m_trie.complete(word, candidates, MAX_LISTED, common);
+        for (const auto& alias : SmallShell::getAliases()) {
+            if (alias.first.compare(0, word.size(), word) == 0 &&
+                std::find(candidates.begin(), candidates.end(), alias.first) == candidates.end()) {
+                if (count == 0) {
+                    common = alias.first;
+                }
+                shortenToCommonPrefix(common, alias.first);
+                candidates.push_back(alias.first);
+                ++count;
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        if (count == 1) {
+            common += ' ';
+        }
+        return count;
+    }
+
+    // A file name, only hidden files when asked for
+    std::string directory = (slash == std::string::npos) ? "." : word.substr(0, slash + 1);
+    std::string prefix = (slash == std::string::npos) ? word : word.substr(slash + 1);
+    int dir = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir == -1) {
+        common = word;
+        return 0;
+    }
+    std::string shared;
+    forEachEntry(dir, [&](const char* name, unsigned char type) {
+        if (strncmp(name, prefix.c_str(), prefix.size()) != 0 || (name[0] == '.' && prefix.empty())) {
+            return;
+        }
+        std::string candidate(name);
+        struct stat st;
+        if (type == DT_DIR || ((type == DT_LNK || type == DT_UNKNOWN) && fstatat(dir, name, &st, 0) == 0 &&
+                               S_ISDIR(st.st_mode))) {
+            candidate += '/';
+        }
+        if (count == 0) {
+            shared = candidate;
+        }
+        shortenToCommonPrefix(shared, candidate);
+        if (candidates.size() < MAX_LISTED) {
+            candidates.push_back(candidate);
+        }
+        ++count;
+    });
+    close(dir);
+    std::sort(candidates.begin(), candidates.end());
+
+    common = (slash == std::string::npos) ? "" : directory;
+    common += (count == 0) ? prefix : shared;
+    if (count == 1 && common.back() != '/') {
+        common += ' ';
+    }
+    return count;
+}
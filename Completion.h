@@ -0,0 +1,92 @@
+#ifndef SMASH_COMPLETION_H_
+#define SMASH_COMPLETION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/*
+ * Command names by prefix. A name may be inserted several times (the same executable in several
+ * PATH directories) and is counted, and every node counts the distinct names below it, so removing
+ * a name is O(length) and completion skips the subtrees that emptied.
+ */
+class CommandTrie {
+    struct Node {
+        std::vector<std::pair<char, uint32_t>> children;    // Sorted by character
+        uint32_t count = 0;     // Of the name ending here
+        uint32_t below = 0;     // Distinct names ending in the subtree, here included
+    };
+
+    std::vector<Node> m_nodes;
+
+    uint32_t child(uint32_t node, char c) const;
+    void adjustBelow(const std::string& name, int delta);
+    void collect(uint32_t node, std::string& name, std::vector<std::string>& out, size_t limit) const;
+
+public:
+    CommandTrie();
+
+    void insert(const std::string& name);
+    void remove(const std::string& name);
+    void clear();
+    /*
+     * Appends the names starting with prefix (at most limit of them) to names and returns how many
+     * there are. common is set to the longest prefix they all share.
+     */
+    size_t complete(const std::string& prefix, std::vector<std::string>& names, size_t limit,
+                    std::string& common) const;
+};
+
+/*
+ * Completes the word before the cursor: command names (built-ins, aliases and the executables on
+ * $PATH) for the first word of a command, file names (read with getdents64) for the others.
+ * The executables are scanned one PATH directory at a time while the shell waits for input
+ * (buildSome()) and kept current through inotify watches on the directories, so completing a
+ * command name never reads a directory. A change of $PATH starts over.
+ */
+class Completer {
+public:
+    static const size_t MAX_LISTED = 200;
+
+private:
+    struct Directory {
+        std::string path;
+        int watch;
+        bool scanned;
+        std::unordered_set<std::string> names;
+    };
+
+    CommandTrie m_trie;
+    std::string m_path;
+    std::vector<Directory> m_directories;
+    int m_inotifyFd;
+    size_t m_nextScan;
+
+    void reset();
+    void scan(Directory& directory);
+    void update(Directory& directory, const std::string& name);
+    void processEvents();
+    void refresh();
+
+public:
+    Completer();
+    ~Completer();
+    Completer(Completer const &) = delete;
+    void operator=(Completer const &) = delete;
+
+    // Scans the next PATH directory, false when all are scanned
+    bool buildSome();
+
+    /*
+     * The candidates for word (the part of it before the cursor), at most MAX_LISTED of them, and
+     * their count. common is set to their longest common prefix, with a ' ' (or a '/' for a
+     * directory) appended when there is only one.
+     */
+    size_t complete(const std::string& word, bool command_name, std::vector<std::string>& candidates,
+                    std::string& common);
+};
+
+#endif //SMASH_COMPLETION_H_
@@ -0,0 +1,260 @@
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "FdStream.h"
+
+FdStreamBuf::FdStreamBuf(int fd) : m_fd(fd) {
+    setp(m_buffer, m_buffer + sizeof(m_buffer));
+}
+
+FdStreamBuf::~FdStreamBuf() {
+    flushBuffer();
+}
+
+bool FdStreamBuf::flushBuffer() {
+    const char* pos = pbase();
+    while (pos < pptr()) {
+        ssize_t written = write(m_fd, pos, pptr() - pos);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // The reader is gone (EPIPE) or the file is not writable - drop the output
+            setp(m_buffer, m_buffer + sizeof(m_buffer));
+            return false;
+        }
+        pos += written;
+    }
+    setp(m_buffer, m_buffer + sizeof(m_buffer));
+    return true;
+}
+
+int FdStreamBuf::overflow(int c) {
+    if (!flushBuffer()) {
+        return traits_type::eof();
+    }
+    if (c != traits_type::eof()) {
+        *pptr() = static_cast<char>(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int FdStreamBuf::sync() {
+    return flushBuffer() ? 0 : -1;
+}
+
+FdOutputStream::FdOutputStream(int fd) : std::ostream(nullptr), m_buf(fd) {
+    rdbuf(&m_buf);
+}
+
+int FdStreamBuf::fd() const {
+    return m_fd;
+}
+
+int FdOutputStream::fd() const {
+    return m_buf.fd();
+}
+
+// Zero-copy helpers
+
+static const size_t COPY_CHUNK_SIZE = 1 << 20;
+
+static bool isPipe(int fd) {
+    struct stat sb;
+    return fstat(fd, &sb) == 0 && S_ISFIFO(sb.st_mode);
+}
+
+static bool isRegularFile(int fd) {
+    struct stat sb;
+    return fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode);
+}
+
+// The kernel cannot do the transfer for this pair of files, the caller should copy by hand
+static bool isUnsupported(int error) {
+    return error == EINVAL || error == EXDEV || error == ENOSYS || error == EOPNOTSUPP || error == EBADF;
+}
+
+static bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+static bool copyWithReadWrite(int in_fd, const std::vector<int>& out_fds) {
+    char buffer[64 * 1024];
+    while (true) {
+        ssize_t bytes = read(in_fd, buffer, sizeof(buffer));
+        if (bytes == 0) {
+            return true;
+        }
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        for (int out_fd : out_fds) {
+            if (!writeAll(out_fd, buffer, bytes)) {
+                return false;
+            }
+        }
+    }
+}
+
+// Moves exactly len bytes from the pipe in_fd to out_fd
+static bool spliceAll(int in_fd, int out_fd, size_t len) {
+    while (len > 0) {
+        ssize_t moved = splice(in_fd, nullptr, out_fd, nullptr, len, SPLICE_F_MOVE);
+        if (moved == -1 && errno == EINTR) {
+            continue;
+        }
+        if (moved == -1 && isUnsupported(errno)) {
+            // Drain what is already in the pipe by hand
+            char buffer[64 * 1024];
+            while (len > 0) {
+                ssize_t bytes = read(in_fd, buffer, std::min(len, sizeof(buffer)));
+                if (bytes <= 0 || !writeAll(out_fd, buffer, bytes)) {
+                    return false;
+                }
+                len -= bytes;
+            }
+            return true;
+        }
+        if (moved <= 0) {
+            return false;
+        }
+        len -= moved;
+    }
+    return true;
+}
+
+bool copyFd(int in_fd, int out_fd) {
+    std::vector<int> out_fds(1, out_fd);
+
+    if (isRegularFile(in_fd) && isRegularFile(out_fd)) {
+        while (true) {
+            ssize_t copied = copy_file_range(in_fd, nullptr, out_fd, nullptr, COPY_CHUNK_SIZE, 0);
+            if (copied == 0) {
+                return true;
+            }
+            if (copied == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (isUnsupported(errno)) {
+                    return copyWithReadWrite(in_fd, out_fds);
+                }
+                return false;
+            }
+        }
+    }
+
+    if (isPipe(in_fd) || isPipe(out_fd)) {
+        while (true) {
+            ssize_t moved = splice(in_fd, nullptr, out_fd, nullptr, COPY_CHUNK_SIZE, SPLICE_F_MOVE);
+            if (moved == 0) {
+                return true;
+            }
+            if (moved == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (isUnsupported(errno)) {
+                    return copyWithReadWrite(in_fd, out_fds);
+                }
+                return false;
+            }
+        }
+    }
+
+    // Neither side is a pipe (e.g. file to terminal) - splice through an intermediate pipe
+    int middle[2];
+    if (pipe2(middle, O_CLOEXEC) == -1) {
+        return copyWithReadWrite(in_fd, out_fds);
+    }
+    bool success = true;
+    while (true) {
+        ssize_t moved = splice(in_fd, nullptr, middle[1], nullptr, COPY_CHUNK_SIZE, SPLICE_F_MOVE);
+        if (moved == 0) {
+            break;
+        }
+        if (moved == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            success = isUnsupported(errno) && copyWithReadWrite(in_fd, out_fds);
+            break;
+        }
+        if (!spliceAll(middle[0], out_fd, moved)) {
+            success = false;
+            break;
+        }
+    }
+    int saved_errno = errno;
+    close(middle[0]);
+    close(middle[1]);
+    errno = saved_errno;
+    return success;
+}
+
+/*
+ * With a pipe as input, tee(2) duplicates the pending data into a scratch pipe for every output
+ * but the last one, which finally consumes it with splice().
+ */
+bool teeFd(int in_fd, const std::vector<int>& out_fds) {
+    if (out_fds.empty()) {
+        return copyWithReadWrite(in_fd, out_fds);
+    }
+    if (out_fds.size() == 1) {
+        return copyFd(in_fd, out_fds[0]);
+    }
+    if (!isPipe(in_fd)) {
+        return copyWithReadWrite(in_fd, out_fds);
+    }
+
+    int scratch[2];
+    if (pipe2(scratch, O_CLOEXEC) == -1) {
+        return copyWithReadWrite(in_fd, out_fds);
+    }
+    bool success = true;
+    while (success) {
+        // Blocks until data is available, the amount duplicated now is what every output gets
+        ssize_t pending = tee(in_fd, scratch[1], COPY_CHUNK_SIZE, 0);
+        if (pending == -1 && errno == EINTR) {
+            continue;
+        }
+        if (pending == -1) {
+            success = false;
+            if (isUnsupported(errno)) {
+                success = copyWithReadWrite(in_fd, out_fds);
+            }
+            break;
+        }
+        if (pending == 0) {
+            break;
+        }
+        success = spliceAll(scratch[0], out_fds[0], pending);
+        for (size_t i = 1; success && i + 1 < out_fds.size(); ++i) {
+            ssize_t duplicated = tee(in_fd, scratch[1], pending, 0);
+            success = (duplicated == pending) && spliceAll(scratch[0], out_fds[i], pending);
+        }
+        success = success && spliceAll(in_fd, out_fds.back(), pending);
+    }
+    int saved_errno = errno;
+    close(scratch[0]);
+    close(scratch[1]);
+    errno = saved_errno;
+    return success;
+}
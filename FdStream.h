@@ -0,0 +1,50 @@
+#ifndef SMASH_FD_STREAM_H_
+#define SMASH_FD_STREAM_H_
+
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+/*
+ * std::ostream writing straight to a file descriptor.
+ * Lets built-in commands print into a pipe or a redirection target
+ * without touching the shell's own stdout. The shell's std::cout writes through one as well.
+ * Output is buffered: write() is called when the buffer fills and on flush(), never per line.
+ * Built-ins end their lines with '\n' and the shell flushes before the prompt, before a child
+ * is started and on exit (std::endl is kept for lines that must show up while the shell waits).
+ */
+class FdStreamBuf : public std::streambuf {
+    int m_fd;
+    char m_buffer[16 * 1024];
+    bool flushBuffer();
+
+protected:
+    int overflow(int c) override;
+    int sync() override;
+
+public:
+    explicit FdStreamBuf(int fd);
+    ~FdStreamBuf() override;
+    int fd() const;
+};
+
+class FdOutputStream : public std::ostream {
+    FdStreamBuf m_buf;
+public:
+    explicit FdOutputStream(int fd);
+    ~FdOutputStream() override = default;
+    int fd() const;
+};
+
+/*
+ * Copies everything readable from in_fd to out_fd without going through user space when the
+ * kernel allows it: copy_file_range() between regular files, splice() when one side is a pipe
+ * (or through an intermediate pipe otherwise). Falls back to read()/write().
+ * Returns false (with errno set) on failure.
+ */
+bool copyFd(int in_fd, int out_fd);
+
+// Like copyFd, duplicating the input to every descriptor in out_fds (tee(2) when in_fd is a pipe)
+bool teeFd(int in_fd, const std::vector<int>& out_fds);
+
+#endif //SMASH_FD_STREAM_H_
@@ -0,0 +1,298 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iomanip>
+#include "History.h"
+
+static const char HISTORY_MAGIC[8] = {'S', 'M', 'H', 'I', 'S', 'T', '1', '\n'};
+static const size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+static const size_t INITIAL_TEXT_TABLE_SIZE = 1024;
+
+const uint32_t History::NONE;
+
+static size_t paddedLength(size_t length) {
+    return (length + 3) & ~static_cast<size_t>(3);
+}
+
+// FNV-1a
+static uint32_t hashText(const char* text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<unsigned char>(text[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// The bucket of the trigram at text. Trigrams sharing a bucket only cost a few more candidates.
+static size_t trigramBucket(const char* text, size_t buckets) {
+    uint32_t trigram = (static_cast<uint32_t>(static_cast<unsigned char>(text[0])) << 16) |
+                       (static_cast<uint32_t>(static_cast<unsigned char>(text[1])) << 8) |
+                       static_cast<unsigned char>(text[2]);
+    return (trigram * 2654435761u) >> 15 & (buckets - 1);
+}
+
+History::History() : m_fd(-1), m_map(nullptr), m_mapSize(0), m_indexed(0),
+        m_textTable(INITIAL_TEXT_TABLE_SIZE, NONE), m_trigrams(TRIGRAM_BUCKETS), m_matchedTexts(0) {
+    const char* path = getenv("SMASH_HISTORY");
+    const char* home = getenv("HOME");
+    if (path != nullptr && *path != '\0') {
+        m_path = path;
+    } else if (home != nullptr) {
+        m_path = std::string(home) + "/.smash_history";
+    }
+}
+
+History::~History() {
+    if (m_map != nullptr) {
+        munmap(const_cast<char*>(m_map), m_mapSize);
+    }
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+/*
+ * Opens the file for appending, creating it when missing. A new file gets its magic before it
+ * appears under its name (linked into place), so no shell ever sees it without one.
+ */
+bool History::openFile() {
+    if (m_fd != -1) {
+        return true;
+    }
+    if (m_path.empty()) {
+        return false;
+    }
+    m_fd = open(m_path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if (m_fd == -1 && errno == ENOENT) {
+        std::string temporary_path = m_path + ".tmp" + std::to_string(getpid());
+        int fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd != -1) {
+            if (write(fd, HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) == sizeof(HISTORY_MAGIC)) {
+                // Fails when another shell created it first, which is just as good
+                link(temporary_path.c_str(), m_path.c_str());
+            }
+            close(fd);
+            unlink(temporary_path.c_str());
+        }
+        m_fd = open(m_path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    }
+    return m_fd != -1;
+}
+
+void History::add(const char* line) {
+    size_t length = strlen(line);
+    if (strspn(line, " \t") == length || !openFile()) {
+        return;
+    }
+    uint32_t header[2] = {static_cast<uint32_t>(length), static_cast<uint32_t>(time(nullptr))};
+    std::string record(reinterpret_cast<const char*>(header), sizeof(header));
+    record.append(line, length);
+    record.append(paddedLength(record.size()) - record.size(), '\0');
+    if (write(m_fd, record.data(), record.size()) == -1) {
+        perror("smash error: write failed");
+    }
+}
+
+// Maps what the file holds now
+void History::remap() {
+    struct stat st;
+    if (!openFile() || fstat(m_fd, &st) == -1) {
+        return;
+    }
+    size_t size = st.st_size;
+    if (size == m_mapSize) {
+        return;
+    }
+    if (m_map != nullptr) {
+        munmap(const_cast<char*>(m_map), m_mapSize);
+        m_map = nullptr;
+        m_mapSize = 0;
+    }
+    if (size < m_indexed) {
+        // Replaced or truncated behind our back, start over
+        m_indexed = 0;
+        m_entries.clear();
+        m_texts.clear();
+        m_textTable.assign(INITIAL_TEXT_TABLE_SIZE, NONE);
+        m_trigrams.assign(TRIGRAM_BUCKETS, std::vector<uint32_t>());
+        m_lastPattern.clear();
+    }
+    if (size == 0) {
+        return;
+    }
+    void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (map == MAP_FAILED) {
+        perror("smash error: mmap failed");
+        return;
+    }
+    m_map = static_cast<const char*>(map);
+    m_mapSize = size;
+
+    if (m_indexed == 0 && size >= sizeof(HISTORY_MAGIC) &&
+        memcmp(m_map, HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) == 0) {
+        m_indexed = sizeof(HISTORY_MAGIC);
+    }
+}
+
+bool History::indexSome(size_t records) {
+    remap();
+    if (m_indexed == 0) {
+        return false;
+    }
+    // A record that is not complete yet is left for later
+    for (size_t i = 0; i < records && m_mapSize - m_indexed >= RECORD_HEADER_SIZE; i++) {
+        uint32_t header[2];
+        memcpy(header, m_map + m_indexed, sizeof(header));
+        size_t record_size = paddedLength(RECORD_HEADER_SIZE + header[0]);
+        if (record_size > m_mapSize - m_indexed) {
+            return false;
+        }
+        indexRecord(m_indexed + RECORD_HEADER_SIZE, header[0], header[1]);
+        m_indexed += record_size;
+    }
+    return m_mapSize - m_indexed >= RECORD_HEADER_SIZE;
+}
+
+// Maps what the file holds now and indexes the records that are new
+void History::refresh() {
+    indexSome(SIZE_MAX);
+}
+
+void History::indexRecord(uint64_t offset, uint32_t length, uint32_t time) {
+    m_entries.push_back({internText(offset, length), time});
+}
+
+// The index of the text at offset, added (and indexed by trigram) when it is new
+uint32_t History::internText(uint64_t offset, uint32_t length) {
+    const char* text = m_map + offset;
+    uint32_t hash = hashText(text, length);
+    size_t mask = m_textTable.size() - 1;
+    size_t slot = hash & mask;
+    for (; m_textTable[slot] != NONE; slot = (slot + 1) & mask) {
+        const Text& existing = m_texts[m_textTable[slot]];
+        if (existing.hash == hash && existing.length == length &&
+            memcmp(m_map + existing.offset, text, length) == 0) {
+            return m_textTable[slot];
+        }
+    }
+
+    uint32_t index = m_texts.size();
+    m_texts.push_back({offset, length, hash});
+    m_textTable[slot] = index;
+    for (uint32_t i = 0; i + 3 <= length; i++) {
+        std::vector<uint32_t>& texts = m_trigrams[trigramBucket(text + i, TRIGRAM_BUCKETS)];
+        if (texts.empty() || texts.back() != index) {
+            texts.push_back(index);
+        }
+    }
+    // At most half full, so probe sequences stay short
+    if (m_texts.size() * 2 > m_textTable.size()) {
+        growTextTable();
+    }
+    return index;
+}
+
+void History::growTextTable() {
+    m_textTable.assign(m_textTable.size() * 2, NONE);
+    size_t mask = m_textTable.size() - 1;
+    for (uint32_t index = 0; index < m_texts.size(); index++) {
+        size_t slot = m_texts[index].hash & mask;
+        while (m_textTable[slot] != NONE) {
+            slot = (slot + 1) & mask;
+        }
+        m_textTable[slot] = index;
+    }
+}
+
+const char* History::textOf(const Entry& entry) const {
+    return m_map + m_texts[entry.text].offset;
+}
+
+// Sets m_matches to the texts that contain pattern
+void History::match(const std::string& pattern) {
+    if (pattern == m_lastPattern && m_matchedTexts == m_texts.size()) {
+        return;
+    }
+    m_lastPattern = pattern;
+    m_matchedTexts = m_texts.size();
+    m_matches.assign(m_texts.size(), false);
+
+    // Only the texts in the bucket of the pattern's rarest trigram can hold the pattern
+    const std::vector<uint32_t>* candidates = nullptr;
+    for (size_t i = 0; i + 3 <= pattern.size(); i++) {
+        const std::vector<uint32_t>& texts = m_trigrams[trigramBucket(pattern.data() + i, TRIGRAM_BUCKETS)];
+        if (candidates == nullptr || texts.size() < candidates->size()) {
+            candidates = &texts;
+        }
+    }
+    auto check = [this, &pattern](uint32_t index) {
+        const Text& text = m_texts[index];
+        if (memmem(m_map + text.offset, text.length, pattern.data(), pattern.size()) != nullptr) {
+            m_matches[index] = true;
+        }
+    };
+    if (candidates != nullptr) {
+        for (uint32_t index : *candidates) {
+            check(index);
+        }
+    } else {
+        for (uint32_t index = 0; index < m_texts.size(); index++) {
+            check(index);
+        }
+    }
+}
+
+size_t History::size() {
+    refresh();
+    return m_entries.size();
+}
+
+bool History::get(size_t index, std::string& line) {
+    refresh();
+    if (index >= m_entries.size()) {
+        return false;
+    }
+    line.assign(textOf(m_entries[index]), m_texts[m_entries[index].text].length);
+    return true;
+}
+
+void History::print(std::ostream& out, size_t count) {
+    refresh();
+    size_t first = (count == 0 || count >= m_entries.size()) ? 0 : m_entries.size() - count;
+    for (size_t i = first; i < m_entries.size(); i++) {
+        out << std::setw(5) << i + 1 << "  ";
+        out.write(textOf(m_entries[i]), m_texts[m_entries[i].text].length);
+        out << '\n';
+    }
+}
+
+void History::search(std::ostream& out, const std::string& pattern) {
+    refresh();
+    match(pattern);
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        if (m_matches[m_entries[i].text]) {
+            out << std::setw(5) << i + 1 << "  ";
+            out.write(textOf(m_entries[i]), m_texts[m_entries[i].text].length);
+            out << '\n';
+        }
+    }
+}
+
+long History::findBefore(const std::string& pattern, long before, std::string& line) {
+    refresh();
+    match(pattern);
+    size_t end = (before < 0 || static_cast<size_t>(before) > m_entries.size()) ? m_entries.size() : before;
+    for (size_t i = end; i-- > 0; ) {
+        if (m_matches[m_entries[i].text]) {
+            line.assign(textOf(m_entries[i]), m_texts[m_entries[i].text].length);
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,86 @@
+#ifndef SMASH_HISTORY_H_
+#define SMASH_HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Command history, shared by every shell through one append-only file ($SMASH_HISTORY, by default
+ * ~/.smash_history): HISTORY_MAGIC, then one record per line - its length and time (uint32_t
+ * each), the text and padding to 4 bytes. Every record is appended with a single O_APPEND write,
+ * so records of concurrent shells never interleave.
+ *
+ * Nothing is read at startup. An interactive shell indexes the file a chunk at a time while it
+ * waits for input (indexSome()), and every lookup first remaps the file and indexes what is left,
+ * so only the records appended since (by any shell) cost anything. Identical lines share one
+ * text, and a trigram index over the distinct texts narrows a search to the texts holding the
+ * pattern's rarest trigram, so it does not scan the file.
+ */
+class History {
+    static const uint32_t NONE = UINT32_MAX;
+    static const size_t TRIGRAM_BUCKETS = 1 << 17;
+
+    struct Entry {
+        uint32_t text;      // Index in m_texts
+        uint32_t time;
+    };
+
+    struct Text {
+        uint64_t offset;    // Of its first occurrence in the file
+        uint32_t length;
+        uint32_t hash;      // Compared before the text, which is likely not in the cache
+    };
+
+    std::string m_path;
+    int m_fd;
+    const char* m_map;
+    size_t m_mapSize;
+    size_t m_indexed;                           // The file is indexed up to there
+    std::vector<Entry> m_entries;
+    std::vector<Text> m_texts;
+    std::vector<uint32_t> m_textTable;          // Open addressing, indices in m_texts (NONE if empty)
+    // Per trigram hash, the texts holding a trigram of that hash, ascending. All TRIGRAM_BUCKETS
+    // exist from the constructor on, and are emptied when the file is replaced.
+    std::vector<std::vector<uint32_t>> m_trigrams;
+    // The texts that matched the last pattern, reverse search steps through them
+    std::string m_lastPattern;
+    std::vector<bool> m_matches;
+    size_t m_matchedTexts;
+
+    bool openFile();
+    void remap();
+    void refresh();
+    void indexRecord(uint64_t offset, uint32_t length, uint32_t time);
+    uint32_t internText(uint64_t offset, uint32_t length);
+    void growTextTable();
+    void match(const std::string& pattern);
+    const char* textOf(const Entry& entry) const;
+
+public:
+    History();
+    ~History();
+    History(History const &) = delete;
+    void operator=(History const &) = delete;
+
+    void add(const char* line);
+    // Indexes at most records more records, returns false when there is nothing left to index
+    bool indexSome(size_t records);
+    // The number of entries, from every shell
+    size_t size();
+    // Sets line to the entry at index, false if there is none
+    bool get(size_t index, std::string& line);
+    // Prints the last count entries (all of them if count is 0) numbered from 1, as bash does
+    void print(std::ostream& out, size_t count);
+    // Prints the entries containing pattern
+    void search(std::ostream& out, const std::string& pattern);
+    /*
+     * Reverse search: the index of the newest entry containing pattern that comes before the
+     * entry at before (any entry when before is -1), -1 if none. Its text is stored in line.
+     */
+    long findBefore(const std::string& pattern, long before, std::string& line);
+};
+
+#endif //SMASH_HISTORY_H_
@@ -0,0 +1,338 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <algorithm>
+#include <new>
+#include <unordered_map>
+#include "JobLog.h"
+
+static const size_t READ_SIZE = 16 * 1024;
+// Reads per log in one drain(), so a job writing nonstop cannot keep the shell busy
+static const int MAX_DRAIN_READS = 16;
+
+// An unlinked file in $TMPDIR (or /tmp), or -1
+static int createSpillFile() {
+    const char* dir = getenv("TMPDIR");
+    if (dir == nullptr || *dir == '\0') {
+        dir = "/tmp";
+    }
+    int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd != -1) {
+        return fd;
+    }
+    // File systems without O_TMPFILE
+    std::string path = std::string(dir) + "/smash-joblog-XXXXXX";
+    fd = mkostemp(&path[0], O_CLOEXEC);
+    if (fd != -1) {
+        unlink(path.c_str());
+    }
+    return fd;
+}
+
+// JobLog class
+
+JobLog::JobLog(int job_id, std::string cmd_line, int fd) : m_jobId(job_id), m_cmdLine(std::move(cmd_line)),
+        m_fd(fd), m_ring(nullptr), m_ringStart(0), m_ringSize(0), m_spillFd(-1), m_spilled(0),
+        m_dropped(0), m_total(0) {}
+
+JobLog::~JobLog() {
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+    if (m_spillFd != -1) {
+        close(m_spillFd);
+    }
+    free(m_ring);
+}
+
+int JobLog::getJobID() const {
+    return m_jobId;
+}
+
+int JobLog::fd() const {
+    return m_fd;
+}
+
+bool JobLog::isOpen() const {
+    return m_fd != -1;
+}
+
+ssize_t JobLog::readSome(char* buffer, size_t size) {
+    if (m_fd == -1) {
+        return 0;
+    }
+    ssize_t bytes;
+    do {
+        bytes = read(m_fd, buffer, size);
+    } while (bytes == -1 && errno == EINTR);
+
+    if (bytes == -1 && errno == EAGAIN) {
+        return -1;
+    }
+    if (bytes <= 0) {
+        close(m_fd);
+        m_fd = -1;
+        return 0;
+    }
+    append(buffer, bytes);
+    return bytes;
+}
+
+void JobLog::append(const char* data, size_t length) {
+    if (m_ring == nullptr) {
+        m_ring = static_cast<char*>(malloc(RING_SIZE));
+        if (m_ring == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+    m_total += length;
+
+    // Only the newest RING_SIZE bytes can stay in memory
+    if (length > RING_SIZE) {
+        evict(m_ringSize);
+        spill(data, length - RING_SIZE);
+        data += length - RING_SIZE;
+        length = RING_SIZE;
+    }
+    if (m_ringSize + length > RING_SIZE) {
+        evict(m_ringSize + length - RING_SIZE);
+    }
+
+    size_t end = (m_ringStart + m_ringSize) % RING_SIZE;
+    size_t first = std::min(length, RING_SIZE - end);
+    memcpy(m_ring + end, data, first);
+    memcpy(m_ring, data + first, length - first);
+    m_ringSize += length;
+}
+
+// Moves the oldest length bytes of the ring to the spill file
+void JobLog::evict(size_t length) {
+    size_t first = std::min(length, RING_SIZE - m_ringStart);
+    spill(m_ring + m_ringStart, first);
+    spill(m_ring, length - first);
+    m_ringStart = (m_ringStart + length) % RING_SIZE;
+    m_ringSize -= length;
+}
+
+void JobLog::spill(const char* data, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    // Once something was dropped everything older than the ring is, to keep the log in order
+    if (m_dropped == 0 && m_spilled + length <= MAX_SPILL_SIZE) {
+        if (m_spillFd == -1 && m_spilled == 0) {
+            m_spillFd = createSpillFile();
+        }
+        size_t written = 0;
+        while (m_spillFd != -1 && written < length) {
+            ssize_t bytes = pwrite(m_spillFd, data + written, length - written, m_spilled + written);
+            if (bytes == -1 && errno == EINTR) {
+                continue;
+            }
+            if (bytes <= 0) {
+                break;
+            }
+            written += bytes;
+        }
+        if (written == length) {
+            m_spilled += length;
+            return;
+        }
+    }
+    m_dropped += length;
+}
+
+void JobLog::writeTo(std::ostream& out) const {
+    char buffer[READ_SIZE];
+    size_t offset = 0;
+    while (offset < m_spilled) {
+        ssize_t bytes = pread(m_spillFd, buffer, std::min(sizeof(buffer), m_spilled - offset), offset);
+        if (bytes == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            perror("smash error: pread failed");
+            break;
+        }
+        out.write(buffer, bytes);
+        offset += bytes;
+    }
+    if (m_dropped > 0) {
+        out << "[... " << m_dropped << " bytes dropped ...]" << '\n';
+    }
+
+    if (m_ringSize > 0) {
+        size_t first = std::min(m_ringSize, RING_SIZE - m_ringStart);
+        out.write(m_ring + m_ringStart, first);
+        out.write(m_ring, m_ringSize - first);
+    }
+}
+
+void JobLog::printSummary(std::ostream& out) const {
+    out << "[" << m_jobId << "] " << m_cmdLine << " : " << m_total << " bytes "
+        << (isOpen() ? "running" : "done") << '\n';
+}
+
+// JobLogs class
+
+JobLogs::JobLogs() : m_capture(false) {}
+
+bool JobLogs::isCapturing() const {
+    return m_capture;
+}
+
+void JobLogs::setCapturing(bool capture) {
+    m_capture = capture;
+}
+
+void JobLogs::add(int job_id, const std::string& cmd_line, int fd) {
+    // The shell drains the pipe without blocking
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    // A reused job-id replaces the log of the finished job
+    for (auto it = m_logs.begin(); it != m_logs.end(); ++it) {
+        if ((*it)->getJobID() == job_id) {
+            m_logs.erase(it);
+            break;
+        }
+    }
+    m_logs.emplace_back(new JobLog(job_id, cmd_line, fd));
+    removeOldFinished();
+}
+
+void JobLogs::removeOldFinished() {
+    size_t finished = std::count_if(m_logs.begin(), m_logs.end(),
+                                    [](const std::unique_ptr<JobLog>& log) { return !log->isOpen(); });
+    for (auto it = m_logs.begin(); it != m_logs.end() && finished > MAX_FINISHED_LOGS; ) {
+        if (!(*it)->isOpen()) {
+            it = m_logs.erase(it);
+            finished--;
+        } else {
+            ++it;
+        }
+    }
+}
+
+JobLog* JobLogs::find(int job_id) const {
+    for (const auto& log : m_logs) {
+        if (log->getJobID() == job_id) {
+            return log.get();
+        }
+    }
+    return nullptr;
+}
+
+void JobLogs::printSummaries(std::ostream& out) const {
+    for (const auto& log : m_logs) {
+        log->printSummary(out);
+    }
+}
+
+void JobLogs::drain() {
+    char buffer[READ_SIZE];
+    for (const auto& log : m_logs) {
+        for (int i = 0; i < MAX_DRAIN_READS && log->readSome(buffer, sizeof(buffer)) > 0; i++) {}
+    }
+    removeOldFinished();
+}
+
+bool JobLogs::waitForInput(int fd, int wake_fd) {
+    char buffer[READ_SIZE];
+    std::vector<struct pollfd> pollfds;
+    std::vector<JobLog*> polled;
+    while (true) {
+        pollfds.assign(1, {fd, POLLIN, 0});
+        pollfds.push_back({wake_fd, POLLIN, 0});
+        polled.clear();
+        for (const auto& log : m_logs) {
+            if (log->isOpen()) {
+                pollfds.push_back({log->fd(), POLLIN, 0});
+                polled.push_back(log.get());
+            }
+        }
+        if (polled.empty() && wake_fd == -1) {
+            return true;
+        }
+
+        if (poll(pollfds.data(), pollfds.size(), -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("smash error: poll failed");
+            return true;
+        }
+        for (size_t i = 0; i < polled.size(); i++) {
+            if (pollfds[i + 2].revents != 0) {
+                polled[i]->readSome(buffer, sizeof(buffer));
+            }
+        }
+        if (pollfds[0].revents != 0) {
+            removeOldFinished();
+            return true;
+        }
+        if (pollfds[1].revents != 0) {
+            return false;
+        }
+    }
+}
+
+void JobLogs::follow(JobLog* log, std::ostream& out) {
+    char buffer[READ_SIZE];
+    std::vector<struct pollfd> pollfds;
+    std::vector<JobLog*> polled;
+    // Jobs whose last output did not end with a newline, their next output gets no prefix
+    std::unordered_map<int, bool> mid_line;
+    while (true) {
+        pollfds.clear();
+        polled.clear();
+        for (const auto& other : m_logs) {
+            if (other->isOpen()) {
+                pollfds.push_back({other->fd(), POLLIN, 0});
+                polled.push_back(other.get());
+            }
+        }
+        if (log != nullptr ? !log->isOpen() : polled.empty()) {
+            return;
+        }
+
+        // What was printed so far shows up before the wait
+        out.flush();
+        if (poll(pollfds.data(), pollfds.size(), -1) == -1) {
+            if (errno != EINTR) {
+                perror("smash error: poll failed");
+            }
+            return; // ctrl-C stops following
+        }
+        for (size_t i = 0; i < polled.size(); i++) {
+            if (pollfds[i].revents == 0) {
+                continue;
+            }
+            ssize_t bytes = polled[i]->readSome(buffer, sizeof(buffer));
+            if (bytes <= 0 || (log != nullptr && polled[i] != log)) {
+                continue;
+            }
+            if (log != nullptr) {
+                out.write(buffer, bytes);
+                continue;
+            }
+
+            bool& in_line = mid_line[polled[i]->getJobID()];
+            const char* current = buffer;
+            const char* end = buffer + bytes;
+            while (current < end) {
+                if (!in_line) {
+                    out << "[" << polled[i]->getJobID() << "] ";
+                }
+                const char* newline = static_cast<const char*>(memchr(current, '\n', end - current));
+                const char* next = (newline != nullptr) ? newline + 1 : end;
+                out.write(current, next - current);
+                in_line = (newline == nullptr);
+                current = next;
+            }
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef SMASH_JOB_LOG_H_
+#define SMASH_JOB_LOG_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Output of one captured background job (joblog --capture).
+ * The job writes its stdout and stderr into a pipe that the shell drains. The newest
+ * RING_SIZE bytes are kept in memory, older ones spill to an unlinked temporary file of
+ * at most MAX_SPILL_SIZE bytes, past which they are dropped (and counted).
+ */
+class JobLog {
+    static const size_t RING_SIZE = 8 * 1024;
+    static const size_t MAX_SPILL_SIZE = 4 * 1024 * 1024;
+
+    int m_jobId;
+    std::string m_cmdLine;
+    int m_fd;
+    char* m_ring;
+    size_t m_ringStart;
+    size_t m_ringSize;
+    int m_spillFd;
+    size_t m_spilled;
+    size_t m_dropped;
+    size_t m_total;
+
+    void append(const char* data, size_t length);
+    void evict(size_t length);
+    void spill(const char* data, size_t length);
+
+public:
+    JobLog(int job_id, std::string cmd_line, int fd);
+    ~JobLog();
+    JobLog(JobLog const &) = delete;
+    void operator=(JobLog const &) = delete;
+
+    int getJobID() const;
+    // The read end of the job's pipe, -1 once every writer closed it
+    int fd() const;
+    bool isOpen() const;
+
+    /*
+     * Reads once from the pipe and stores the data. Returns the number of bytes read
+     * (the data is left in buffer too), 0 at end of file or -1 when nothing is available.
+     */
+    ssize_t readSome(char* buffer, size_t size);
+
+    // Prints everything kept so far
+    void writeTo(std::ostream& out) const;
+    // Prints "[<job-id>] <command> : <bytes> bytes <running|done>"
+    void printSummary(std::ostream& out) const;
+};
+
+/*
+ * The logs of the captured background jobs. They are drained while the shell waits for its
+ * next command line (see waitForInput) and whenever the jobs list is updated, so a job only
+ * blocks on a full pipe while a foreground command runs.
+ * Logs of finished jobs stay until their job-id is reused, at most MAX_FINISHED_LOGS of them.
+ */
+class JobLogs {
+    static const size_t MAX_FINISHED_LOGS = 64;
+
+    std::vector<std::unique_ptr<JobLog>> m_logs;
+    bool m_capture;
+
+    void removeOldFinished();
+
+public:
+    JobLogs();
+    ~JobLogs() = default;
+    JobLogs(JobLogs const &) = delete;
+    void operator=(JobLogs const &) = delete;
+
+    bool isCapturing() const;
+    void setCapturing(bool capture);
+
+    // Starts logging job_id from the read end of its pipe (the log owns fd)
+    void add(int job_id, const std::string& cmd_line, int fd);
+    JobLog* find(int job_id) const;
+    void printSummaries(std::ostream& out) const;
+
+    // Stores whatever the jobs wrote so far, without blocking
+    void drain();
+    /*
+     * Drains the logs until fd becomes readable (returns true) or wake_fd does first (returns
+     * false). Returns at once when there is nothing to wait for besides fd.
+     */
+    bool waitForInput(int fd, int wake_fd = -1);
+    /*
+     * Prints the output of log as it arrives, or of every running job with a "[<job-id>] " prefix
+     * per line when log is NULL. Returns when the followed jobs are done or on ctrl-C.
+     */
+    void follow(JobLog* log, std::ostream& out);
+};
+
+#endif //SMASH_JOB_LOG_H_
@@ -0,0 +1,176 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <fstream>
+#include "LaunchOptions.h"
+
+static const struct {
+    const char* name;
+    int policy;
+} POLICIES[] = {
+    {"other", SCHED_OTHER}, {"batch", SCHED_BATCH}, {"idle", SCHED_IDLE}, {"fifo", SCHED_FIFO}, {"rr", SCHED_RR}
+};
+
+// The highest NUMA node a memory binding can name
+static const int MAX_NUMA_NODE = 1023;
+
+// A whole number in [min, max] into value, false otherwise
+static bool parseInt(const std::string& word, long min, long max, long& value) {
+    char* end;
+    errno = 0;
+    value = strtol(word.c_str(), &end, 10);
+    return !word.empty() && *end == '\0' && errno == 0 && value >= min && value <= max;
+}
+
+// A CPU list as in cpuset files and taskset -c ("0-3,8,10-11") into cpus
+static bool parseCpuList(const std::string& list, cpu_set_t& cpus) {
+    CPU_ZERO(&cpus);
+    const char* text = list.c_str();
+    while (*text != '\0') {
+        char* end;
+        if (*text < '0' || *text > '9') {
+            return false;
+        }
+        unsigned long first = strtoul(text, &end, 10);
+        unsigned long last = first;
+        if (*end == '-') {
+            text = end + 1;
+            if (*text < '0' || *text > '9') {
+                return false;
+            }
+            last = strtoul(text, &end, 10);
+        }
+        if (last < first || last >= CPU_SETSIZE || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, &cpus);
+        }
+        text = (*end == ',') ? end + 1 : end;
+    }
+    return CPU_COUNT(&cpus) > 0;
+}
+
+bool LaunchOptions::parse(const std::string& option, const std::string& value) {
+    long number;
+    if (option == "--cpus") {
+        hasCpus = parseCpuList(value, cpus);
+        cpuList = value;
+        return hasCpus;
+    }
+    if (option == "--sched") {
+        for (const auto& known : POLICIES) {
+            if (value == known.name) {
+                policy = known.policy;
+                return true;
+            }
+        }
+        return false;
+    }
+    if (option == "--prio" && parseInt(value, 1, 99, number)) {
+        priority = static_cast<int>(number);
+        return true;
+    }
+    if (option == "--nice" && parseInt(value, -40, 40, number)) {
+        hasNice = true;
+        nice = static_cast<int>(number);
+        return true;
+    }
+    if (option == "--numa" && parseInt(value, 0, MAX_NUMA_NODE, number)) {
+        std::string node = "/sys/devices/system/node/node" + value;
+        numaNode = static_cast<int>(number);
+        return access(node.c_str(), F_OK) == 0;
+    }
+    return false;
+}
+
+void LaunchOptions::inherit(const LaunchOptions& outer) {
+    if (cgroup == nullptr) {
+        cgroup = outer.cgroup;
+    }
+    if (!hasCpus && outer.hasCpus) {
+        hasCpus = true;
+        cpus = outer.cpus;
+        cpuList = outer.cpuList;
+    }
+    policy = (policy == -1) ? outer.policy : policy;
+    priority = (priority == 0) ? outer.priority : priority;
+    if (!hasNice) {
+        hasNice = outer.hasNice;
+        nice = outer.nice;
+    }
+    if (numaNode == -1) {
+        numaNode = outer.numaNode;
+    }
+}
+
+/*
+ * Runs in the child, only making system calls but for reading the CPUs of the NUMA node (when it
+ * is used without --cpus). The memory binding comes first, so nothing the command allocates
+ * lands on another node.
+ */
+bool LaunchOptions::apply() const {
+    cpu_set_t node_cpus;
+    bool node_cpus_read = false;
+    if (numaNode != -1) {
+        unsigned long nodes[(MAX_NUMA_NODE + 1) / (8 * sizeof(unsigned long))] = {};
+        nodes[numaNode / (8 * sizeof(unsigned long))] |= 1UL << (numaNode % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_set_mempolicy, MPOL_BIND, nodes, MAX_NUMA_NODE + 1) == -1) {
+            perror("smash error: set_mempolicy failed");
+            return false;
+        }
+        std::string list;
+        std::ifstream node("/sys/devices/system/node/node" + std::to_string(numaNode) + "/cpulist");
+        node_cpus_read = !hasCpus && std::getline(node, list) && parseCpuList(list, node_cpus);
+    }
+    if ((hasCpus || node_cpus_read) && sched_setaffinity(0, sizeof(cpu_set_t), hasCpus ? &cpus : &node_cpus) == -1) {
+        perror("smash error: sched_setaffinity failed");
+        return false;
+    }
+    if (policy != -1) {
+        // The real-time policies need a priority, the lowest unless --prio says otherwise
+        struct sched_param param = {};
+        if (policy == SCHED_FIFO || policy == SCHED_RR) {
+            param.sched_priority = (priority > 0) ? priority : 1;
+        }
+        if (sched_setscheduler(0, policy, &param) == -1) {
+            perror("smash error: sched_setscheduler failed");
+            return false;
+        }
+    }
+    errno = 0;
+    if (hasNice && ::nice(nice) == -1 && errno != 0) {
+        perror("smash error: nice failed");
+        return false;
+    }
+    return true;
+}
+
+std::string LaunchOptions::describe() const {
+    std::string flags;
+    if (cgroup != nullptr) {
+        flags += " --cgroup";
+    }
+    if (hasCpus) {
+        flags += " --cpus " + cpuList;
+    }
+    for (const auto& known : POLICIES) {
+        if (policy == known.policy) {
+            flags += std::string(" --sched ") + known.name;
+        }
+    }
+    if (priority > 0 && (policy == SCHED_FIFO || policy == SCHED_RR)) {
+        flags += " --prio " + std::to_string(priority);
+    }
+    if (hasNice) {
+        flags += " --nice " + std::to_string(nice);
+    }
+    if (numaNode != -1) {
+        flags += " --numa " + std::to_string(numaNode);
+    }
+    return flags.empty() ? flags : flags.substr(1);
+}
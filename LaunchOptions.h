@@ -0,0 +1,40 @@
+#ifndef SMASH_LAUNCH_OPTIONS_H_
+#define SMASH_LAUNCH_OPTIONS_H_
+
+#include <sched.h>
+#include <memory>
+#include <string>
+#include "Cgroup.h"
+
+/*
+ * How the external commands of a line prefixed by run are started. One instance is shared by
+ * every process of the line and by the jobs they become.
+ * The CPU affinity, scheduling policy, niceness and NUMA memory binding are applied by the child
+ * itself between fork and exec, so no taskset, chrt, nice or numactl process is executed in
+ * front of the command.
+ */
+struct LaunchOptions {
+    std::shared_ptr<Cgroup> cgroup;     // NULL to stay in the shell's cgroup
+    bool hasCpus = false;
+    cpu_set_t cpus;
+    std::string cpuList;                // cpus as given
+    int policy = -1;                    // SCHED_*, -1 to keep the shell's
+    int priority = 0;                   // For SCHED_FIFO and SCHED_RR
+    bool hasNice = false;
+    int nice = 0;                       // Added to the niceness, like nice -n
+    int numaNode = -1;
+
+    /*
+     * Sets the option (--cpus LIST, --sched POLICY, --prio N, --nice N or --numa NODE) to value,
+     * false when option is not one of them or value is invalid.
+     */
+    bool parse(const std::string& option, const std::string& value);
+    // Takes the options of outer that are not set here (a run inside another one)
+    void inherit(const LaunchOptions& outer);
+    // Applies the options to the calling process, false (after printing why) on failure
+    bool apply() const;
+    // The options as run flags ("--cpus 4-7 --sched batch"), empty when none is set
+    std::string describe() const;
+};
+
+#endif //SMASH_LAUNCH_OPTIONS_H_
@@ -0,0 +1,258 @@
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <vector>
+#include "Launcher.h"
+
+extern char **environ;
+
+static const size_t MAX_REQUEST_SIZE = 128 * 1024;
+static const size_t MAX_REQUEST_FDS = 64;
+
+static int launcher_socket = -1;
+static pid_t launcher_owner = 0;
+
+/*
+ * Request layout: RequestHeader, FdOperation[num_operations], then the NUL terminated strings:
+ * cwd, argv[0..num_args) and the environment [0..num_env).
+ * The descriptors sent along are referenced by index from the operations.
+ */
+struct RequestHeader {
+    uint32_t num_args;
+    uint32_t num_env;
+    uint32_t num_operations;
+};
+
+struct FdOperation {
+    int32_t source;       // Index into the sent descriptors, or a descriptor of the new process
+    int32_t target;
+    int32_t is_sent;
+};
+
+// Launcher process
+
+static void runChild(const RequestHeader& header, const FdOperation* operations, const int* fds, char* strings) {
+    signal(SIGINT, SIG_DFL);
+    setpgrp();
+
+    for (uint32_t i = 0; i < header.num_operations; i++) {
+        int source = operations[i].is_sent ? fds[operations[i].source] : operations[i].source;
+        if (dup2(source, operations[i].target) == -1) {
+            perror("smash error: dup2 failed");
+            _exit(1);
+        }
+    }
+
+    const char* cwd = strings;
+    strings += strlen(strings) + 1;
+    if (chdir(cwd) == -1) {
+        perror("smash error: chdir failed");
+        _exit(1);
+    }
+
+    std::vector<char*> argv, env;
+    for (uint32_t i = 0; i < header.num_args; i++) {
+        argv.push_back(strings);
+        strings += strlen(strings) + 1;
+    }
+    for (uint32_t i = 0; i < header.num_env; i++) {
+        env.push_back(strings);
+        strings += strlen(strings) + 1;
+    }
+    argv.push_back(nullptr);
+    env.push_back(nullptr);
+    environ = env.data();
+
+    execvp(argv[0], argv.data());
+    perror("smash error: execvp failed");
+    _exit(1);
+}
+
+static void serve(int sock) {
+    static char request[MAX_REQUEST_SIZE];
+    char control[CMSG_SPACE(sizeof(int) * MAX_REQUEST_FDS)];
+
+    while (true) {
+        struct iovec iov = {request, sizeof(request)};
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (len == -1 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            return; // The shell exited
+        }
+
+        int fds[MAX_REQUEST_FDS];
+        size_t num_fds = 0;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                memcpy(fds, CMSG_DATA(cmsg), num_fds * sizeof(int));
+            }
+        }
+
+        RequestHeader header;
+        memcpy(&header, request, sizeof(header));
+        auto* operations = reinterpret_cast<FdOperation*>(request + sizeof(header));
+        char* strings = request + sizeof(header) + header.num_operations * sizeof(FdOperation);
+
+        // Like fork(), but the new process is a child of the shell
+        int32_t reply = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, nullptr, nullptr, nullptr, nullptr);
+        if (reply == 0) {
+            runChild(header, operations, fds, strings);
+        }
+        if (reply == -1) {
+            reply = -errno;
+        }
+
+        for (size_t i = 0; i < num_fds; i++) {
+            close(fds[i]);
+        }
+        if (send(sock, &reply, sizeof(reply), 0) == -1) {
+            return;
+        }
+    }
+}
+
+// Shell side
+
+bool Launcher::start() {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1) {
+        perror("smash error: socketpair failed");
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("smash error: fork failed");
+        close(sockets[0]);
+        close(sockets[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // ctrl-C is meant for the shell, not for its launcher
+        signal(SIGINT, SIG_IGN);
+        close(sockets[0]);
+        serve(sockets[1]);
+        _exit(0);
+    }
+
+    close(sockets[1]);
+    int buffer_size = MAX_REQUEST_SIZE * 2;
+    setsockopt(sockets[0], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    launcher_socket = sockets[0];
+    launcher_owner = getpid();
+    return true;
+}
+
+bool Launcher::isAvailable() {
+    return launcher_socket != -1 && getpid() == launcher_owner;
+}
+
+pid_t Launcher::spawn(char* const argv[], const std::pair<int, int>* redirections, size_t count) {
+    if (!isAvailable()) {
+        return -1;
+    }
+
+    // The standard descriptors of the shell, then the redirections. A source that is a standard
+    // descriptor or was set up by an earlier redirection refers to the new process, others are sent.
+    std::vector<FdOperation> operations;
+    std::vector<int> fds;
+    for (int fd = 0; fd <= 2; fd++) {
+        operations.push_back({static_cast<int32_t>(fds.size()), fd, 1});
+        fds.push_back(fd);
+    }
+    for (size_t i = 0; i < count; i++) {
+        bool is_defined = redirections[i].first <= 2;
+        for (size_t j = 0; j < i && !is_defined; j++) {
+            is_defined = (redirections[j].second == redirections[i].first);
+        }
+        if (is_defined) {
+            operations.push_back({redirections[i].first, redirections[i].second, 0});
+        } else {
+            operations.push_back({static_cast<int32_t>(fds.size()), redirections[i].second, 1});
+            fds.push_back(redirections[i].first);
+        }
+    }
+    if (fds.size() > MAX_REQUEST_FDS) {
+        return -1;
+    }
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return -1;
+    }
+
+    RequestHeader header = {0, 0, static_cast<uint32_t>(operations.size())};
+    std::vector<char> request(sizeof(header));
+    request.insert(request.end(), reinterpret_cast<char*>(operations.data()),
+                   reinterpret_cast<char*>(operations.data() + operations.size()));
+    request.insert(request.end(), cwd, cwd + strlen(cwd) + 1);
+    for (; argv[header.num_args] != nullptr; header.num_args++) {
+        const char* arg = argv[header.num_args];
+        request.insert(request.end(), arg, arg + strlen(arg) + 1);
+    }
+    for (; environ[header.num_env] != nullptr; header.num_env++) {
+        const char* var = environ[header.num_env];
+        request.insert(request.end(), var, var + strlen(var) + 1);
+    }
+    memcpy(request.data(), &header, sizeof(header));
+    if (request.size() > MAX_REQUEST_SIZE) {
+        return -1;
+    }
+
+    char control[CMSG_SPACE(sizeof(int) * MAX_REQUEST_FDS)] = {};
+    struct iovec iov = {request.data(), request.size()};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(launcher_socket, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+
+    int32_t reply = -1;
+    ssize_t received = -1;
+    if (sent != -1) {
+        do {
+            received = recv(launcher_socket, &reply, sizeof(reply), 0);
+        } while (received == -1 && errno == EINTR);
+    }
+
+    if (sent == -1 || received != sizeof(reply)) {
+        if (sent == -1 && errno == EMSGSIZE) {
+            return -1; // Too big for one request, only this command is forked by the shell
+        }
+        // The launcher is gone, the shell forks by itself from now on
+        close(launcher_socket);
+        launcher_socket = -1;
+        return -1;
+    }
+    if (reply < 0) {
+        errno = -reply;
+        return -1;
+    }
+    return reply;
+}
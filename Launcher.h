@@ -0,0 +1,32 @@
+#ifndef SMASH_LAUNCHER_H_
+#define SMASH_LAUNCHER_H_
+
+#include <sys/types.h>
+#include <utility>
+
+/*
+ * Optional helper process that spawns external commands for the shell (smash --launcher).
+ * It is forked at startup while the shell is still small, so the cost of launching a command no
+ * longer grows with the memory of a long running shell.
+ * Requests (argv, environment, cwd and the descriptors to install via SCM_RIGHTS) are sent over a
+ * Unix socketpair. The launcher creates the process with clone(CLONE_PARENT), so it is a child of
+ * the shell itself: waitpid(), job control and exit statuses work exactly as with fork().
+ */
+class Launcher {
+public:
+    // Forks the launcher process, returns false if it could not be started
+    static bool start();
+
+    // True when the launcher can serve the calling process (forked child shells cannot use it)
+    static bool isAvailable();
+
+    /*
+     * Runs argv (searched in PATH) in a new process group. redirections are (source fd, target fd)
+     * pairs applied with dup2() in order, like in ExternalCommand.
+     * Returns the pid of the new process, or -1 when the request could not be delivered,
+     * in which case the caller should fork by itself.
+     */
+    static pid_t spawn(char* const argv[], const std::pair<int, int>* redirections, size_t count);
+};
+
+#endif //SMASH_LAUNCHER_H_
@@ -0,0 +1,336 @@
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "LineEditor.h"
+#include "Commands.h"
+#include "History.h"
+
+static const char BACKSPACE = 127;
+static const char ESCAPE = 27;
+
+static constexpr char ctrl(char c) {
+    return c & 0x1f;
+}
+
+static void writeAll(const std::string& text) {
+    size_t written = 0;
+    while (written < text.size()) {
+        ssize_t count = write(STDOUT_FILENO, text.data() + written, text.size() - written);
+        if (count == -1 && errno != EINTR) {
+            return;
+        }
+        written += (count > 0) ? count : 0;
+    }
+}
+
+static bool isWordBreak(char c) {
+    return c == ' ' || c == '\t' || c == ';' || c == '|' || c == '&' || c == '<' || c == '>' || c == '(';
+}
+
+LineEditor::LineEditor(int fd, History* history) : m_fd(fd), m_original(), m_history(history), m_cursor(0),
+        m_historyIndex(-1), m_pendingKey(-1) {}
+
+// Reads a key, building the completions and then running the wait handler until one comes
+bool LineEditor::readKey(char& key, LineReader::WaitHandler wait) {
+    if (m_pendingKey != -1) {
+        key = static_cast<char>(m_pendingKey);
+        m_pendingKey = -1;
+        return true;
+    }
+    struct pollfd input = {m_fd, POLLIN, 0};
+    while (poll(&input, 1, 0) == 0 && m_completer.buildSome()) {}
+    if (wait != nullptr && poll(&input, 1, 0) == 0) {
+        wait(m_fd);
+    }
+    ssize_t count;
+    do {
+        count = read(m_fd, &key, 1);
+    } while (count == -1 && errno == EINTR);
+    return count == 1;
+}
+
+void LineEditor::redraw(const std::string& prompt) const {
+    std::string out = "\r" + prompt + m_line + "\x1b[K";
+    if (m_cursor < m_line.size()) {
+        out += "\x1b[" + std::to_string(m_line.size() - m_cursor) + "D";
+    }
+    writeAll(out);
+}
+
+void LineEditor::insert(const std::string& text) {
+    m_line.insert(m_cursor, text);
+    m_cursor += text.size();
+}
+
+void LineEditor::showHistory(long index) {
+    m_historyIndex = index;
+    if (index == -1) {
+        m_line = m_typed;
+    } else if (!m_history->get(index, m_line)) {
+        m_line.clear();
+    }
+    m_cursor = m_line.size();
+}
+
+void LineEditor::complete() {
+    size_t start = m_cursor;
+    while (start > 0 && !isWordBreak(m_line[start - 1])) {
+        --start;
+    }
+    // The first word of a command, at the start or after an operator
+    size_t before = (start == 0) ? std::string::npos : m_line.find_last_not_of(" \t", start - 1);
+    bool command_name = (before == std::string::npos || m_line[before] == ';' || m_line[before] == '|' ||
+                         m_line[before] == '&' || m_line[before] == '(');
+
+    std::string word = m_line.substr(start, m_cursor - start);
+    std::vector<std::string> candidates;
+    std::string common;
+    size_t count = m_completer.complete(word, command_name, candidates, common);
+    if (count == 0) {
+        writeAll("\a");
+        return;
+    }
+    if (common.size() > word.size()) {
+        m_line.replace(start, word.size(), common);
+        m_cursor = start + common.size();
+        return;
+    }
+    if (count == 1) {
+        return;
+    }
+
+    // Nothing to add, lists the candidates in columns under the line
+    struct winsize window;
+    size_t width = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0 && window.ws_col > 0) ? window.ws_col : 80;
+    size_t column_width = 2;
+    for (const std::string& candidate : candidates) {
+        column_width = std::max(column_width, candidate.size() + 2);
+    }
+    size_t columns = std::max<size_t>(1, width / column_width);
+    std::string out = "\n";
+    for (size_t i = 0; i < candidates.size(); i++) {
+        out += candidates[i];
+        bool last = (i + 1) % columns == 0 || i + 1 == candidates.size();
+        out += last ? "\n" : std::string(column_width - candidates[i].size(), ' ');
+    }
+    if (count > candidates.size()) {
+        out += "... and " + std::to_string(count - candidates.size()) + " more\n";
+    }
+    writeAll(out);
+}
+
+bool LineEditor::reverseSearch(LineReader::WaitHandler wait, bool& accepted) {
+    std::string pattern;
+    std::string match = m_line;
+    long found = -1;
+    bool failed = false;
+    accepted = false;
+    while (true) {
+        writeAll(std::string("\r(") + (failed ? "failed " : "") + "reverse-i-search)`" + pattern + "': " +
+                 match + "\x1b[K");
+        char key;
+        if (!readKey(key, wait)) {
+            return false;
+        }
+        long next = -2;
+        std::string text;
+        if (key == ctrl('r')) {
+            // Older entries repeating the one shown are skipped
+            for (long from = found; from > 0 && !pattern.empty(); from = next) {
+                next = m_history->findBefore(pattern, from, text);
+                if (next == -1 || text != match) {
+                    break;
+                }
+            }
+        } else if (key == BACKSPACE || key == ctrl('h')) {
+            if (!pattern.empty()) {
+                pattern.pop_back();
+                next = pattern.empty() ? -2 : m_history->findBefore(pattern, -1, text);
+            }
+        } else if (static_cast<unsigned char>(key) >= ' ' && key != BACKSPACE) {
+            pattern += key;
+            // The entry shown may still match the longer pattern
+            next = m_history->findBefore(pattern, found == -1 ? -1 : found + 1, text);
+        } else if (key == ctrl('g') || key == ctrl('c')) {
+            return true;
+        } else {
+            // Any other key leaves the search with the match and is then handled as usual
+            m_line = match;
+            m_cursor = m_line.size();
+            accepted = (key == '\r' || key == '\n');
+            if (!accepted) {
+                m_pendingKey = static_cast<unsigned char>(key);
+            }
+            return true;
+        }
+        failed = (next == -1);
+        if (next >= 0) {
+            found = next;
+            match = text;
+        }
+    }
+}
+
+bool LineEditor::readLine(std::string& line, LineReader::WaitHandler wait) {
+    SmallShell& smash = SmallShell::getInstance();
+    std::string prompt = smash.getShownPrompt();
+    m_line.clear();
+    m_cursor = 0;
+    m_historyIndex = -1;
+
+    // Commands may change the terminal, so it is put back to how they left it
+    tcgetattr(m_fd, &m_original);
+    struct termios raw = m_original;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_iflag &= ~(IXON | ICRNL | INLCR);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(m_fd, TCSADRAIN, &raw);
+
+    bool done = false;
+    bool end_of_input = false;
+    while (!done) {
+        char key;
+        if (!readKey(key, wait)) {
+            end_of_input = m_line.empty();
+            break;
+        }
+        switch (key) {
+            case '\r':
+            case '\n':
+                done = true;
+                break;
+            case ctrl('d'):
+                if (m_line.empty()) {
+                    end_of_input = true;
+                    done = true;
+                } else if (m_cursor < m_line.size()) {
+                    m_line.erase(m_cursor, 1);
+                }
+                break;
+            case ctrl('c'):
+                writeAll("^C\n");
+                tcsetattr(m_fd, TCSADRAIN, &m_original);
+                // Reported like a ctrl-C anywhere else
+                raise(SIGINT);
+                std::cout.flush();
+                line.clear();
+                return true;
+            case BACKSPACE:
+            case ctrl('h'):
+                if (m_cursor > 0) {
+                    m_line.erase(--m_cursor, 1);
+                }
+                break;
+            case ctrl('a'):
+                m_cursor = 0;
+                break;
+            case ctrl('e'):
+                m_cursor = m_line.size();
+                break;
+            case ctrl('b'):
+                m_cursor -= (m_cursor > 0);
+                break;
+            case ctrl('f'):
+                m_cursor += (m_cursor < m_line.size());
+                break;
+            case ctrl('u'):
+                m_line.erase(0, m_cursor);
+                m_cursor = 0;
+                break;
+            case ctrl('k'):
+                m_line.erase(m_cursor);
+                break;
+            case ctrl('w'): {
+                size_t start = m_cursor;
+                while (start > 0 && m_line[start - 1] == ' ') {
+                    --start;
+                }
+                while (start > 0 && m_line[start - 1] != ' ') {
+                    --start;
+                }
+                m_line.erase(start, m_cursor - start);
+                m_cursor = start;
+                break;
+            }
+            case ctrl('l'):
+                writeAll("\x1b[H\x1b[2J");
+                break;
+            case ctrl('p'):
+                key = 'A';
+                // fallthrough
+            case ctrl('n'):
+            case ESCAPE: {
+                char code = (key == ctrl('n')) ? 'B' : key;
+                if (key == ESCAPE) {
+                    char bracket;
+                    if (!readKey(bracket, wait) || !readKey(code, wait)) {
+                        break;
+                    }
+                    // ESC [ <digit> ~
+                    char tilde = '~';
+                    if (code >= '0' && code <= '9' && !readKey(tilde, wait)) {
+                        break;
+                    }
+                }
+                if (code == 'A' && m_history != nullptr) {
+                    long index = (m_historyIndex == -1) ? static_cast<long>(m_history->size()) : m_historyIndex;
+                    if (m_historyIndex == -1) {
+                        m_typed = m_line;
+                    }
+                    if (index > 0) {
+                        showHistory(index - 1);
+                    }
+                } else if (code == 'B' && m_historyIndex != -1) {
+                    long index = m_historyIndex + 1;
+                    showHistory(index < static_cast<long>(m_history->size()) ? index : -1);
+                } else if (code == 'C') {
+                    m_cursor += (m_cursor < m_line.size());
+                } else if (code == 'D') {
+                    m_cursor -= (m_cursor > 0);
+                } else if (code == 'H' || code == '1') {
+                    m_cursor = 0;
+                } else if (code == 'F' || code == '4') {
+                    m_cursor = m_line.size();
+                } else if (code == '3' && m_cursor < m_line.size()) {
+                    m_line.erase(m_cursor, 1);
+                }
+                break;
+            }
+            case ctrl('r'): {
+                bool accepted;
+                if (m_history == nullptr) {
+                    break;
+                }
+                if (!reverseSearch(wait, accepted)) {
+                    end_of_input = m_line.empty();
+                    done = true;
+                }
+                done = done || accepted;
+                break;
+            }
+            case '\t':
+                complete();
+                break;
+            default:
+                if (static_cast<unsigned char>(key) >= ' ') {
+                    insert(std::string(1, key));
+                }
+                break;
+        }
+        redraw(prompt);
+    }
+
+    writeAll("\n");
+    tcsetattr(m_fd, TCSADRAIN, &m_original);
+    if (end_of_input) {
+        return false;
+    }
+    line = m_line;
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef SMASH_LINE_EDITOR_H_
+#define SMASH_LINE_EDITOR_H_
+
+#include <stddef.h>
+#include <termios.h>
+#include <string>
+#include "Completion.h"
+#include "LineReader.h"
+
+class History;
+
+/*
+ * Reads command lines from a terminal in raw mode (only while reading, commands get the terminal
+ * as it was) with emacs style editing:
+ *   Left/Right, Ctrl-B/F, Home/End, Ctrl-A/E    move          Backspace, Delete, Ctrl-D   delete
+ *   Ctrl-U/K                                    kill to start/end of line   Ctrl-W       kill word
+ *   Up/Down, Ctrl-P/N                           history       Ctrl-R   reverse search (again for older)
+ *   Tab                                         complete (see Completer), lists the candidates
+ *   Ctrl-L                                      clear screen  Ctrl-C   abandon the line
+ * While waiting for a key it builds the completions, then calls the wait handler.
+ */
+class LineEditor {
+    int m_fd;
+    struct termios m_original;
+    History* m_history;
+    Completer m_completer;
+    std::string m_line;
+    size_t m_cursor;
+    long m_historyIndex;        // The entry shown, -1 for the line being typed
+    std::string m_typed;        // The line being typed while the history is shown
+    int m_pendingKey;           // The key that ended a reverse search, -1 for none
+
+    bool readKey(char& key, LineReader::WaitHandler wait);
+    void redraw(const std::string& prompt) const;
+    void insert(const std::string& text);
+    void showHistory(long index);
+    void complete();
+    // Returns false when the line is abandoned, with the line to run in accepted otherwise
+    bool reverseSearch(LineReader::WaitHandler wait, bool& accepted);
+
+public:
+    LineEditor(int fd, History* history);
+    ~LineEditor() = default;
+    LineEditor(LineEditor const &) = delete;
+    void operator=(LineEditor const &) = delete;
+
+    // Reads one line (without its '\n'), false at the end of input (Ctrl-D on an empty line)
+    bool readLine(std::string& line, LineReader::WaitHandler wait);
+};
+
+#endif //SMASH_LINE_EDITOR_H_
@@ -0,0 +1,131 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <new>
+#include <string>
+#include "LineReader.h"
+#include "LineEditor.h"
+
+LineReader::LineReader(int fd, bool owns_fd) : m_fd(fd), m_ownsFd(owns_fd), m_buffer(nullptr),
+        m_capacity(BLOCK_SIZE), m_start(0), m_end(0), m_eof(false), m_waitHandler(nullptr), m_editor(nullptr) {
+    m_buffer = static_cast<char*>(malloc(m_capacity + 1));
+    if (m_buffer == nullptr) {
+        throw std::bad_alloc();
+    }
+}
+
+LineReader::LineReader(const char* script, size_t length) : m_fd(-1), m_ownsFd(false), m_buffer(nullptr),
+        m_capacity(length), m_start(0), m_end(length), m_eof(true), m_waitHandler(nullptr), m_editor(nullptr) {
+    m_buffer = static_cast<char*>(malloc(m_capacity + 1));
+    if (m_buffer == nullptr) {
+        throw std::bad_alloc();
+    }
+    memcpy(m_buffer, script, length);
+}
+
+LineReader::~LineReader() {
+    free(m_buffer);
+    if (m_ownsFd) {
+        close(m_fd);
+    }
+}
+
+// Reads the next block after the unconsumed tail of the buffer.
+// Returns false once the input is exhausted.
+bool LineReader::fill() {
+    if (m_start > 0) {
+        memmove(m_buffer, m_buffer + m_start, m_end - m_start);
+        m_end -= m_start;
+        m_start = 0;
+    }
+    if (m_editor != nullptr) {
+        return fillFromEditor();
+    }
+    if (m_end == m_capacity) {
+        // A single line is longer than the buffer
+        char* bigger = static_cast<char*>(realloc(m_buffer, 2 * m_capacity + 1));
+        if (bigger == nullptr) {
+            throw std::bad_alloc();
+        }
+        m_buffer = bigger;
+        m_capacity *= 2;
+    }
+
+    if (m_waitHandler != nullptr) {
+        m_waitHandler(m_fd);
+    }
+    ssize_t bytes;
+    do {
+        bytes = read(m_fd, m_buffer + m_end, m_capacity - m_end);
+    } while (bytes == -1 && errno == EINTR);
+
+    if (bytes == -1) {
+        perror("smash error: read failed");
+    }
+    if (bytes <= 0) {
+        m_eof = true;
+        return false;
+    }
+    m_end += bytes;
+    return true;
+}
+
+// Appends the next line the editor reads, with its '\n'
+bool LineReader::fillFromEditor() {
+    std::string line;
+    if (!m_editor->readLine(line, m_waitHandler)) {
+        m_eof = true;
+        return false;
+    }
+    line += '\n';
+    if (m_capacity - m_end < line.size()) {
+        char* bigger = static_cast<char*>(realloc(m_buffer, m_end + line.size() + 1));
+        if (bigger == nullptr) {
+            throw std::bad_alloc();
+        }
+        m_buffer = bigger;
+        m_capacity = m_end + line.size();
+    }
+    memcpy(m_buffer + m_end, line.data(), line.size());
+    m_end += line.size();
+    return true;
+}
+
+void LineReader::setWaitHandler(WaitHandler handler) {
+    m_waitHandler = handler;
+}
+
+void LineReader::setEditor(LineEditor* editor) {
+    m_editor = editor;
+}
+
+const char* LineReader::nextLine() {
+    // Offset (from m_start) up to which the pending bytes are known to contain no '\n'
+    size_t scanned = 0;
+    while (true) {
+        char* from = m_buffer + m_start + scanned;
+        char* newline = static_cast<char*>(memchr(from, '\n', m_end - m_start - scanned));
+        if (newline != nullptr) {
+            *newline = '\0';
+            const char* line = m_buffer + m_start;
+            m_start = newline - m_buffer + 1;
+            return line;
+        }
+        scanned = m_end - m_start;
+
+        if (m_eof || !fill()) {
+            break;
+        }
+    }
+
+    // Last line without a terminating '\n'
+    if (m_start == m_end) {
+        return nullptr;
+    }
+    m_buffer[m_end] = '\0';
+    const char* line = m_buffer + m_start;
+    m_start = m_end;
+    return line;
+}
@@ -0,0 +1,50 @@
+#ifndef SMASH_LINE_READER_H_
+#define SMASH_LINE_READER_H_
+
+#include <stddef.h>
+
+class LineEditor;
+
+/*
+ * Reads command lines from a file descriptor (or an in-memory script) in large
+ * blocks and splits them in place, so a long script costs one read() per block
+ * instead of one std::string per line.
+ */
+class LineReader {
+public:
+    // Called before blocking on the descriptor, returns once it is readable
+    typedef void (*WaitHandler)(int fd);
+
+private:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    int m_fd;
+    bool m_ownsFd;
+    char* m_buffer;
+    size_t m_capacity;
+    size_t m_start;
+    size_t m_end;
+    bool m_eof;
+    WaitHandler m_waitHandler;
+    LineEditor* m_editor;
+
+    bool fill();
+    bool fillFromEditor();
+
+public:
+    explicit LineReader(int fd, bool owns_fd = false);
+    LineReader(const char* script, size_t length);
+    ~LineReader();
+    LineReader(LineReader const &) = delete;
+    void operator=(LineReader const &) = delete;
+
+    // Returns the next line without its '\n', or NULL at end of input.
+    // The line stays valid until the next call.
+    const char* nextLine();
+
+    void setWaitHandler(WaitHandler handler);
+    // Reads the lines through editor (a terminal) instead, NULL to stop
+    void setEditor(LineEditor* editor);
+};
+
+#endif //SMASH_LINE_READER_H_
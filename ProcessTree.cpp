@@ -0,0 +1,281 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include "ProcessTree.h"
+
+struct linux_dirent64 {
+    unsigned long  d_ino;
+    off_t          d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+static const size_t PATH_SIZE = 64;
+
+// Writes the digits of value at out, returns the end
+static char* appendNumber(char* out, unsigned long value) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+static char* appendText(char* out, const char* text) {
+    while (*text != '\0') {
+        *out++ = *text++;
+    }
+    return out;
+}
+
+// The number at text (stopping at the first non digit), 0 if none
+static uint64_t parseNumber(const char*& text, const char* end) {
+    uint64_t value = 0;
+    while (text < end && *text >= '0' && *text <= '9') {
+        value = value * 10 + (*text++ - '0');
+    }
+    return value;
+}
+
+// Moves text past count fields separated by single spaces
+static void skipFields(const char*& text, const char* end, int count) {
+    while (count > 0 && text < end) {
+        if (*text++ == ' ') {
+            --count;
+        }
+    }
+}
+
+// Reads the whole (small) file at path into buffer as a string, its length or -1
+static ssize_t readFile(int dir, const char* path, char* buffer, size_t size) {
+    int fd = openat(dir, path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t length = read(fd, buffer, size - 1);
+    close(fd);
+    if (length >= 0) {
+        buffer[length] = '\0';
+    }
+    return length;
+}
+
+ProcessTree::ProcessTree() : m_procFd(-1), m_ticksPerSecond(sysconf(_SC_CLK_TCK)),
+        m_pageSizeKb(sysconf(_SC_PAGESIZE) / 1024), m_childrenFiles(false) {}
+
+ProcessTree::~ProcessTree() {
+    if (m_procFd != -1) {
+        close(m_procFd);
+    }
+}
+
+/*
+ * /proc/<pid>/stat: "pid (comm) state ppid ..." with utime and stime the 14th and 15th fields,
+ * num_threads the 20th and rss the 24th. comm may hold spaces and parentheses, so the fields are
+ * counted from its last ')'.
+ */
+bool ProcessTree::readStat(pid_t pid, Process& process) const {
+    char path[PATH_SIZE];
+    appendText(appendNumber(path, pid), "/stat")[0] = '\0';
+    char buffer[1024];
+    ssize_t length = readFile(m_procFd, path, buffer, sizeof(buffer));
+    const char* open_paren = (length > 0) ? strchr(buffer, '(') : nullptr;
+    const char* close_paren = (length > 0) ? strrchr(buffer, ')') : nullptr;
+    if (open_paren == nullptr || close_paren == nullptr || close_paren + 4 > buffer + length) {
+        return false;
+    }
+    const char* end = buffer + length;
+    size_t comm_length = std::min<size_t>(close_paren - open_paren - 1, sizeof(process.comm) - 1);
+    memcpy(process.comm, open_paren + 1, comm_length);
+    process.comm[comm_length] = '\0';
+    process.pid = pid;
+
+    const char* field = close_paren + 2;
+    process.state = *field;
+    skipFields(field, end, 1);
+    process.ppid = parseNumber(field, end);
+    skipFields(field, end, 10);
+    process.cpuTicks = parseNumber(field, end);
+    skipFields(field, end, 1);
+    process.cpuTicks += parseNumber(field, end);
+    skipFields(field, end, 5);
+    process.threads = parseNumber(field, end);
+    skipFields(field, end, 4);
+    process.rssPages = parseNumber(field, end);
+    return true;
+}
+
+// Appends the children of every thread of process to m_children
+void ProcessTree::readChildren(const Process& process) {
+    char path[PATH_SIZE];
+    char* task = appendText(appendNumber(path, process.pid), "/task/");
+    auto read_children = [this, &path](char* tid_end) {
+        appendText(tid_end, "/children")[0] = '\0';
+        int fd = openat(m_procFd, path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return;
+        }
+        // Space separated pids, a pid may be cut between two reads
+        char buffer[4096];
+        uint64_t pid = 0;
+        bool in_pid = false;
+        ssize_t nread;
+        while ((nread = read(fd, buffer, sizeof(buffer))) > 0) {
+            for (ssize_t i = 0; i < nread; i++) {
+                if (buffer[i] >= '0' && buffer[i] <= '9') {
+                    pid = pid * 10 + (buffer[i] - '0');
+                    in_pid = true;
+                } else if (in_pid) {
+                    m_children.push_back(static_cast<pid_t>(pid));
+                    pid = 0;
+                    in_pid = false;
+                }
+            }
+        }
+        if (in_pid) {
+            m_children.push_back(static_cast<pid_t>(pid));
+        }
+        close(fd);
+    };
+
+    // A single threaded process (the usual case) needs no listing of its tasks
+    if (process.threads <= 1) {
+        read_children(appendNumber(task, process.pid));
+        return;
+    }
+    task[-1] = '\0';
+    int dir = openat(m_procFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    task[-1] = '/';
+    if (dir == -1) {
+        return;
+    }
+    char buffer[4096];
+    long nread;
+    while ((nread = syscall(SYS_getdents64, dir, buffer, sizeof(buffer))) > 0) {
+        for (long pos = 0; pos < nread; ) {
+            auto* entry = reinterpret_cast<struct linux_dirent64*>(buffer + pos);
+            pos += entry->d_reclen;
+            if (entry->d_name[0] != '.') {
+                read_children(appendText(task, entry->d_name));
+            }
+        }
+    }
+    close(dir);
+}
+
+// Reads the stat file of every process
+void ProcessTree::scan() {
+    m_processes.clear();
+    m_byParent.clear();
+    lseek(m_procFd, 0, SEEK_SET);
+    char buffer[32 * 1024];
+    long nread;
+    while ((nread = syscall(SYS_getdents64, m_procFd, buffer, sizeof(buffer))) > 0) {
+        for (long pos = 0; pos < nread; ) {
+            auto* entry = reinterpret_cast<struct linux_dirent64*>(buffer + pos);
+            pos += entry->d_reclen;
+            const char* name = entry->d_name;
+            if (*name < '1' || *name > '9') {
+                continue;
+            }
+            Process process;
+            if (readStat(parseNumber(name, name + strlen(name)), process)) {
+                m_processes.push_back(process);
+            }
+        }
+    }
+    std::sort(m_processes.begin(), m_processes.end(), [](const Process& a, const Process& b) {
+        return a.pid < b.pid;
+    });
+    for (uint32_t i = 0; i < m_processes.size(); i++) {
+        m_byParent.push_back(i);
+    }
+    // The children of a process stay by pid (creation order until pids wrap)
+    std::sort(m_byParent.begin(), m_byParent.end(), [this](uint32_t a, uint32_t b) {
+        return m_processes[a].ppid < m_processes[b].ppid || (m_processes[a].ppid == m_processes[b].ppid && a < b);
+    });
+}
+
+const ProcessTree::Process* ProcessTree::find(pid_t pid) const {
+    auto by_pid = [](const Process& process, pid_t value) {
+        return process.pid < value;
+    };
+    auto it = std::lower_bound(m_processes.begin(), m_processes.end(), pid, by_pid);
+    return (it != m_processes.end() && it->pid == pid) ? &*it : nullptr;
+}
+
+void ProcessTree::refresh() {
+    // Opened on first use, not by every shell
+    if (m_procFd == -1) {
+        m_procFd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (m_procFd == -1) {
+            perror("smash error: open failed");
+            return;
+        }
+        m_childrenFiles = (faccessat(m_procFd, "thread-self/children", R_OK, 0) == 0);
+    }
+    if (!m_childrenFiles) {
+        scan();
+    }
+}
+
+// "   <pid> <state>   <cpu>s   <rss>K <indent>\_ <comm>"
+void ProcessTree::printProcess(std::ostream& out, const Process& process, int depth) const {
+    char line[128];
+    int length = snprintf(line, sizeof(line), "  %7d %c %9.2fs %9lluK %*s%s%s\n", process.pid,
+                          process.state, static_cast<double>(process.cpuTicks) / m_ticksPerSecond,
+                          static_cast<unsigned long long>(process.rssPages * m_pageSizeKb),
+                          depth > 0 ? 3 * depth - 2 : 1, "", depth > 0 ? "\\_ " : "", process.comm);
+    out.write(line, std::min<int>(length, sizeof(line) - 1));
+}
+
+void ProcessTree::print(std::ostream& out, pid_t root) {
+    if (m_procFd == -1) {
+        return;
+    }
+    m_stack.clear();
+    m_stack.emplace_back(root, 0);
+    while (!m_stack.empty()) {
+        pid_t pid = m_stack.back().first;
+        int depth = m_stack.back().second;
+        m_stack.pop_back();
+
+        // The children go on the stack last first, so they come out in order
+        size_t first_child = m_stack.size();
+        if (m_childrenFiles) {
+            Process process;
+            if (!readStat(pid, process)) {
+                continue;
+            }
+            printProcess(out, process, depth);
+            m_children.clear();
+            readChildren(process);
+            for (pid_t child : m_children) {
+                m_stack.emplace_back(child, depth + 1);
+            }
+        } else {
+            const Process* process = find(pid);
+            if (process == nullptr) {
+                continue;
+            }
+            printProcess(out, *process, depth);
+            auto by_parent = [this](uint32_t index, pid_t value) {
+                return m_processes[index].ppid < value;
+            };
+            auto child = std::lower_bound(m_byParent.begin(), m_byParent.end(), pid, by_parent);
+            for (; child != m_byParent.end() && m_processes[*child].ppid == pid; ++child) {
+                m_stack.emplace_back(m_processes[*child].pid, depth + 1);
+            }
+        }
+        std::reverse(m_stack.begin() + first_child, m_stack.end());
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef SMASH_PROCESS_TREE_H_
+#define SMASH_PROCESS_TREE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <ostream>
+#include <vector>
+
+/*
+ * The processes below the jobs (jobs -t), read from /proc. Where the kernel has them, the children
+ * files of every thread (/proc/<pid>/task/<tid>/children) lead from a job to its descendants, so
+ * only those are read. Otherwise refresh() reads the stat file of every process once and the tree
+ * is built from their parent pids.
+ * Files are opened with openat() relative to one /proc descriptor (opened on first use and kept)
+ * and parsed in place from fixed buffers, so once the vectors have grown a listing allocates
+ * nothing.
+ */
+class ProcessTree {
+    struct Process {
+        pid_t pid;
+        pid_t ppid;
+        char state;
+        int threads;
+        uint64_t cpuTicks;      // utime + stime
+        uint64_t rssPages;
+        char comm[16];
+    };
+
+    int m_procFd;
+    long m_ticksPerSecond;
+    long m_pageSizeKb;
+    bool m_childrenFiles;               // The kernel has /proc/<pid>/task/<tid>/children
+    std::vector<Process> m_processes;   // Every process by pid, without the children files
+    std::vector<uint32_t> m_byParent;   // Indexes in m_processes by parent pid
+    std::vector<std::pair<pid_t, int>> m_stack;
+    std::vector<pid_t> m_children;
+
+    bool readStat(pid_t pid, Process& process) const;
+    void readChildren(const Process& process);
+    void scan();
+    const Process* find(pid_t pid) const;
+    void printProcess(std::ostream& out, const Process& process, int depth) const;
+
+public:
+    ProcessTree();
+    ~ProcessTree();
+    ProcessTree(ProcessTree const &) = delete;
+    void operator=(ProcessTree const &) = delete;
+
+    // Takes the processes as they are now for the next print() calls, called before them
+    void refresh();
+    // Prints the process root and its descendants, one per line, each below its parent
+    void print(std::ostream& out, pid_t root);
+};
+
+#endif //SMASH_PROCESS_TREE_H_
@@ -0,0 +1,281 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <algorithm>
+#include <iostream>
+#include "Scheduler.h"
+#include "Commands.h"
+
+// TimerWheel
+
+static const uint64_t NEVER = UINT64_MAX;
+
+TimerWheel::TimerWheel(uint64_t now) : m_current(now), m_count(0) {
+    for (auto& level : m_slots) {
+        for (Timer& head : level) {
+            head.prev = &head;
+            head.next = &head;
+        }
+    }
+}
+
+static void unlink(TimerWheel::Timer* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = nullptr;
+    timer->next = nullptr;
+}
+
+void TimerWheel::place(Timer* timer) {
+    uint64_t delta = timer->expires - m_current;
+    uint64_t tick = timer->expires;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ull << ((level + 1) * LEVEL_BITS))) {
+        ++level;
+    }
+    if (delta >= (1ull << (LEVELS * LEVEL_BITS))) {
+        // Beyond the top level, parked in its furthest slot until it cascades again
+        tick = m_current + (1ull << (LEVELS * LEVEL_BITS)) - 1;
+    }
+    Timer& head = m_slots[level][(tick >> (level * LEVEL_BITS)) & (SLOTS - 1)];
+    timer->prev = head.prev;
+    timer->next = &head;
+    head.prev->next = timer;
+    head.prev = timer;
+}
+
+void TimerWheel::add(Timer* timer) {
+    if (timer->expires <= m_current) {
+        timer->expires = m_current + 1;
+    }
+    place(timer);
+    ++m_count;
+}
+
+void TimerWheel::cancel(Timer* timer) {
+    if (timer->isPending()) {
+        unlink(timer);
+        --m_count;
+    }
+}
+
+// Moves the timers of the current slot of level down to the levels below
+void TimerWheel::cascade(int level) {
+    Timer& head = m_slots[level][(m_current >> (level * LEVEL_BITS)) & (SLOTS - 1)];
+    while (head.next != &head) {
+        Timer* timer = head.next;
+        unlink(timer);
+        place(timer);
+    }
+}
+
+void TimerWheel::advance(uint64_t now, std::vector<Timer*>& expired) {
+    while (m_current < now) {
+        if (m_count == 0) {
+            m_current = now;
+            break;
+        }
+        ++m_current;
+        for (int level = 1; level < LEVELS; level++) {
+            if ((m_current & ((1ull << (level * LEVEL_BITS)) - 1)) != 0) {
+                break;
+            }
+            cascade(level);
+        }
+        Timer& head = m_slots[0][m_current & (SLOTS - 1)];
+        while (head.next != &head) {
+            Timer* timer = head.next;
+            unlink(timer);
+            --m_count;
+            expired.push_back(timer);
+        }
+    }
+}
+
+uint64_t TimerWheel::nextWakeup() const {
+    uint64_t wakeup = NEVER;
+    if (m_count == 0) {
+        return wakeup;
+    }
+    // The next non-empty slot of every level, a slot of level n is due when its first tick comes
+    for (int level = 0; level < LEVELS; level++) {
+        int shift = level * LEVEL_BITS;
+        for (uint64_t i = 1; i <= SLOTS; i++) {
+            uint64_t block = (m_current >> shift) + i;
+            const Timer& head = m_slots[level][block & (SLOTS - 1)];
+            if (head.next != &head) {
+                wakeup = std::min(wakeup, block << shift);
+                break;
+            }
+        }
+    }
+    return wakeup;
+}
+
+bool TimerWheel::empty() const {
+    return m_count == 0;
+}
+
+// Scheduler
+
+Scheduler::Scheduler() : m_timerFd(-1), m_armedTick(NEVER), m_owner(0) {}
+
+Scheduler::~Scheduler() {
+    if (m_timerFd != -1) {
+        close(m_timerFd);
+    }
+}
+
+int64_t Scheduler::nowMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+void Scheduler::schedule(Entry* entry) {
+    entry->expires = (entry->dueMs + TICK_MS - 1) / TICK_MS;
+    m_wheel->add(entry);
+}
+
+// Arms the timerfd for the wheel's next wakeup, unless it already is
+void Scheduler::arm() {
+    uint64_t wakeup = m_wheel->nextWakeup();
+    if (wakeup == m_armedTick) {
+        return;
+    }
+    m_armedTick = wakeup;
+    struct itimerspec spec = {};
+    if (wakeup != NEVER) {
+        spec.it_value.tv_sec = wakeup * TICK_MS / 1000;
+        spec.it_value.tv_nsec = (wakeup * TICK_MS % 1000) * 1000000;
+    }
+    if (timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+        perror("smash error: timerfd_settime failed");
+    }
+}
+
+// Starts a run as a background job
+void Scheduler::start(Entry* entry, int64_t due_ms, int64_t now_ms) {
+    pid_t pid = SmallShell::getInstance().startJob(entry->cmdLine);
+    if (pid == -1) {
+        return;
+    }
+
+    entry->pid = pid;
+    ++entry->runs;
+    int64_t lateness = std::max<int64_t>(0, now_ms - due_ms);
+    entry->totalLatenessMs += lateness;
+    entry->maxLatenessMs = std::max(entry->maxLatenessMs, lateness);
+}
+
+int Scheduler::add(int64_t interval_ms, const std::string& cmd_line, OverlapPolicy policy) {
+    int64_t now = nowMs();
+    if (m_wheel == nullptr) {
+        m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (m_timerFd == -1) {
+            perror("smash error: timerfd_create failed");
+            return -1;
+        }
+        m_wheel.reset(new TimerWheel(now / TICK_MS));
+        m_owner = getpid();
+    }
+
+    std::unique_ptr<Entry> entry(new Entry());
+    entry->id = m_entries.empty() ? 1 : m_entries.back()->id + 1;
+    entry->cmdLine = cmd_line;
+    entry->intervalMs = interval_ms;
+    entry->policy = policy;
+    entry->dueMs = now + interval_ms;
+    entry->pid = 0;
+    entry->queued = false;
+    entry->queuedDueMs = 0;
+    entry->runs = 0;
+    entry->skipped = 0;
+    entry->totalLatenessMs = 0;
+    entry->maxLatenessMs = 0;
+    schedule(entry.get());
+    m_entries.push_back(std::move(entry));
+    arm();
+    return m_entries.back()->id;
+}
+
+bool Scheduler::remove(int id) {
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if ((*it)->id == id) {
+            m_wheel->cancel(it->get());
+            m_queued.erase(std::remove(m_queued.begin(), m_queued.end(), it->get()), m_queued.end());
+            m_entries.erase(it);
+            arm();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scheduler::list(std::ostream& out) const {
+    for (const auto& entry : m_entries) {
+        out << entry->id << ": every " << entry->intervalMs / 1000.0 << "s "
+            << (entry->policy == QUEUE ? "-q " : "") << entry->cmdLine << " : " << entry->runs << " runs, "
+            << entry->skipped << " skipped, lateness avg "
+            << (entry->runs == 0 ? 0 : entry->totalLatenessMs / static_cast<int64_t>(entry->runs))
+            << " ms max " << entry->maxLatenessMs << " ms" << '\n';
+    }
+}
+
+int Scheduler::fd() const {
+    return (m_wheel != nullptr && !m_entries.empty()) ? m_timerFd : -1;
+}
+
+void Scheduler::runDue() {
+    // Child shells (pipe stages, substitutions...) inherit the entries but must not run them
+    if (m_wheel == nullptr || m_entries.empty() || getpid() != m_owner) {
+        return;
+    }
+    uint64_t expirations;
+    while (read(m_timerFd, &expirations, sizeof(expirations)) > 0) {}
+
+    int64_t now = nowMs();
+    JobsList& jobs = SmallShell::getInstance().getJobsList();
+    jobs.removeFinishedJobs();
+    auto is_running = [&jobs](const Entry* entry) {
+        return entry->pid != 0 && jobs.getJobByPid(entry->pid) != nullptr;
+    };
+
+    for (auto it = m_queued.begin(); it != m_queued.end(); ) {
+        if (is_running(*it)) {
+            ++it;
+            continue;
+        }
+        Entry* entry = *it;
+        it = m_queued.erase(it);
+        entry->queued = false;
+        start(entry, entry->queuedDueMs, now);
+    }
+
+    std::vector<TimerWheel::Timer*> expired;
+    m_wheel->advance(now / TICK_MS, expired);
+    for (TimerWheel::Timer* timer : expired) {
+        Entry* entry = static_cast<Entry*>(timer);
+        if (!is_running(entry)) {
+            start(entry, entry->dueMs, now);
+        } else if (entry->policy == QUEUE && !entry->queued) {
+            entry->queued = true;
+            entry->queuedDueMs = entry->dueMs;
+            m_queued.push_back(entry);
+        } else {
+            ++entry->skipped;
+        }
+
+        // Fixed rate, the periods that already passed are skipped
+        entry->dueMs += entry->intervalMs;
+        if (entry->dueMs <= now) {
+            int64_t missed = (now - entry->dueMs) / entry->intervalMs + 1;
+            entry->skipped += missed;
+            entry->dueMs += missed * entry->intervalMs;
+        }
+        schedule(entry);
+    }
+    arm();
+}
@@ -0,0 +1,114 @@
+#ifndef SMASH_SCHEDULER_H_
+#define SMASH_SCHEDULER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Hierarchical timing wheel: LEVELS wheels of SLOTS slots, a slot of level n spans SLOTS^n ticks.
+ * Adding and cancelling a timer is O(1) (intrusive lists). A tick expires one slot of level 0, and
+ * every SLOTS^n ticks the next slot of level n is cascaded into the levels below, so a timer moves
+ * down at most LEVELS - 1 times in its life whatever the number of timers.
+ */
+class TimerWheel {
+public:
+    static const int LEVEL_BITS = 6;
+    static const int SLOTS = 1 << LEVEL_BITS;
+    static const int LEVELS = 4;
+
+    struct Timer {
+        Timer* prev = nullptr;
+        Timer* next = nullptr;
+        uint64_t expires = 0;   // Tick
+        bool isPending() const { return prev != nullptr; }
+    };
+
+    explicit TimerWheel(uint64_t now);
+    ~TimerWheel() = default;
+    TimerWheel(TimerWheel const &) = delete;
+    void operator=(TimerWheel const &) = delete;
+
+    // Schedules timer for timer->expires (at the earliest the next tick)
+    void add(Timer* timer);
+    void cancel(Timer* timer);
+    // Moves the wheel to tick now, appending the timers that expired on the way
+    void advance(uint64_t now, std::vector<Timer*>& expired);
+    // The first tick advance() has anything to do at, UINT64_MAX when the wheel is empty
+    uint64_t nextWakeup() const;
+    bool empty() const;
+
+private:
+    // Circular lists, m_slots[level][slot] is the head (a sentinel that never expires)
+    Timer m_slots[LEVELS][SLOTS];
+    uint64_t m_current;
+    size_t m_count;
+
+    void place(Timer* timer);
+    void cascade(int level);
+};
+
+/*
+ * every <interval> <command>: runs command as a background job every interval, driven by a
+ * TimerWheel of TICK_MS ticks. The shell wakes up through fd() (a timerfd armed for the wheel's
+ * next wakeup) while it waits for input, and checks for due runs before every command line.
+ * Runs keep to a fixed rate (periods missed while the shell was busy are skipped). A run that
+ * comes while the previous one is still running is skipped, or with QUEUE started as soon as it
+ * finishes (at most one run waits).
+ */
+class Scheduler {
+public:
+    static const int64_t TICK_MS = 10;
+    enum OverlapPolicy {SKIP, QUEUE};
+
+private:
+    struct Entry : TimerWheel::Timer {
+        int id;
+        std::string cmdLine;
+        int64_t intervalMs;
+        OverlapPolicy policy;
+        int64_t dueMs;          // When the next run should start
+        pid_t pid;              // The last run, 0 if none
+        bool queued;            // A run waits for the last one to finish
+        int64_t queuedDueMs;    // When the waiting run was due
+        uint64_t runs;
+        uint64_t skipped;
+        int64_t totalLatenessMs;
+        int64_t maxLatenessMs;
+    };
+
+    std::unique_ptr<TimerWheel> m_wheel;
+    std::vector<std::unique_ptr<Entry>> m_entries;
+    std::vector<Entry*> m_queued;
+    int m_timerFd;
+    uint64_t m_armedTick;
+    pid_t m_owner;          // The shell that scheduled the entries
+
+    static int64_t nowMs();
+    void schedule(Entry* entry);
+    void start(Entry* entry, int64_t due_ms, int64_t now_ms);
+    void arm();
+
+public:
+    Scheduler();
+    ~Scheduler();
+    Scheduler(Scheduler const &) = delete;
+    void operator=(Scheduler const &) = delete;
+
+    // Returns the id of the new entry
+    int add(int64_t interval_ms, const std::string& cmd_line, OverlapPolicy policy);
+    bool remove(int id);
+    // Prints "<id>: every <interval>s [-q] <command> : runs, skipped, lateness" per entry
+    void list(std::ostream& out) const;
+
+    // Readable when a run is due, -1 while nothing is scheduled
+    int fd() const;
+    // Starts the runs that are due
+    void runDue();
+};
+
+#endif //SMASH_SCHEDULER_H_
@@ -0,0 +1,632 @@
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <glob.h>
+#include "Script.h"
+#include "Commands.h"
+
+extern volatile sig_atomic_t smash_interrupted;
+
+// Tokens of the control flow level, the words of a simple command are kept as written
+struct Token {
+    enum Type {WORD, SEMICOLON, NEWLINE, AND, OR, AMPERSAND, LEFT_PAREN, RIGHT_PAREN, END};
+    Type type;
+    size_t start;
+    size_t end;
+    bool quoted;
+};
+
+/*
+ * Splits source into tokens. '&' stays part of a word in redirections (2>&1, &>file, |&).
+ * Returns false when a quote or a command substitution is not closed, the tokens up to it are
+ * still produced.
+ */
+static bool tokenize(const std::string& source, std::vector<Token>& tokens) {
+    size_t len = source.size();
+    size_t pos = 0;
+    while (true) {
+        pos = source.find_first_not_of(" \t", pos);
+        if (pos == std::string::npos) {
+            tokens.push_back({Token::END, len, len, false});
+            return true;
+        }
+
+        char c = source[pos];
+        char next = (pos + 1 < len) ? source[pos + 1] : '\0';
+        Token::Type type = Token::WORD;
+        size_t length = 1;
+        if (c == '#') {
+            pos = source.find('\n', pos);
+            pos = (pos == std::string::npos) ? len : pos;
+            continue;
+        } else if (c == '\n') {
+            type = Token::NEWLINE;
+        } else if (c == ';') {
+            type = Token::SEMICOLON;
+        } else if (c == '(') {
+            type = Token::LEFT_PAREN;
+        } else if (c == ')') {
+            type = Token::RIGHT_PAREN;
+        } else if (c == '&' && next == '&') {
+            type = Token::AND;
+            length = 2;
+        } else if (c == '|' && next == '|') {
+            type = Token::OR;
+            length = 2;
+        } else if (c == '&' && next != '>') {
+            type = Token::AMPERSAND;
+        }
+        if (type != Token::WORD) {
+            tokens.push_back({type, pos, pos + length, false});
+            pos += length;
+            continue;
+        }
+
+        size_t start = pos;
+        bool quoted = false;
+        while (pos < len) {
+            c = source[pos];
+            next = (pos + 1 < len) ? source[pos + 1] : '\0';
+            if (c == '\'' || c == '"') {
+                size_t close = source.find(c, pos + 1);
+                if (close == std::string::npos) {
+                    tokens.push_back({Token::END, len, len, false});
+                    return false;
+                }
+                quoted = true;
+                pos = close + 1;
+                continue;
+            }
+            if ((c == '$' && next == '(') || c == '`') {
+                // A command substitution is part of the word, whatever it holds
+                size_t end = SmallShell::substitutionEnd(source.c_str(), pos, len);
+                if (end == std::string::npos) {
+                    tokens.push_back({Token::END, len, len, false});
+                    return false;
+                }
+                pos = end;
+                continue;
+            }
+            if (strchr(" \t\n;()", c) != nullptr || (c == '|' && next == '|')) {
+                break;
+            }
+            if (c == '&' && next != '>' && (pos == start || strchr("<>|", source[pos - 1]) == nullptr)) {
+                break;
+            }
+            ++pos;
+        }
+        tokens.push_back({Token::WORD, start, pos, quoted});
+    }
+}
+
+static bool isName(const std::string& word) {
+    if (word.empty() || isdigit(word[0])) {
+        return false;
+    }
+    for (char c : word) {
+        if (!isalnum(c) && c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Adds field to words, or the paths it matches when it has wildcards that match any
+static void addMatches(const std::string& field, std::vector<std::string>& words) {
+    if (field.find_first_of("*?[") != std::string::npos) {
+        glob_t matches;
+        if (glob(field.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; i++) {
+                words.emplace_back(matches.gl_pathv[i]);
+            }
+            globfree(&matches);
+            return;
+        }
+        globfree(&matches);
+    }
+    words.push_back(field);
+}
+
+/*
+ * The words a for loop iterates over: parameters and command substitutions expanded, then an
+ * unquoted word is split on whitespace and its wildcards matched, a quoted one loses its quotes
+ */
+static void expandWord(const std::string& word, std::vector<std::string>& words) {
+    // Kept on the heap, a loop may be entered many times within the same line
+    ArenaString expanded{ArenaAllocator<char>(nullptr)};
+    char quote = '\0';
+    SmallShell::getInstance().expandParameters(word.data(), word.size(), expanded, quote);
+    if (word.find_first_of("'\"") == std::string::npos) {
+        size_t pos = expanded.find_first_not_of(" \t\n");
+        while (pos != std::string::npos) {
+            size_t end = expanded.find_first_of(" \t\n", pos);
+            addMatches(std::string(expanded.c_str() + pos, std::min(end, expanded.size()) - pos), words);
+            pos = expanded.find_first_not_of(" \t\n", end);
+        }
+        return;
+    }
+    std::string unquoted;
+    for (char c : expanded) {
+        if (c != '\'' && c != '"') {
+            unquoted += c;
+        }
+    }
+    words.push_back(unquoted);
+}
+
+// Compiler
+
+class ScriptCompiler {
+    const std::string& m_source;
+    std::vector<Token> m_tokens;
+    size_t m_pos;
+    bool m_incomplete;
+    std::string m_error;
+
+    const Token& peek() const {
+        return m_tokens[m_pos];
+    }
+
+    std::string text(const Token& token) const {
+        return m_source.substr(token.start, token.end - token.start);
+    }
+
+    bool isWord(const Token& token, const char* word) const {
+        return token.type == Token::WORD && !token.quoted &&
+               m_source.compare(token.start, token.end - token.start, word) == 0;
+    }
+
+    // Words that end the list before them
+    bool isReserved(const Token& token) const {
+        static const char* const RESERVED[] = {"then", "elif", "else", "fi", "do", "done", "}"};
+        for (const char* word : RESERVED) {
+            if (isWord(token, word)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool fail(const Token& token) {
+        if (token.type == Token::END) {
+            m_incomplete = true;
+        } else {
+            m_error = "syntax error near unexpected token `" +
+                      (token.type == Token::NEWLINE ? std::string("newline") : text(token)) + "'";
+        }
+        return false;
+    }
+
+    bool expect(const char* word) {
+        if (!isWord(peek(), word)) {
+            return fail(peek());
+        }
+        ++m_pos;
+        return true;
+    }
+
+    void skipNewlines() {
+        while (peek().type == Token::NEWLINE) {
+            ++m_pos;
+        }
+    }
+
+    static int emit(Script& script, Script::OpCode op, int arg = 0) {
+        script.m_code.push_back({op, arg});
+        return static_cast<int>(script.m_code.size()) - 1;
+    }
+
+    // Makes the jump at instruction continue at the next instruction emitted
+    static void patch(Script& script, int instruction) {
+        script.m_code[instruction].arg = static_cast<int>(script.m_code.size());
+    }
+
+    bool parseList(Script& script);
+    bool parseAndOr(Script& script);
+    bool parseCommand(Script& script);
+    bool parseSimpleCommand(Script& script);
+    bool parseIf(Script& script);
+    bool parseLoop(Script& script, bool until);
+    bool parseFor(Script& script);
+    bool parseFunction(Script& script, const std::string& name);
+
+public:
+    explicit ScriptCompiler(const std::string& source) : m_source(source), m_pos(0), m_incomplete(false) {}
+
+    Script::CompileResult compile(Script& script, std::string& error) {
+        if (!tokenize(m_source, m_tokens)) {
+            m_incomplete = true;
+        }
+        bool compiled = parseList(script) && (peek().type == Token::END || fail(peek()));
+        if (m_incomplete) {
+            return Script::INCOMPLETE;
+        }
+        if (!compiled) {
+            error = m_error;
+            return Script::SYNTAX_ERROR;
+        }
+        return Script::COMPILED;
+    }
+};
+
+// list: and_or ((';' | newline) and_or)*, up to the end or a reserved word
+bool ScriptCompiler::parseList(Script& script) {
+    while (true) {
+        skipNewlines();
+        if (peek().type == Token::END || isReserved(peek())) {
+            return true;
+        }
+        if (!parseAndOr(script)) {
+            return false;
+        }
+        // A command sent to the background by '&' needs no other separator
+        const Token& separator = peek();
+        if (separator.type == Token::SEMICOLON || separator.type == Token::NEWLINE) {
+            ++m_pos;
+        } else if (separator.type != Token::END && !isReserved(separator) &&
+                   m_tokens[m_pos - 1].type != Token::AMPERSAND) {
+            return fail(separator);
+        }
+    }
+}
+
+// and_or: command (('&&' | '||') command)*, each operator skips the next command
+bool ScriptCompiler::parseAndOr(Script& script) {
+    if (!parseCommand(script)) {
+        return false;
+    }
+    while (peek().type == Token::AND || peek().type == Token::OR) {
+        Script::OpCode op = (peek().type == Token::AND) ? Script::JUMP_IF_FAILED : Script::JUMP_IF_SUCCEEDED;
+        ++m_pos;
+        skipNewlines();
+        int jump = emit(script, op);
+        if (!parseCommand(script)) {
+            return false;
+        }
+        patch(script, jump);
+    }
+    return true;
+}
+
+bool ScriptCompiler::parseCommand(Script& script) {
+    const Token& token = peek();
+    if (token.type != Token::WORD || isReserved(token)) {
+        return fail(token);
+    }
+
+    bool compound = true;
+    bool parsed;
+    if (isWord(token, "if")) {
+        parsed = parseIf(script);
+    } else if (isWord(token, "while") || isWord(token, "until")) {
+        parsed = parseLoop(script, isWord(token, "until"));
+    } else if (isWord(token, "for")) {
+        parsed = parseFor(script);
+    } else if (isWord(token, "{")) {
+        ++m_pos;
+        parsed = parseList(script) && expect("}");
+    } else if (isWord(token, "function")) {
+        ++m_pos;
+        if (peek().type != Token::WORD || !isName(text(peek()))) {
+            return fail(peek());
+        }
+        std::string name = text(peek());
+        ++m_pos;
+        parsed = parseFunction(script, name);
+    } else if (m_tokens[m_pos + 1].type == Token::LEFT_PAREN && isName(text(token))) {
+        ++m_pos;
+        parsed = parseFunction(script, text(token));
+    } else {
+        compound = false;
+        parsed = parseSimpleCommand(script);
+    }
+
+    // Compound commands cannot run in the background
+    if (parsed && compound && peek().type == Token::AMPERSAND) {
+        return fail(peek());
+    }
+    return parsed;
+}
+
+// The words up to the next operator, run by the existing command path (pipes and redirections included)
+bool ScriptCompiler::parseSimpleCommand(Script& script) {
+    size_t start = peek().start;
+    size_t end = start;
+    while (peek().type == Token::WORD) {
+        end = peek().end;
+        ++m_pos;
+    }
+    if (peek().type == Token::AMPERSAND) {
+        end = peek().end;
+        ++m_pos;
+    }
+
+    script.m_commands.push_back({m_source.substr(start, end - start), false, false, nullptr});
+    emit(script, Script::RUN, static_cast<int>(script.m_commands.size()) - 1);
+    return true;
+}
+
+// if list; then list; [elif list; then list;]... [else list;] fi
+bool ScriptCompiler::parseIf(Script& script) {
+    ++m_pos;
+    std::vector<int> ends;
+    while (true) {
+        if (!parseList(script) || !expect("then")) {
+            return false;
+        }
+        int skip = emit(script, Script::JUMP_IF_FAILED);
+        if (!parseList(script)) {
+            return false;
+        }
+        ends.push_back(emit(script, Script::JUMP));
+        patch(script, skip);
+        if (!isWord(peek(), "elif")) {
+            break;
+        }
+        ++m_pos;
+    }
+    if (isWord(peek(), "else")) {
+        ++m_pos;
+        if (!parseList(script)) {
+            return false;
+        }
+    } else {
+        emit(script, Script::SET_STATUS, 0);
+    }
+    if (!expect("fi")) {
+        return false;
+    }
+    for (int end : ends) {
+        patch(script, end);
+    }
+    return true;
+}
+
+// while|until list; do list; done
+bool ScriptCompiler::parseLoop(Script& script, bool until) {
+    ++m_pos;
+    emit(script, Script::LOOP_ENTER, -1);
+    int top = static_cast<int>(script.m_code.size());
+    if (!parseList(script) || !expect("do")) {
+        return false;
+    }
+    int exit = emit(script, until ? Script::JUMP_IF_SUCCEEDED : Script::JUMP_IF_FAILED);
+    if (!parseList(script) || !expect("done")) {
+        return false;
+    }
+    emit(script, Script::LOOP_SAVE);
+    emit(script, Script::JUMP, top);
+    patch(script, exit);
+    emit(script, Script::LOOP_EXIT);
+    return true;
+}
+
+// for NAME [in word...]; do list; done
+bool ScriptCompiler::parseFor(Script& script) {
+    ++m_pos;
+    if (peek().type != Token::WORD || !isName(text(peek()))) {
+        return fail(peek());
+    }
+    Script::ForLoop loop;
+    loop.variable = text(peek());
+    ++m_pos;
+    skipNewlines();
+    if (isWord(peek(), "in")) {
+        ++m_pos;
+        while (peek().type == Token::WORD) {
+            loop.words.push_back(text(peek()));
+            ++m_pos;
+        }
+    }
+    if (peek().type == Token::SEMICOLON) {
+        ++m_pos;
+    }
+    skipNewlines();
+    if (!expect("do")) {
+        return false;
+    }
+
+    script.m_forLoops.push_back(loop);
+    emit(script, Script::LOOP_ENTER, static_cast<int>(script.m_forLoops.size()) - 1);
+    int next = emit(script, Script::FOR_NEXT);
+    if (!parseList(script) || !expect("done")) {
+        return false;
+    }
+    emit(script, Script::LOOP_SAVE);
+    emit(script, Script::JUMP, next);
+    patch(script, next);
+    emit(script, Script::LOOP_EXIT);
+    return true;
+}
+
+// NAME () command, the body is compiled into a script of its own that outlives this one
+bool ScriptCompiler::parseFunction(Script& script, const std::string& name) {
+    if (peek().type == Token::LEFT_PAREN) {
+        ++m_pos;
+        if (peek().type != Token::RIGHT_PAREN) {
+            return fail(peek());
+        }
+        ++m_pos;
+    }
+    skipNewlines();
+    std::shared_ptr<Script> body(new Script());
+    if (!parseCommand(*body)) {
+        return false;
+    }
+    script.m_functions.emplace_back(name, body);
+    emit(script, Script::DEFINE_FUNCTION, static_cast<int>(script.m_functions.size()) - 1);
+    return true;
+}
+
+// Script class
+
+Script::~Script() {
+    for (auto& command : m_commands) {
+        delete command.prepared;
+    }
+}
+
+Script::CompileResult Script::compile(const std::string& source, std::string& error) {
+    for (auto& command : m_commands) {
+        delete command.prepared;
+    }
+    m_code.clear();
+    m_commands.clear();
+    m_forLoops.clear();
+    m_functions.clear();
+    m_hereDocuments.clear();
+    return ScriptCompiler(source).compile(*this, error);
+}
+
+bool Script::isCompound(const char* cmd_line) {
+    std::string line(cmd_line);
+    std::vector<Token> tokens;
+    tokenize(line, tokens);
+
+    const Token& first = tokens[0];
+    if (first.type == Token::WORD && !first.quoted) {
+        static const char* const KEYWORDS[] = {"if", "while", "until", "for", "{", "function",
+                                               "then", "elif", "else", "fi", "do", "done", "}"};
+        for (const char* keyword : KEYWORDS) {
+            if (line.compare(first.start, first.end - first.start, keyword) == 0) {
+                return true;
+            }
+        }
+    }
+    for (size_t i = 0; i < tokens.size(); i++) {
+        bool trailing_ampersand = (tokens[i].type == Token::AMPERSAND && tokens[i + 1].type == Token::END);
+        if (tokens[i].type != Token::WORD && tokens[i].type != Token::END && !trailing_ampersand) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Script::keepHereDocuments(const std::vector<std::shared_ptr<HereDocument>>& documents) {
+    for (auto& function : m_functions) {
+        function.second->m_hereDocuments.insert(function.second->m_hereDocuments.end(),
+                                                documents.begin(), documents.end());
+        function.second->keepHereDocuments(documents);
+    }
+}
+
+// True when running cmd_line substitutes a command, or which command it runs depends on a parameter
+static bool isSubstitutedOrNamedByParameter(const std::string& cmd_line) {
+    if (cmd_line.find('`') != std::string::npos || cmd_line.find("$(") != std::string::npos) {
+        return true;
+    }
+    // The value of an assignment (NAME=$value) does not name the command
+    size_t start = cmd_line.find_first_not_of(" \t");
+    if (start == std::string::npos) {
+        return false;
+    }
+    std::string name = cmd_line.substr(start, cmd_line.find_first_of(" \t", start) - start);
+    return name.find('$') < name.find('=');
+}
+
+void Script::runCommand(SimpleCommand& command, SmallShell& smash) {
+    bool expand = command.dynamic;
+    if (command.prepared == nullptr && !command.nested) {
+        // Aliases are resolved once, when the command first runs
+        std::string resolved = smash.resolveAlias(command.text.c_str());
+        if (isCompound(resolved.c_str()) || isSubstitutedOrNamedByParameter(resolved)) {
+            command.nested = true;
+        } else {
+            // The command object is kept as long as the script, possibly beyond this line
+            Arena* arena = Arena::current();
+            Arena::setCurrent(nullptr);
+            command.prepared = smash.prepareCommand(resolved.c_str());
+            Arena::setCurrent(arena);
+            command.dynamic = (resolved.find('$') != std::string::npos);
+            if (command.prepared != nullptr && command.dynamic && !command.prepared->canExpandAgain()) {
+                delete command.prepared;
+                command.prepared = nullptr;
+            }
+            command.nested = (command.prepared == nullptr);
+        }
+    }
+    if (command.nested) {
+        smash.executeCommand(command.text.c_str());
+        return;
+    }
+    // Just created, its parameters have their current values
+    command.prepared->executeAgain(expand);
+    smash.setLastExitStatus(command.prepared->getExitStatus());
+}
+
+void Script::run(SmallShell& smash) {
+    struct Loop {
+        const ForLoop* forLoop;
+        std::vector<std::string> words;
+        size_t next;
+        int status;
+    };
+    std::vector<Loop> loops;
+    Arena* arena = Arena::current();
+
+    size_t pc = 0;
+    while (pc < m_code.size() && !smash_interrupted) {
+        const Instruction& instruction = m_code[pc++];
+        switch (instruction.op) {
+            case RUN: {
+                // Whatever a command allocates in the line's arena is released once it is done,
+                // so a long loop does not grow it
+                Arena::Mark mark = (arena != nullptr) ? arena->mark() : Arena::Mark{nullptr, 0};
+                runCommand(m_commands[instruction.arg], smash);
+                if (arena != nullptr) {
+                    arena->rewind(mark);
+                }
+                break;
+            }
+            case JUMP:
+                pc = instruction.arg;
+                break;
+            case JUMP_IF_FAILED:
+                if (smash.getLastExitStatus() != 0) {
+                    pc = instruction.arg;
+                }
+                break;
+            case JUMP_IF_SUCCEEDED:
+                if (smash.getLastExitStatus() == 0) {
+                    pc = instruction.arg;
+                }
+                break;
+            case SET_STATUS:
+                smash.setLastExitStatus(instruction.arg);
+                break;
+            case LOOP_ENTER: {
+                Loop loop = {nullptr, {}, 0, 0};
+                if (instruction.arg >= 0) {
+                    loop.forLoop = &m_forLoops[instruction.arg];
+                    for (const auto& word : loop.forLoop->words) {
+                        expandWord(word, loop.words);
+                    }
+                }
+                loops.push_back(std::move(loop));
+                break;
+            }
+            case FOR_NEXT: {
+                Loop& loop = loops.back();
+                if (loop.next == loop.words.size()) {
+                    pc = instruction.arg;
+                } else {
+                    const std::string& word = loop.words[loop.next++];
+                    smash.getVariables().set(loop.forLoop->variable.data(), loop.forLoop->variable.size(),
+                                             word.data(), word.size());
+                }
+                break;
+            }
+            case LOOP_SAVE:
+                loops.back().status = smash.getLastExitStatus();
+                break;
+            case LOOP_EXIT:
+                smash.setLastExitStatus(loops.back().status);
+                loops.pop_back();
+                break;
+            case DEFINE_FUNCTION:
+                smash.defineFunction(m_functions[instruction.arg].first, m_functions[instruction.arg].second);
+                smash.setLastExitStatus(0);
+                break;
+        }
+    }
+}
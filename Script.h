@@ -0,0 +1,88 @@
+#ifndef SMASH_SCRIPT_H_
+#define SMASH_SCRIPT_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Command;
+class HereDocument;
+class SmallShell;
+
+/*
+ * Command lists (;, &&, ||, &), if/elif/else, while/until, for ... in, { ... } and functions,
+ * compiled once into bytecode run by a small VM.
+ * The simple commands of a script are kept as text and turned into Command objects the first
+ * time they run. A loop body runs the same objects again, so it is never re-tokenized nor sent
+ * through SmallShell::CreateCommand. The parameters of a kept command are expanded again into its
+ * arguments before every run (see Command::executeAgain). Commands with a command substitution or
+ * a parameter in their name, and those that cannot expand again, go through executeCommand every
+ * time instead. Like aliases, a command name that becomes a function later keeps its first meaning
+ * within an already compiled script.
+ */
+class Script {
+    enum OpCode {
+        RUN,                // Runs m_commands[arg]
+        JUMP,               // Continues at arg
+        JUMP_IF_FAILED,     // Continues at arg when the last exit status is not 0
+        JUMP_IF_SUCCEEDED,  // Continues at arg when the last exit status is 0
+        SET_STATUS,         // Sets the last exit status to arg
+        LOOP_ENTER,         // Starts a loop, over the words of m_forLoops[arg] unless arg is -1
+        FOR_NEXT,           // Assigns the next word to the loop variable, or continues at arg when done
+        LOOP_SAVE,          // Records the exit status of the loop body
+        LOOP_EXIT,          // Ends the loop, its exit status is that of the last body run (0 if none)
+        DEFINE_FUNCTION     // Defines m_functions[arg]
+    };
+
+    struct Instruction {
+        OpCode op;
+        int arg;
+    };
+
+    struct SimpleCommand {
+        std::string text;
+        bool dynamic;           // Has parameters, expanded again before every run of prepared
+        bool nested;            // Run through executeCommand (compound, substituted or dynamic name)
+        Command* prepared;
+    };
+
+    struct ForLoop {
+        std::string variable;
+        std::vector<std::string> words;
+    };
+
+    std::vector<Instruction> m_code;
+    std::vector<SimpleCommand> m_commands;
+    std::vector<ForLoop> m_forLoops;
+    std::vector<std::pair<std::string, std::shared_ptr<Script>>> m_functions;
+    std::vector<std::shared_ptr<HereDocument>> m_hereDocuments;
+
+    void runCommand(SimpleCommand& command, SmallShell& smash);
+    friend class ScriptCompiler;
+
+public:
+    enum CompileResult {COMPILED, INCOMPLETE, SYNTAX_ERROR};
+
+    Script() = default;
+    ~Script();
+    Script(Script const &) = delete;
+    void operator=(Script const &) = delete;
+
+    /*
+     * Compiles source into this (empty) script. INCOMPLETE means the source ends inside a
+     * construct and may continue on the next line, on SYNTAX_ERROR error describes the problem.
+     */
+    CompileResult compile(const std::string& source, std::string& error);
+
+    // Keeps documents open as long as the functions this script defines, the lines may refer to them
+    void keepHereDocuments(const std::vector<std::shared_ptr<HereDocument>>& documents);
+
+    // Runs the script, the exit status is left in SmallShell::getLastExitStatus()
+    void run(SmallShell& smash);
+
+    // True when cmd_line uses anything beyond a single (possibly piped or redirected) command
+    static bool isCompound(const char* cmd_line);
+};
+
+#endif //SMASH_SCRIPT_H_
@@ -0,0 +1,167 @@
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <iostream>
+#include <memory>
+#include "Server.h"
+#include "Commands.h"
+#include "LineReader.h"
+
+static const size_t MAX_REQUEST_SIZE = 64 * 1024;
+static const int REQUEST_FDS = 3;
+
+// Installs the descriptors received with a request as the session's stdin, stdout and stderr
+static void installDescriptors(const int* fds, int num_fds) {
+    std::cout.flush();
+    std::cerr.flush();
+    if (num_fds == REQUEST_FDS) {
+        for (int fd = 0; fd < REQUEST_FDS; fd++) {
+            if (dup2(fds[fd], fd) == -1) {
+                perror("smash error: dup2 failed");
+            }
+        }
+    }
+    for (int i = 0; i < num_fds; i++) {
+        close(fds[i]);
+    }
+}
+
+static void serveSession(int connection) {
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd != -1) {
+        int fds[REQUEST_FDS] = {null_fd, dup(null_fd), dup(null_fd)};
+        installDescriptors(fds, REQUEST_FDS);
+    }
+
+    static char request[MAX_REQUEST_SIZE];
+    char control[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+    SmallShell& smash = SmallShell::getInstance();
+    std::unique_ptr<LineReader> reader;
+
+    while (true) {
+        struct iovec iov = {request, sizeof(request)};
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t len = recvmsg(connection, &msg, MSG_CMSG_CLOEXEC);
+        if (len == -1 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            return; // The client closed the connection
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                int fds[REQUEST_FDS];
+                int num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                memcpy(fds, CMSG_DATA(cmsg), num_fds * sizeof(int));
+                installDescriptors(fds, num_fds);
+            }
+        }
+
+        if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+            std::cerr << "smash error: request too long" << std::endl;
+            int32_t reply = 2;
+            send(connection, &reply, sizeof(reply), MSG_NOSIGNAL);
+            continue;
+        }
+
+        // The request may hold several lines (and here-documents), like a -c script
+        std::unique_ptr<LineReader> next_reader(new LineReader(request, len));
+        smash.setInput(next_reader.get(), false);
+        reader = std::move(next_reader);
+        const char* cmd_line;
+        while ((cmd_line = reader->nextLine()) != nullptr) {
+            smash.executeCommand(cmd_line);
+        }
+        std::cout.flush();
+        std::cerr.flush();
+
+        int32_t reply = smash.getLastExitStatus();
+        if (send(connection, &reply, sizeof(reply), MSG_NOSIGNAL) == -1) {
+            return;
+        }
+    }
+}
+
+// Removes a socket file left behind by a server that is no longer running
+static void removeStaleSocket(const struct sockaddr_un& address) {
+    struct stat st;
+    if (stat(address.sun_path, &st) == -1 || !S_ISSOCK(st.st_mode)) {
+        return;
+    }
+    int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (probe == -1) {
+        return;
+    }
+    if (connect(probe, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) == -1 &&
+        errno == ECONNREFUSED) {
+        unlink(address.sun_path);
+    }
+    close(probe);
+}
+
+int Server::run(const char* socket_path) {
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        std::cerr << "smash error: --serve: socket path too long" << std::endl;
+        return 2;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listener == -1) {
+        perror("smash error: socket failed");
+        return 1;
+    }
+    removeStaleSocket(address);
+    if (bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1) {
+        perror("smash error: bind failed");
+        close(listener);
+        return 1;
+    }
+    if (listen(listener, SOMAXCONN) == -1) {
+        perror("smash error: listen failed");
+        close(listener);
+        return 1;
+    }
+
+    // ctrl-C stops the server and its sessions, finished sessions are reaped by the kernel
+    signal(SIGINT, SIG_DFL);
+    signal(SIGCHLD, SIG_IGN);
+
+    while (true) {
+        int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection == -1) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                perror("smash error: accept failed");
+            }
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("smash error: fork failed");
+        }
+        if (pid == 0) {
+            close(listener);
+            // The session waits for its own commands
+            signal(SIGCHLD, SIG_DFL);
+            serveSession(connection);
+            exit(SmallShell::getInstance().getLastExitStatus());
+        }
+        close(connection);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef SMASH_SERVER_H_
+#define SMASH_SERVER_H_
+
+/*
+ * smash --serve <socket>: runs command requests of local clients on a SOCK_SEQPACKET Unix socket.
+ * Every connection is a session served by its own forked shell, so the cwd, aliases, prompt and
+ * jobs of a session are isolated from the others and sessions run in parallel on all cores.
+ *
+ * Request: one packet holding command lines, optionally carrying three descriptors (SCM_RIGHTS)
+ *          that become the session's stdin, stdout and stderr until replaced. Output is written
+ *          straight to the client's descriptors, by default the session writes to /dev/null.
+ * Reply:   one packet holding the exit status of the last command, as an int32_t.
+ * Closing the connection (or running quit) ends the session.
+ */
+class Server {
+public:
+    // Serves until killed, returns only when the socket could not be set up
+    static int run(const char* socket_path);
+};
+
+#endif //SMASH_SERVER_H_
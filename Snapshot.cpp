@@ -0,0 +1,344 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <map>
+#include <sstream>
+#include <vector>
+#include "Snapshot.h"
+#include "Commands.h"
+#include "LineReader.h"
+
+extern char** environ;
+
+static const char SNAPSHOT_MAGIC[8] = {'S', 'M', 'A', 'S', 'H', 'S', 'N', 'P'};
+
+static bool isNameChar(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+/*
+ * True when line only sets state the snapshot keeps, adding the environment variables it expands
+ * to dependencies. Conservative: a ';' or a '|' inside quotes also disqualifies the line.
+ */
+static bool isStateLine(const char* line, std::vector<std::string>& dependencies) {
+    if (strpbrk(line, ";&|<>`") != nullptr) {
+        return false;
+    }
+    for (const char* dollar = strchr(line, '$'); dollar != nullptr; dollar = strchr(dollar + 1, '$')) {
+        const char* name = dollar + 1;
+        bool braced = (*name == '{');
+        name += braced;
+        const char* end = name;
+        while (isNameChar(*end)) {
+            ++end;
+        }
+        // $?, $$, $1, $(...) and such change from shell to shell
+        if (!ShellVariables::isValidName(name, end - name) || (braced && *end != '}')) {
+            return false;
+        }
+        dependencies.emplace_back(name, end - name);
+    }
+
+    size_t length = strcspn(line, " \t");
+    std::string first_word(line, length);
+    static const char* const STATE_COMMANDS[] = {"alias", "unalias", "chprompt", "export", "unset", "unsetenv"};
+    for (const char* command : STATE_COMMANDS) {
+        if (first_word == command) {
+            if (first_word == "unsetenv" || first_word == "unset") {
+                // unsetenv fails for a name that is not in the environment, and what unset removes
+                // from the environment depends on what the shell inherited
+                std::istringstream names(line + length);
+                std::string name;
+                while (names >> name) {
+                    dependencies.push_back(name);
+                }
+            }
+            return true;
+        }
+    }
+    if (first_word == "cd") {
+        // The snapshot keeps where cd went, which only holds for absolute paths
+        const char* target = line + length + strspn(line + length, " \t");
+        return *target == '/' || *target == '$';
+    }
+    size_t equals = first_word.find('=');
+    return equals != std::string::npos && ShellVariables::isValidName(line, equals);
+}
+
+static bool readAll(int fd, std::string& out) {
+    char buffer[64 * 1024];
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (count == -1) {
+            return false;
+        }
+        out.append(buffer, count);
+    }
+    return true;
+}
+
+static std::string currentDirectory() {
+    char path[PATH_MAX];
+    return getcwd(path, sizeof(path)) != NULL ? path : "";
+}
+
+void Snapshot::loadStartupFile() {
+    std::string rc_path;
+    const char* rc_env = getenv("SMASHRC");
+    const char* home = getenv("HOME");
+    if (rc_env != nullptr && *rc_env != '\0') {
+        rc_path = rc_env;
+    } else if (home != nullptr) {
+        rc_path = std::string(home) + "/.smashrc";
+    } else {
+        return;
+    }
+
+    int fd = open(rc_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    struct stat rc;
+    if (fstat(fd, &rc) == -1) {
+        perror("smash error: fstat failed");
+        close(fd);
+        return;
+    }
+    std::string snapshot_path = rc_path + ".snap";
+    if (apply(snapshot_path, rc)) {
+        close(fd);
+        return;
+    }
+    std::string text;
+    if (!readAll(fd, text)) {
+        perror("smash error: read failed");
+    }
+    close(fd);
+    run(text, rc, snapshot_path);
+}
+
+// Maps the snapshot and applies it, false when it is missing, stale or malformed
+bool Snapshot::apply(const std::string& path, const struct stat& rc) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat snapshot;
+    if (fstat(fd, &snapshot) == -1 || static_cast<size_t>(snapshot.st_size) < sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+    size_t size = snapshot.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    // The mapping is page aligned and every field keeps its natural alignment
+    const Header& header = *static_cast<const Header*>(data);
+    bool valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+                 header.version == SNAPSHOT_VERSION && header.size == size &&
+                 header.rcDevice == static_cast<uint64_t>(rc.st_dev) &&
+                 header.rcInode == static_cast<uint64_t>(rc.st_ino) && header.rcSize == rc.st_size &&
+                 header.rcMtimeSec == rc.st_mtim.tv_sec && header.rcMtimeNsec == rc.st_mtim.tv_nsec &&
+                 applyRecords(static_cast<const char*>(data), size, header, true);
+    if (valid) {
+        applyRecords(static_cast<const char*>(data), size, header, false);
+    }
+    munmap(data, size);
+    return valid;
+}
+
+/*
+ * Walks the records after header. With check_only, only checks that they are well formed and
+ * that the dependencies still hold, otherwise applies them to the shell.
+ */
+bool Snapshot::applyRecords(const char* data, size_t size, const Header& header, bool check_only) {
+    SmallShell& smash = SmallShell::getInstance();
+    size_t pos = sizeof(Header);
+    for (uint32_t i = 0; i < header.records; i++) {
+        if (size - pos < sizeof(Record)) {
+            return false;
+        }
+        const Record& record = *reinterpret_cast<const Record*>(data + pos);
+        const char* name = data + pos + sizeof(Record);
+        uint64_t length = sizeof(Record) + static_cast<uint64_t>(record.nameLength) + record.valueLength + 2;
+        length = (length + 3) & ~static_cast<uint64_t>(3);
+        if (length > size - pos) {
+            return false;
+        }
+        const char* value = name + record.nameLength + 1;
+        pos += length;
+
+        if (check_only) {
+            if (name[record.nameLength] != '\0' || value[record.valueLength] != '\0') {
+                return false;
+            }
+            const char* current = (record.kind == DEPENDENCY || record.kind == DEPENDENCY_UNSET) ? getenv(name) : nullptr;
+            if ((record.kind == DEPENDENCY && (current == nullptr || strcmp(current, value) != 0)) ||
+                (record.kind == DEPENDENCY_UNSET && current != nullptr)) {
+                return false;
+            }
+            continue;
+        }
+        switch (record.kind) {
+            case ENVIRONMENT:
+                setenv(name, value, 1);
+                break;
+            case UNSET_ENVIRONMENT:
+                unsetenv(name);
+                break;
+            case VARIABLE:
+                smash.getVariables().set(name, record.nameLength, value, record.valueLength);
+                break;
+            case ALIAS:
+                SmallShell::getAliases().emplace_back(std::string(name, record.nameLength),
+                                                      std::string(value, record.valueLength));
+                break;
+            case PROMPT:
+                smash.setPrompt(std::string(value, record.valueLength));
+                break;
+            case CWD:
+                if (chdir(value) == -1) {
+                    perror("smash error: chdir failed");
+                }
+                break;
+            case LAST_PWD:
+                smash.setLastPwd(record.valueLength == 0 ? currentDirectory().c_str() : value);
+                break;
+            default:
+                break;
+        }
+    }
+    return pos == size;
+}
+
+void Snapshot::appendRecord(std::string& out, RecordKind kind, const char* name, size_t name_length,
+                            const char* value, size_t value_length) {
+    Record record = {kind, static_cast<uint32_t>(name_length), static_cast<uint32_t>(value_length)};
+    out.append(reinterpret_cast<const char*>(&record), sizeof(record));
+    out.append(name, name_length);
+    out.push_back('\0');
+    out.append(value, value_length);
+    out.push_back('\0');
+    out.append((4 - out.size() % 4) % 4, '\0');
+}
+
+// Runs the rc file line by line, then saves the state it left when it only set state
+void Snapshot::run(const std::string& text, const struct stat& rc, const std::string& snapshot_path) {
+    SmallShell& smash = SmallShell::getInstance();
+    std::map<std::string, std::string> environment;
+    for (char** entry = environ; *entry != nullptr; entry++) {
+        const char* equals = strchr(*entry, '=');
+        if (equals != nullptr) {
+            environment.emplace(std::string(*entry, equals - *entry), equals + 1);
+        }
+    }
+    std::string start_directory = currentDirectory();
+
+    bool cacheable = true;
+    std::vector<std::string> dependencies;
+    LineReader reader(text.data(), text.size());
+    smash.setInput(&reader, false);
+    for (const char* line = reader.nextLine(); line != nullptr; line = reader.nextLine()) {
+        const char* start = line + strspn(line, " \t");
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+        cacheable = cacheable && isStateLine(start, dependencies) && smash.resolveAlias(start) == start;
+        smash.executeCommand(line);
+        // A failing line must fail (and complain) again in the next shell
+        cacheable = cacheable && smash.getLastExitStatus() == 0;
+    }
+    smash.setInput(nullptr, false);
+    if (!cacheable) {
+        unlink(snapshot_path.c_str());
+        return;
+    }
+
+    std::string records;
+    uint32_t count = 0;
+    auto add = [&records, &count](RecordKind kind, const std::string& name, const std::string& value) {
+        appendRecord(records, kind, name.data(), name.size(), value.data(), value.size());
+        ++count;
+    };
+    for (const std::string& name : dependencies) {
+        auto it = environment.find(name);
+        if (it != environment.end()) {
+            add(DEPENDENCY, name, it->second);
+        } else {
+            add(DEPENDENCY_UNSET, name, "");
+        }
+    }
+    std::map<std::string, std::string> remaining(environment);
+    for (char** entry = environ; *entry != nullptr; entry++) {
+        const char* equals = strchr(*entry, '=');
+        if (equals == nullptr) {
+            continue;
+        }
+        std::string name(*entry, equals - *entry);
+        auto it = remaining.find(name);
+        if (it == remaining.end() || it->second != equals + 1) {
+            add(ENVIRONMENT, name, equals + 1);
+        }
+        if (it != remaining.end()) {
+            remaining.erase(it);
+        }
+    }
+    for (const auto& removed : remaining) {
+        add(UNSET_ENVIRONMENT, removed.first, "");
+    }
+    smash.getVariables().forEach([&records, &count](const SmallString& name, const SmallString& value) {
+        appendRecord(records, VARIABLE, name.c_str(), name.size(), value.c_str(), value.size());
+        ++count;
+    });
+    for (const auto& alias : SmallShell::getAliases()) {
+        add(ALIAS, alias.first, alias.second);
+    }
+    add(PROMPT, "", smash.getPrompt());
+    if (smash.getLastPwd() != NULL) {
+        add(LAST_PWD, "", start_directory == smash.getLastPwd() ? "" : smash.getLastPwd());
+    }
+    std::string directory = currentDirectory();
+    if (directory != start_directory) {
+        add(CWD, "", directory);
+    }
+
+    Header header = {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.records = count;
+    header.size = sizeof(header) + records.size();
+    header.rcDevice = rc.st_dev;
+    header.rcInode = rc.st_ino;
+    header.rcSize = rc.st_size;
+    header.rcMtimeSec = rc.st_mtim.tv_sec;
+    header.rcMtimeNsec = rc.st_mtim.tv_nsec;
+    records.insert(0, reinterpret_cast<const char*>(&header), sizeof(header));
+
+    // Written aside and renamed, so a shell starting meanwhile never maps half a snapshot. A
+    // directory the shell cannot write to just means no snapshot.
+    std::string temporary_path = snapshot_path + ".tmp" + std::to_string(getpid());
+    int fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return;
+    }
+    size_t written = 0;
+    while (written < records.size()) {
+        ssize_t count_written = write(fd, records.data() + written, records.size() - written);
+        if (count_written == -1) {
+            break;
+        }
+        written += count_written;
+    }
+    close(fd);
+    if (written != records.size() || rename(temporary_path.c_str(), snapshot_path.c_str()) == -1) {
+        unlink(temporary_path.c_str());
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef SMASH_SNAPSHOT_H_
+#define SMASH_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <string>
+
+/*
+ * The startup file ($SMASHRC, by default ~/.smashrc) is run line by line before the first command.
+ * When all its lines only set state (alias, unalias, chprompt, export, unset, unsetenv, NAME=value
+ * and cd to an absolute path, no ';', '|', redirections or command substitutions), the state it
+ * leaves is saved to a snapshot next to it (<rc>.snap), and later shells map the snapshot and apply
+ * it instead of running the file.
+ *
+ * The snapshot is keyed on the rc file's device, inode, size and mtime, and on the values the
+ * environment variables the file expands ($NAME) had, so editing the file or running in another
+ * environment makes the next shell run the file again and rewrite the snapshot.
+ *
+ * Format (native byte order, every field 4 byte aligned):
+ *   Header                                  SNAPSHOT_MAGIC, SNAPSHOT_VERSION, the file size and
+ *                                           the rc file identity
+ *   Record*                                 kind, name and value lengths, then the name and the
+ *                                           value, each NUL terminated so they are used in place
+ * The DEPENDENCY records come first, so a stale snapshot is rejected before anything is applied.
+ */
+class Snapshot {
+public:
+    static const uint32_t SNAPSHOT_VERSION = 1;
+
+    // Runs or applies the startup file, nothing when there is none
+    static void loadStartupFile();
+
+private:
+    enum RecordKind : uint32_t {
+        DEPENDENCY,         // name had value in the environment
+        DEPENDENCY_UNSET,   // name was not in the environment
+        ENVIRONMENT,        // setenv(name, value)
+        UNSET_ENVIRONMENT,  // unsetenv(name)
+        VARIABLE,
+        ALIAS,
+        PROMPT,             // value
+        CWD,                // value
+        LAST_PWD,           // value, empty for the directory the shell started in
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t records;
+        uint64_t size;
+        uint64_t rcDevice;
+        uint64_t rcInode;
+        int64_t rcSize;
+        int64_t rcMtimeSec;
+        int64_t rcMtimeNsec;
+    };
+
+    struct Record {
+        uint32_t kind;
+        uint32_t nameLength;
+        uint32_t valueLength;
+    };
+
+    static bool apply(const std::string& path, const struct stat& rc);
+    static bool applyRecords(const char* data, size_t size, const Header& header, bool check_only);
+    static void run(const std::string& text, const struct stat& rc, const std::string& snapshot_path);
+    static void appendRecord(std::string& out, RecordKind kind, const char* name, size_t name_length,
+                             const char* value, size_t value_length);
+};
+
+#endif //SMASH_SNAPSHOT_H_
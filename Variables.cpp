@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <utility>
+#include "Variables.h"
+
+// SmallString
+
+SmallString::SmallString() : m_size(0) {
+    m_inline[0] = '\0';
+}
+
+SmallString::~SmallString() {
+    if (!isInline()) {
+        free(m_heap);
+    }
+}
+
+SmallString::SmallString(SmallString&& other) : m_size(other.m_size) {
+    memcpy(m_inline, other.m_inline, sizeof(m_inline));
+    other.m_size = 0;
+    other.m_inline[0] = '\0';
+}
+
+SmallString& SmallString::operator=(SmallString&& other) {
+    if (this != &other) {
+        clear();
+        m_size = other.m_size;
+        memcpy(m_inline, other.m_inline, sizeof(m_inline));
+        other.m_size = 0;
+        other.m_inline[0] = '\0';
+    }
+    return *this;
+}
+
+bool SmallString::isInline() const {
+    return m_size <= INLINE_CAPACITY;
+}
+
+void SmallString::assign(const char* data, size_t length) {
+    if (length <= INLINE_CAPACITY) {
+        clear();
+        memcpy(m_inline, data, length);
+        m_inline[length] = '\0';
+    } else {
+        // data may point into the current value
+        char* copy = static_cast<char*>(malloc(length + 1));
+        memcpy(copy, data, length);
+        copy[length] = '\0';
+        clear();
+        m_heap = copy;
+    }
+    m_size = length;
+}
+
+void SmallString::clear() {
+    if (!isInline()) {
+        free(m_heap);
+    }
+    m_size = 0;
+    m_inline[0] = '\0';
+}
+
+const char* SmallString::c_str() const {
+    return isInline() ? m_inline : m_heap;
+}
+
+size_t SmallString::size() const {
+    return m_size;
+}
+
+bool SmallString::equals(const char* data, size_t length) const {
+    return m_size == length && memcmp(c_str(), data, length) == 0;
+}
+
+// ShellVariables
+
+// Calls action with name NUL terminated, as getenv() and friends want it
+template <typename Action>
+static auto withTerminatedName(const char* name, size_t length, Action action) -> decltype(action("")) {
+    char buffer[128];
+    if (length < sizeof(buffer)) {
+        memcpy(buffer, name, length);
+        buffer[length] = '\0';
+        return action(buffer);
+    }
+    return action(std::string(name, length).c_str());
+}
+
+ShellVariables::ShellVariables() : m_table(INITIAL_CAPACITY), m_used(0), m_occupied(0) {}
+
+// FNV-1a
+size_t ShellVariables::hash(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<unsigned char>(name[i])) * 16777619u;
+    }
+    return hash;
+}
+
+const ShellVariables::Entry* ShellVariables::find(const char* name, size_t length) const {
+    size_t mask = m_table.size() - 1;
+    for (size_t index = hash(name, length) & mask; ; index = (index + 1) & mask) {
+        const Entry& entry = m_table[index];
+        if (entry.state == Entry::EMPTY) {
+            return nullptr;
+        }
+        if (entry.state == Entry::USED && entry.name.equals(name, length)) {
+            return &entry;
+        }
+    }
+}
+
+ShellVariables::Entry* ShellVariables::find(const char* name, size_t length) {
+    return const_cast<Entry*>(static_cast<const ShellVariables*>(this)->find(name, length));
+}
+
+// Rehashes into a table twice the size, dropping the REMOVED entries
+void ShellVariables::grow() {
+    std::vector<Entry> old_table(m_table.size() * 2);
+    old_table.swap(m_table);
+    size_t mask = m_table.size() - 1;
+    for (Entry& entry : old_table) {
+        if (entry.state != Entry::USED) {
+            continue;
+        }
+        size_t index = hash(entry.name.c_str(), entry.name.size()) & mask;
+        while (m_table[index].state != Entry::EMPTY) {
+            index = (index + 1) & mask;
+        }
+        m_table[index] = std::move(entry);
+    }
+    m_occupied = m_used;
+}
+
+const char* ShellVariables::get(const char* name, size_t length) const {
+    const Entry* entry = find(name, length);
+    if (entry != nullptr) {
+        return entry->value.c_str();
+    }
+    return withTerminatedName(name, length, [](const char* terminated) {
+        return static_cast<const char*>(getenv(terminated));
+    });
+}
+
+void ShellVariables::set(const char* name, size_t name_length, const char* value, size_t value_length) {
+    Entry* entry = find(name, name_length);
+    if (entry != nullptr) {
+        entry->value.assign(value, value_length);
+        return;
+    }
+    bool exported = withTerminatedName(name, name_length, [](const char* terminated) {
+        return getenv(terminated) != nullptr;
+    });
+    if (exported) {
+        exportName(name, name_length, value, value_length);
+        return;
+    }
+
+    // Keeps the table at most 3/4 full, so probe sequences stay short and always end
+    if ((m_occupied + 1) * 4 > m_table.size() * 3) {
+        grow();
+    }
+    size_t mask = m_table.size() - 1;
+    size_t index = hash(name, name_length) & mask;
+    while (m_table[index].state == Entry::USED) {
+        index = (index + 1) & mask;
+    }
+    Entry& slot = m_table[index];
+    if (slot.state == Entry::EMPTY) {
+        ++m_occupied;
+    }
+    slot.state = Entry::USED;
+    slot.name.assign(name, name_length);
+    slot.value.assign(value, value_length);
+    ++m_used;
+}
+
+void ShellVariables::exportName(const char* name, size_t name_length, const char* value, size_t value_length) {
+    Entry* entry = find(name, name_length);
+    std::string exported_value;
+    if (value != nullptr) {
+        exported_value.assign(value, value_length);
+    } else if (entry != nullptr) {
+        exported_value.assign(entry->value.c_str(), entry->value.size());
+    } else {
+        // export NAME of an unset name, nothing to put in the environment yet
+        return;
+    }
+    if (entry != nullptr) {
+        entry->state = Entry::REMOVED;
+        entry->name.clear();
+        entry->value.clear();
+        --m_used;
+    }
+    withTerminatedName(name, name_length, [&exported_value](const char* terminated) {
+        return setenv(terminated, exported_value.c_str(), 1);
+    });
+}
+
+bool ShellVariables::unset(const char* name, size_t length) {
+    Entry* entry = find(name, length);
+    if (entry != nullptr) {
+        entry->state = Entry::REMOVED;
+        entry->name.clear();
+        entry->value.clear();
+        --m_used;
+        return true;
+    }
+    return withTerminatedName(name, length, [](const char* terminated) {
+        if (getenv(terminated) == nullptr) {
+            return false;
+        }
+        unsetenv(terminated);
+        return true;
+    });
+}
+
+bool ShellVariables::isValidName(const char* name, size_t length) {
+    if (length == 0 || !(isalpha(static_cast<unsigned char>(name[0])) || name[0] == '_')) {
+        return false;
+    }
+    for (size_t i = 1; i < length; i++) {
+        if (!(isalnum(static_cast<unsigned char>(name[i])) || name[i] == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,93 @@
+#ifndef SMASH_VARIABLES_H_
+#define SMASH_VARIABLES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * A string that keeps up to INLINE_CAPACITY characters inside the object and only longer
+ * ones on the heap. Always NUL terminated.
+ */
+class SmallString {
+public:
+    static const size_t INLINE_CAPACITY = 22;
+
+    SmallString();
+    ~SmallString();
+    SmallString(SmallString&& other);
+    SmallString& operator=(SmallString&& other);
+    SmallString(SmallString const &) = delete;
+    void operator=(SmallString const &) = delete;
+
+    void assign(const char* data, size_t length);
+    void clear();
+    const char* c_str() const;
+    size_t size() const;
+    bool equals(const char* data, size_t length) const;
+
+private:
+    size_t m_size;
+    union {
+        char m_inline[INLINE_CAPACITY + 1];
+        char* m_heap;
+    };
+
+    bool isInline() const;
+};
+
+/*
+ * Shell variables (NAME=value), looked up by the tokenizer for every $NAME it expands.
+ * Unexported variables live in an open addressing table of SmallStrings, so short names and
+ * values take no heap allocation. Exported ones live in the environment only - assigning a name
+ * that is already in the environment updates it there, and names that were never assigned in the
+ * shell are looked up there.
+ */
+class ShellVariables {
+    static const size_t INITIAL_CAPACITY = 16;
+
+    struct Entry {
+        enum State : uint8_t {EMPTY, USED, REMOVED};
+        State state = EMPTY;
+        SmallString name;
+        SmallString value;
+    };
+
+    std::vector<Entry> m_table;
+    size_t m_used;      // USED entries
+    size_t m_occupied;  // USED and REMOVED entries, which both lengthen the probe sequences
+
+    static size_t hash(const char* name, size_t length);
+    Entry* find(const char* name, size_t length);
+    const Entry* find(const char* name, size_t length) const;
+    void grow();
+
+public:
+    ShellVariables();
+    ~ShellVariables() = default;
+    ShellVariables(ShellVariables const &) = delete;
+    void operator=(ShellVariables const &) = delete;
+
+    // The value of name (not NUL terminated), or NULL when it is not set
+    const char* get(const char* name, size_t length) const;
+    void set(const char* name, size_t name_length, const char* value, size_t value_length);
+    // Moves name to the environment, with the given value when value is not NULL
+    void exportName(const char* name, size_t name_length, const char* value, size_t value_length);
+    // Removes name from the shell and the environment, false when it was not set
+    bool unset(const char* name, size_t length);
+
+    // True for [A-Za-z_][A-Za-z0-9_]*
+    static bool isValidName(const char* name, size_t length);
+
+    // Calls visit(const SmallString& name, const SmallString& value) for every unexported variable
+    template <typename Visitor>
+    void forEach(Visitor visit) const {
+        for (const Entry& entry : m_table) {
+            if (entry.state == Entry::USED) {
+                visit(entry.name, entry.value);
+            }
+        }
+    }
+};
+
+#endif //SMASH_VARIABLES_H_
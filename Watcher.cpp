@@ -0,0 +1,220 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <iostream>
+#include "Watcher.h"
+
+struct linux_dirent64 {
+    unsigned long  d_ino;
+    off_t          d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+const uint32_t FileWatcher::EVENTS = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE |
+                                     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+static int64_t nanoseconds(const struct timespec& time) {
+    return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+// Calls visit(dir_fd, name, is_directory) for every entry of the directory at path but . and ..
+template <typename Visitor>
+static bool forEachEntry(const std::string& path, Visitor visit) {
+    int dir = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir == -1) {
+        return false;
+    }
+    char buffer[32 * 1024];
+    long nread;
+    while ((nread = syscall(SYS_getdents64, dir, buffer, sizeof(buffer))) > 0) {
+        for (long pos = 0; pos < nread; ) {
+            auto* entry = reinterpret_cast<struct linux_dirent64*>(buffer + pos);
+            pos += entry->d_reclen;
+            const char* name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            bool is_directory = (entry->d_type == DT_DIR);
+            struct stat st;
+            if (entry->d_type == DT_UNKNOWN && fstatat(dir, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                is_directory = S_ISDIR(st.st_mode);
+            }
+            visit(dir, name, is_directory);
+        }
+    }
+    close(dir);
+    return true;
+}
+
+// Changes when an entry of the directory is added, removed or modified, -1 if it is gone
+static int64_t directorySignature(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1) {
+        return -1;
+    }
+    int64_t signature = nanoseconds(st.st_mtim);
+    forEachEntry(path, [&signature](int dir, const char* name, bool) {
+        struct stat entry;
+        if (fstatat(dir, name, &entry, AT_SYMLINK_NOFOLLOW) == 0) {
+            signature = signature * 31 + nanoseconds(entry.st_mtim) + static_cast<int64_t>(entry.st_ino);
+        }
+    });
+    return signature;
+}
+
+FileWatcher::FileWatcher(bool recursive) : m_recursive(recursive), m_limitReported(false) {
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd == -1) {
+        perror("smash error: inotify_init1 failed");
+    }
+}
+
+FileWatcher::~FileWatcher() {
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+// Adds a watch, or polls the directory when the watch limit is reached
+bool FileWatcher::watch(const std::string& path, bool is_directory) {
+    int wd = inotify_add_watch(m_fd, path.c_str(), EVENTS | (is_directory ? IN_ONLYDIR : 0));
+    if (wd != -1) {
+        m_watches[wd] = path;
+        return true;
+    }
+    if (errno != ENOSPC || !is_directory) {
+        return false;
+    }
+    if (!m_limitReported) {
+        std::cerr << "smash: watchrun: inotify watch limit reached (fs.inotify.max_user_watches), "
+                     "polling the remaining directories" << std::endl;
+        m_limitReported = true;
+    }
+    for (const Unwatched& unwatched : m_unwatched) {
+        if (unwatched.path == path) {
+            return true;
+        }
+    }
+    m_unwatched.push_back({path, directorySignature(path)});
+    return true;
+}
+
+// Watches the directory at path and, when recursive, the ones below it (not through symbolic links)
+void FileWatcher::watchTree(const std::string& path) {
+    if (!watch(path, true) || !m_recursive) {
+        return;
+    }
+    std::vector<std::string> directories;
+    forEachEntry(path, [&](int, const char* name, bool is_directory) {
+        if (is_directory) {
+            directories.push_back(path + "/" + name);
+        }
+    });
+    for (const std::string& directory : directories) {
+        watchTree(directory);
+    }
+}
+
+bool FileWatcher::add(const std::string& path) {
+    struct stat st;
+    if (m_fd == -1 || stat(path.c_str(), &st) == -1) {
+        return false;
+    }
+    m_paths.push_back(path);
+    if (!S_ISDIR(st.st_mode)) {
+        return watch(path, false);
+    }
+    size_t watched = m_watches.size() + m_unwatched.size();
+    watchTree(path);
+    return m_watches.size() + m_unwatched.size() > watched;
+}
+
+void FileWatcher::rewatch() {
+    for (const std::string& path : m_paths) {
+        bool watched = false;
+        for (const auto& entry : m_watches) {
+            watched = watched || entry.second == path;
+        }
+        struct stat st;
+        if (!watched && stat(path.c_str(), &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                watchTree(path);
+            } else {
+                watch(path, false);
+            }
+        }
+    }
+}
+
+int FileWatcher::fd() const {
+    return m_fd;
+}
+
+size_t FileWatcher::readEvents(std::string& changed) {
+    size_t changes = 0;
+    alignas(struct inotify_event) char buffer[16 * 1024];
+    ssize_t nread;
+    while ((nread = read(m_fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t pos = 0; pos < nread; ) {
+            auto* event = reinterpret_cast<struct inotify_event*>(buffer + pos);
+            pos += sizeof(struct inotify_event) + event->len;
+            auto watch = m_watches.find(event->wd);
+            if (event->mask & IN_IGNORED) {
+                if (watch != m_watches.end()) {
+                    m_watches.erase(watch);
+                }
+                continue;
+            }
+            std::string path;
+            if (event->mask & IN_Q_OVERFLOW) {
+                path = "(events lost)";
+            } else if (watch != m_watches.end()) {
+                path = (event->len > 0) ? watch->second + "/" + event->name : watch->second;
+            }
+            bool new_directory = (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO));
+            if (m_recursive && new_directory && !path.empty()) {
+                watchTree(path);
+            }
+            if (changes++ == 0) {
+                changed = path;
+            }
+        }
+    }
+    return changes;
+}
+
+size_t FileWatcher::unwatchedCount() const {
+    return m_unwatched.size();
+}
+
+bool FileWatcher::pollUnwatched(std::string& changed) {
+    bool any = false;
+    // watchTree() may append to m_unwatched while it is walked
+    for (size_t i = 0; i < m_unwatched.size(); i++) {
+        int64_t signature = directorySignature(m_unwatched[i].path);
+        if (signature == m_unwatched[i].signature) {
+            continue;
+        }
+        m_unwatched[i].signature = signature;
+        if (!any) {
+            changed = m_unwatched[i].path;
+            any = true;
+        }
+        if (m_recursive && signature != -1) {
+            std::string path = m_unwatched[i].path;
+            forEachEntry(path, [this, &path](int, const char* name, bool is_directory) {
+                if (is_directory) {
+                    watchTree(path + "/" + name);
+                }
+            });
+        }
+    }
+    return any;
+}
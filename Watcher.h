@@ -0,0 +1,59 @@
+#ifndef SMASH_WATCHER_H_
+#define SMASH_WATCHER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Watches files and directory trees for changes with one inotify descriptor (watchrun).
+ * Directories created inside a recursively watched tree are watched as soon as their creation is
+ * read. When the watch limit (fs.inotify.max_user_watches) runs out, the directories left over are
+ * polled instead: pollUnwatched() compares their entries' modification times with the last poll.
+ * A watched path that is replaced (an editor saving through a rename) is watched again by
+ * rewatch().
+ */
+class FileWatcher {
+    static const uint32_t EVENTS;
+
+    struct Unwatched {
+        std::string path;
+        int64_t signature;
+    };
+
+    bool m_recursive;
+    int m_fd;
+    std::unordered_map<int, std::string> m_watches;     // Watch descriptor to path
+    std::vector<std::string> m_paths;                   // As given to add()
+    std::vector<Unwatched> m_unwatched;
+    bool m_limitReported;
+
+    bool watch(const std::string& path, bool is_directory);
+    void watchTree(const std::string& path);
+
+public:
+    explicit FileWatcher(bool recursive);
+    ~FileWatcher();
+    FileWatcher(FileWatcher const &) = delete;
+    void operator=(FileWatcher const &) = delete;
+
+    // Watches path (a file or a directory), false if it does not exist or inotify failed
+    bool add(const std::string& path);
+    // Watches the paths given to add() again where their watch went away with the file
+    void rewatch();
+    // Readable when events are pending
+    int fd() const;
+    /*
+     * Reads the pending events and returns how many of them were changes, changed is set to the
+     * path of the first one.
+     */
+    size_t readEvents(std::string& changed);
+    // The number of directories polled because of the watch limit
+    size_t unwatchedCount() const;
+    // Checks the polled directories, true (with the path in changed) when one of them changed
+    bool pollUnwatched(std::string& changed);
+};
+
+#endif //SMASH_WATCHER_H_
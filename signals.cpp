@@ -4,10 +4,12 @@
 #include "signals.h"
 #include "Commands.h"
 extern pid_t smash_fg_pid;
+extern volatile sig_atomic_t smash_interrupted;
 
 void ctrlCHandler(int sig_num) {
     // TODO: Add your implementation
     std::cout << "smash: got ctrl-C" << std::endl;
+    smash_interrupted = 1;
 
     if (smash_fg_pid != 0) {
         int ret = kill(smash_fg_pid, SIGKILL);
@@ -1,23 +1,126 @@
 #include <iostream>
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
+#include <fcntl.h>
 #include <signal.h>
 #include "Commands.h"
+#include "FdStream.h"
+#include "LineEditor.h"
+#include "LineReader.h"
+#include "Launcher.h"
+#include "Server.h"
+#include "Snapshot.h"
 #include "signals.h"
 pid_t smash_fg_pid = 0;
+// Set by ctrl-C, stops a running script
+volatile sig_atomic_t smash_interrupted = 0;
 
 int main(int argc, char *argv[]) {
     if (signal(SIGINT, ctrlCHandler) == SIG_ERR) {
         perror("smash error: failed to set ctrl-C handler");
     }
+    // Built-ins print through a buffer of the shell's own (see FdStream.h). It is never freed, so
+    // it is still there when std::cout is flushed on exit.
+    std::cout.rdbuf(new FdStreamBuf(STDOUT_FILENO));
 
+    /*
+     * smash                 - interactive when stdin is a terminal, otherwise reads the script from stdin
+     * smash -c <commands> [$0 [args]] - runs the given command lines
+     * smash <script> [args] - runs the script file, args are $1, $2, ...
+     * smash --serve <socket> - runs the commands of local clients (see Server.h)
+     * The prompt is only shown in interactive mode, where a terminal also gets line editing
+     * (see LineEditor.h).
+     * --launcher (first) spawns external commands through a launcher process forked right now,
+     * while the shell is still small.
+     * The startup file (see Snapshot.h) is loaded except for scripts and with --norc (next).
+     */
+    if (argc >= 2 && strcmp(argv[1], "--launcher") == 0) {
+        Launcher::start();
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    bool load_startup_file = true;
+    if (argc >= 2 && strcmp(argv[1], "--norc") == 0) {
+        load_startup_file = false;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--serve") == 0) {
+        if (argc < 3) {
+            std::cerr << "smash error: --serve: option requires an argument" << std::endl;
+            return 2;
+        }
+        if (load_startup_file) {
+            // Loaded once, every session starts from it
+            Snapshot::loadStartupFile();
+        }
+        return Server::run(argv[2]);
+    }
 
     SmallShell &smash = SmallShell::getInstance();
+    LineReader* reader;
+    LineEditor* editor = nullptr;
+    bool interactive = false;
+    if (argc >= 2 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            std::cerr << "smash error: -c: option requires an argument" << std::endl;
+            return 2;
+        }
+        reader = new LineReader(argv[2], strlen(argv[2]));
+        smash.setScriptParameters(std::vector<std::string>(argv + 3, argv + argc));
+    } else if (argc >= 2) {
+        load_startup_file = false;
+        int script = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (script == -1) {
+            perror("smash error: open failed");
+            return 127;
+        }
+        reader = new LineReader(script, true);
+        smash.setScriptParameters(std::vector<std::string>(argv + 1, argv + argc));
+    } else {
+        interactive = isatty(STDIN_FILENO);
+        reader = new LineReader(STDIN_FILENO);
+        const char* term = getenv("TERM");
+        if (interactive && isatty(STDOUT_FILENO) && (term == nullptr || strcmp(term, "dumb") != 0)) {
+            editor = new LineEditor(STDIN_FILENO, &smash.getHistory());
+            reader->setEditor(editor);
+        }
+    }
+
+    // Before the startup file, so its commands are recorded too
+    const char* audit_path = getenv("SMASH_AUDIT");
+    if (audit_path != nullptr && audit_path[0] != '\0') {
+        smash.getAuditLog().open(audit_path);
+    }
+    if (load_startup_file) {
+        Snapshot::loadStartupFile();
+    }
+    smash.setInput(reader, interactive);
+    // Like stdio, the output reaches a terminal line by line (here, command line by command line)
+    bool flush_lines = interactive || isatty(STDOUT_FILENO);
     while (true) {
-        smash.showPrompt();
-        std::string cmd_line;
-        std::getline(std::cin, cmd_line);
-        smash.executeCommand(cmd_line.c_str());
+        if (interactive) {
+            smash.showPrompt();
+        }
+        if (flush_lines) {
+            std::cout.flush();
+        }
+        const char* cmd_line = reader->nextLine();
+        if (cmd_line == nullptr) {
+            break;
+        }
+        if (interactive) {
+            smash.getHistory().add(cmd_line);
+        }
+        smash.executeCommand(cmd_line);
     }
-    return 0;
-}
\ No newline at end of file
+    delete reader;
+    delete editor;
+    std::cout.flush();
+    return smash.getLastExitStatus();
+}